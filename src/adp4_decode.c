@@ -31,6 +31,8 @@
   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
 
+#include "adp4_decode.h"
+
 #include "types_ints.h"
 
 #define INDEX_TABLE_SIZE 16
@@ -62,14 +64,6 @@ g_STEPSIZE_TABLE[STEPSIZE_TABLE_SIZE] =
     15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
   };
 
-typedef struct adp4_state_t adp4_state_t;
-struct adp4_state_t
-{
-  s32 predicted_sample;
-  s32 index;
-  s32 stepsize;
-};
-
 static
 s32
 _clamp_s32(const s64 v_,
@@ -83,63 +77,305 @@ _clamp_s32(const s64 v_,
   return v_;
 }
 
+/*
+  The difference a nibble decodes to depends only on the nibble and
+  the step index, and so does the next index. With 89 indexes a table
+  over (index, byte) holds both differences of a byte plus the index
+  after it, leaving only the sample clamps per byte. Entries are
+  packed into a u64 so a byte costs a single load:
+
+    bits  0-17: difference of the high nibble, signed
+    bits 18-35: difference of the low nibble, signed
+    bits 36-42: next index
+
+  The largest difference, 32767 + 16383 + 8191 + 4095, fits in 18
+  signed bits.
+
+  Stereo bytes hold one nibble per channel so they use a table over
+  (index, nibble) instead, packed as (difference << 7) | next index.
+*/
+#define LUT_DIFF_BITS 18
+#define LUT_DIFF_MASK ((1ULL << LUT_DIFF_BITS) - 1)
+#define LUT_INDEX_SHIFT (LUT_DIFF_BITS * 2)
+
+#define NIBBLE_LUT_INDEX_BITS 7
+#define NIBBLE_LUT_INDEX_MASK ((1 << NIBBLE_LUT_INDEX_BITS) - 1)
+
+static u64 g_LUT[STEPSIZE_TABLE_SIZE][256];
+static s32 g_NIBBLE_LUT[STEPSIZE_TABLE_SIZE][16];
+
+static
+s32
+_nibble_difference(const s32 stepsize_,
+                   const u8  nibble_)
+{
+  s32 difference;
+
+  difference = 0;
+  if(nibble_ & 0x4)
+    difference += stepsize_;
+  if(nibble_ & 0x2)
+    difference += stepsize_ >> 1;
+  if(nibble_ & 0x1)
+    difference += stepsize_ >> 2;
+  difference += stepsize_ >> 3;
+  if(nibble_ & 0x8)
+    difference = -difference;
+
+  return difference;
+}
+
+static
+s32
+_next_index(const s32 index_,
+            const u8  nibble_)
+{
+  return _clamp_s32(index_ + g_INDEX_TABLE[nibble_],0,STEPSIZE_TABLE_MAX);
+}
+
+static
+__attribute__((constructor))
 void
-adp4_decode(const u8  *input_data_,
-            const u32  input_data_sample_count_,
-            s16*       output_data_)
+_build_lut(void)
+{
+  for(s32 index = 0; index < STEPSIZE_TABLE_SIZE; index++)
+    {
+      for(s32 byte = 0; byte < 256; byte++)
+        {
+          s32 index_h;
+          s32 index_l;
+          s32 difference_h;
+          s32 difference_l;
+
+          index_h      = _next_index(index,(byte >> 4));
+          index_l      = _next_index(index_h,(byte & 0xF));
+          difference_h = _nibble_difference(g_STEPSIZE_TABLE[index],(byte >> 4));
+          difference_l = _nibble_difference(g_STEPSIZE_TABLE[index_h],(byte & 0xF));
+
+          g_LUT[index][byte] = ((((u64)difference_h & LUT_DIFF_MASK) << 0) |
+                                (((u64)difference_l & LUT_DIFF_MASK) << LUT_DIFF_BITS) |
+                                ((u64)index_l << LUT_INDEX_SHIFT));
+        }
+
+      for(s32 nibble = 0; nibble < 16; nibble++)
+        g_NIBBLE_LUT[index][nibble] =
+          ((_nibble_difference(g_STEPSIZE_TABLE[index],nibble) * (1 << NIBBLE_LUT_INDEX_BITS)) |
+           _next_index(index,nibble));
+    }
+}
+
+static
+inline
+s32
+_lut_difference_h(const u64 entry_)
+{
+  return (s32)((s64)(entry_ << (64 - LUT_DIFF_BITS)) >> (64 - LUT_DIFF_BITS));
+}
+
+static
+inline
+s32
+_lut_difference_l(const u64 entry_)
+{
+  return (s32)((s64)(entry_ << (64 - LUT_INDEX_SHIFT)) >> (64 - LUT_DIFF_BITS));
+}
+
+static
+inline
+s32
+_lut_index(const u64 entry_)
+{
+  return (s32)(entry_ >> LUT_INDEX_SHIFT);
+}
+
+static
+inline
+s32
+_nibble_lut_difference(const s32 entry_)
+{
+  return (entry_ >> NIBBLE_LUT_INDEX_BITS);
+}
+
+static
+inline
+s32
+_nibble_lut_index(const s32 entry_)
+{
+  return (entry_ & NIBBLE_LUT_INDEX_MASK);
+}
+
+static
+inline
+s32
+_clamp_s16(const s32 v_)
+{
+  return ((v_ < -32768) ? -32768 : ((v_ > 32767) ? 32767 : v_));
+}
+
+void
+adp4_decoder_init(adp4_decoder_t *decoder_,
+                  const u8        num_channels_)
+{
+  decoder_->num_channels = num_channels_;
+  for(int i = 0; i < ADP4_STEREO; i++)
+    {
+      decoder_->channels[i].sample   = 0;
+      decoder_->channels[i].index    = 0;
+      decoder_->channels[i].stepsize = 7;
+    }
+}
+
+static
+s16
+_decode_nibble(adp4_decoder_channel_t *s_,
+               const u8                nibble_)
 {
   s32 difference;
-  s32 original_sample_h;
-  s32 original_sample_l;  
-  s32 new_sample;
-  adp4_state_t s;
 
-  s.index = 0;
-  s.stepsize = 7;
-  s.predicted_sample = 0;
+  difference = 0;
+  if(nibble_ & 0x4)
+    difference += s_->stepsize;
+  if(nibble_ & 0x2)
+    difference += s_->stepsize >> 1;
+  if(nibble_ & 0x1)
+    difference += s_->stepsize >> 2;
+  difference += s_->stepsize >> 3;
+  if(nibble_ & 0x8)
+    difference = -difference;
+  s_->sample += difference;
+  s_->sample = _clamp_s32(s_->sample,-32768,32767);
+
+  s_->index += g_INDEX_TABLE[nibble_];
+  s_->index = _clamp_s32(s_->index,0,STEPSIZE_TABLE_MAX);
+  s_->stepsize = g_STEPSIZE_TABLE[s_->index];
+
+  return s_->sample;
+}
+
+void
+adp4_decoder_feed_reference(adp4_decoder_t *decoder_,
+                            const u8       *input_data_,
+                            const u32       input_data_len_,
+                            s16            *output_data_)
+{
+  adp4_decoder_channel_t *h;
+  adp4_decoder_channel_t *l;
+
+  // Mono bytes are two samples of the one channel, stereo bytes are
+  // one frame with left in the high nibble.
+  h = &decoder_->channels[0];
+  l = &decoder_->channels[decoder_->num_channels - 1];
+  for(u32 i = 0; i < input_data_len_; i++)
+    {
+      *output_data_++ = _decode_nibble(h,(input_data_[i] >> 4));
+      *output_data_++ = _decode_nibble(l,(input_data_[i] & 0x0F));
+    }
+}
+
+static
+void
+_decoder_feed_mono(adp4_decoder_channel_t *s_,
+                   const u8               *input_data_,
+                   const u32               input_data_len_,
+                   s16                    *output_data_)
+{
+  s32 index;
+  s32 sample;
+
+  index  = s_->index;
+  sample = s_->sample;
+  for(u32 i = 0; i < input_data_len_; i++)
+    {
+      u64 entry;
+
+      entry  = g_LUT[index][input_data_[i]];
+      index  = _lut_index(entry);
+
+      sample = _clamp_s16(sample + _lut_difference_h(entry));
+      *output_data_++ = sample;
+      sample = _clamp_s16(sample + _lut_difference_l(entry));
+      *output_data_++ = sample;
+    }
+
+  s_->index    = index;
+  s_->sample   = sample;
+  s_->stepsize = g_STEPSIZE_TABLE[index];
+}
+
+/*
+  The two channels' predictors don't depend on each other so both
+  chains are kept in registers and advanced side by side, letting the
+  CPU overlap their loads and clamps.
+*/
+static
+void
+_decoder_feed_stereo(adp4_decoder_channel_t *s_,
+                     const u8               *input_data_,
+                     const u32               input_data_len_,
+                     s16                    *output_data_)
+{
+  s32 index_l;
+  s32 index_r;
+  s32 sample_l;
+  s32 sample_r;
 
-  new_sample = 0;
-  for(u32 i = 0; i < input_data_sample_count_; i++)
+  index_l  = s_[0].index;
+  index_r  = s_[1].index;
+  sample_l = s_[0].sample;
+  sample_r = s_[1].sample;
+  for(u32 i = 0; i < input_data_len_; i++)
     {
-      original_sample_h = ((input_data_[i] & 0xF0) >> 4);
-      original_sample_l = ((input_data_[i] & 0x0F) >> 0);      
-
-      difference = 0;
-      if(original_sample_h & 0x4)
-        difference += s.stepsize;
-      if(original_sample_h & 0x2)
-        difference += s.stepsize >> 1;
-      if(original_sample_h & 0x1)
-        difference += s.stepsize >> 2;
-      difference += s.stepsize >> 3;
-      if(original_sample_h & 0x8)
-        difference = -difference;
-      new_sample += difference;
-      new_sample = _clamp_s32(new_sample,-32768,32767);
-
-      s.index += g_INDEX_TABLE[original_sample_h];
-      s.index = _clamp_s32(s.index,0,STEPSIZE_TABLE_MAX);
-      s.stepsize = g_STEPSIZE_TABLE[s.index];
-
-      *output_data_++ = new_sample;
-
-      difference = 0;
-      if(original_sample_l & 0x4)
-        difference += s.stepsize;
-      if(original_sample_l & 0x2)
-        difference += s.stepsize >> 1;
-      if(original_sample_l & 0x1)
-        difference += s.stepsize >> 2;
-      difference += s.stepsize >> 3;
-      if(original_sample_l & 0x8)
-        difference = -difference;
-      new_sample += difference;
-      new_sample = _clamp_s32(new_sample,-32768,32767);
-
-      s.index += g_INDEX_TABLE[original_sample_l];
-      s.index = _clamp_s32(s.index,0,STEPSIZE_TABLE_MAX);
-      s.stepsize = g_STEPSIZE_TABLE[s.index];
-
-      *output_data_++ = new_sample;
-    }  
+      s32 entry_l;
+      s32 entry_r;
+
+      entry_l  = g_NIBBLE_LUT[index_l][input_data_[i] >> 4];
+      entry_r  = g_NIBBLE_LUT[index_r][input_data_[i] & 0x0F];
+      index_l  = _nibble_lut_index(entry_l);
+      index_r  = _nibble_lut_index(entry_r);
+      sample_l = _clamp_s16(sample_l + _nibble_lut_difference(entry_l));
+      sample_r = _clamp_s16(sample_r + _nibble_lut_difference(entry_r));
+
+      *output_data_++ = sample_l;
+      *output_data_++ = sample_r;
+    }
+
+  s_[0].index    = index_l;
+  s_[1].index    = index_r;
+  s_[0].sample   = sample_l;
+  s_[1].sample   = sample_r;
+  s_[0].stepsize = g_STEPSIZE_TABLE[index_l];
+  s_[1].stepsize = g_STEPSIZE_TABLE[index_r];
+}
+
+void
+adp4_decoder_feed(adp4_decoder_t *decoder_,
+                  const u8       *input_data_,
+                  const u32       input_data_len_,
+                  s16            *output_data_)
+{
+  if(decoder_->num_channels == ADP4_STEREO)
+    _decoder_feed_stereo(decoder_->channels,
+                         input_data_,
+                         input_data_len_,
+                         output_data_);
+  else
+    _decoder_feed_mono(&decoder_->channels[0],
+                       input_data_,
+                       input_data_len_,
+                       output_data_);
+}
+
+void
+adp4_decode(const u8  *input_data_,
+            const u32  input_data_sample_count_,
+            const u8   num_channels_,
+            s16*       output_data_)
+{
+  adp4_decoder_t decoder;
+
+  adp4_decoder_init(&decoder,num_channels_);
+  adp4_decoder_feed(&decoder,
+                    input_data_,
+                    input_data_sample_count_,
+                    output_data_);
 }
@@ -24,8 +24,50 @@
 extern "C" {
 #endif
 
+#define ADP4_MONO   1
+#define ADP4_STEREO 2
+
+/*
+  Incremental decoder. Input can be fed in pieces of any size and the
+  output is identical to a single adp4_decode() of the concatenated
+  input. Every byte decodes to 2 samples. Stereo is interleaved by
+  nibble, so each byte is one frame with left in the high nibble, and
+  every channel has its own predictor.
+*/
+typedef struct adp4_decoder_channel_t adp4_decoder_channel_t;
+struct adp4_decoder_channel_t
+{
+  s32 sample;
+  s32 index;
+  s32 stepsize;
+};
+
+typedef struct adp4_decoder_t adp4_decoder_t;
+struct adp4_decoder_t
+{
+  u8                     num_channels;
+  adp4_decoder_channel_t channels[ADP4_STEREO];
+};
+
+void adp4_decoder_init(adp4_decoder_t *decoder,
+                       const u8        num_channels);
+void adp4_decoder_feed(adp4_decoder_t *decoder,
+                       const u8       *input_data,
+                       const u32       input_data_len,
+                       s16            *output_data);
+
+/*
+  The straightforward nibble at a time decoder adp4_decoder_feed() is
+  checked against. Kept for verification and benchmarking.
+*/
+void adp4_decoder_feed_reference(adp4_decoder_t *decoder,
+                                 const u8       *input_data,
+                                 const u32       input_data_len,
+                                 s16            *output_data);
+
 void adp4_decode(const u8  *input_data,
                  const u32  input_data_sample_count,
+                 const u8   num_channels,
                  s16       *output_data);
 
 #if defined __cplusplus
@@ -31,8 +31,18 @@
   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
 
+#include "adp4_encode.h"
+
 #include "types_ints.h"
 
+#include <stdlib.h>
+#include <string.h>
+
+#if defined __x86_64__ || defined __i386__
+#define ADP4_ENCODE_X86
+#include <immintrin.h>
+#endif
+
 #define INDEX_TABLE_SIZE 16
 #define STEPSIZE_TABLE_SIZE 89
 #define STEPSIZE_TABLE_MAX (STEPSIZE_TABLE_SIZE - 1)
@@ -62,13 +72,16 @@ g_STEPSIZE_TABLE[STEPSIZE_TABLE_SIZE] =
     15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
   };
 
-typedef struct adp4_state_t adp4_state_t;
-struct adp4_state_t
-{
-  s32 predicted_sample;
-  s32 index;
-  s32 stepsize;
-};
+// 32bit copy of g_STEPSIZE_TABLE for the lane kernels' gathers.
+static s32 g_STEPSIZE_TABLE_S32[STEPSIZE_TABLE_SIZE];
+
+// Decoded difference and next step index of every (index, nibble)
+// for the trellis search.
+static s32 g_DIFF_TABLE[STEPSIZE_TABLE_SIZE][16];
+static u8  g_NEXT_INDEX_TABLE[STEPSIZE_TABLE_SIZE][16];
+
+// Samples per lane passed to a lane kernel at a time. Must be even.
+#define LANE_TILE 64
 
 static
 s32
@@ -157,8 +170,8 @@ _adp4_decode_difference(const s32 stepsize_,
 
 static
 u8
-_adp4_encode_sample(adp4_state_t *s_,
-                    const s16     orig_sample_)
+_adp4_encode_sample(adp4_encoder_channel_t *s_,
+                    const s16               orig_sample_)
 {
   s32 difference;
   u8  encoded_sample;
@@ -179,34 +192,913 @@ _adp4_encode_sample(adp4_state_t *s_,
 }
 
 void
-adp4_encode(const s16 *input_data_,
-            const u32  sample_count_,
-            u8        *output_data_)
+adp4_encoder_init(adp4_encoder_t *encoder_,
+                  const u8        num_channels_)
+{
+  encoder_->num_channels = num_channels_;
+  encoder_->pending      = 0;
+  encoder_->pending_byte = 0;
+  for(int i = 0; i < ADP4_STEREO; i++)
+    {
+      encoder_->channels[i].predicted_sample = 0;
+      encoder_->channels[i].index            = 0;
+      encoder_->channels[i].stepsize         = 7;
+    }
+}
+
+u32
+adp4_encoder_feed(adp4_encoder_t *encoder_,
+                  const s16      *input_data_,
+                  const u32       sample_count_,
+                  u8             *output_data_)
 {
   u32 i_idx;
   u32 o_idx;
-  int shift;
-  adp4_state_t s;
-  u8 output_byte;
+  u8  mask;
+  u8  pending;
+  u8  output_byte;
+  adp4_encoder_t s;
 
-  s.index = 0;
-  s.predicted_sample = 0;
-  s.stepsize = 7;
+  s = *encoder_;
 
-  shift = 1;
-  for(i_idx = 0, o_idx = 0; i_idx < sample_count_; i_idx++)
+  i_idx       = 0;
+  o_idx       = 0;
+  pending     = s.pending;
+  output_byte = s.pending_byte;
+
+  /*
+    A stereo byte is one frame. The channels' predictors are
+    independent so whole frames advance both side by side, letting
+    the CPU overlap the two dependency chains. A frame split across
+    calls is finished first.
+  */
+  if(s.num_channels == ADP4_STEREO)
+    {
+      adp4_encoder_channel_t l;
+      adp4_encoder_channel_t r;
+
+      if(pending && (i_idx < sample_count_))
+        {
+          output_data_[o_idx++] = (output_byte |
+                                   _adp4_encode_sample(&s.channels[1],input_data_[i_idx++]));
+          pending = 0;
+        }
+
+      l = s.channels[0];
+      r = s.channels[1];
+      for(; (i_idx + 1) < sample_count_; i_idx += 2)
+        {
+          u8 adp4_sample_l;
+          u8 adp4_sample_r;
+
+          adp4_sample_l = _adp4_encode_sample(&l,input_data_[i_idx + 0]);
+          adp4_sample_r = _adp4_encode_sample(&r,input_data_[i_idx + 1]);
+
+          output_data_[o_idx++] = ((adp4_sample_l << 4) | adp4_sample_r);
+        }
+      s.channels[0] = l;
+      s.channels[1] = r;
+    }
+
+  // Mono, or the left half of a trailing stereo frame. A mono byte's
+  // nibbles both belong to channel 0.
+  mask = (s.num_channels - 1);
+  for(; i_idx < sample_count_; i_idx++)
     {
       u8 adp4_sample;
 
-      adp4_sample = _adp4_encode_sample(&s,input_data_[i_idx]);
-      if(shift)
+      adp4_sample = _adp4_encode_sample(&s.channels[pending & mask],
+                                        input_data_[i_idx]);
+      if(!pending)
         output_byte = (adp4_sample << 4);
       else
         output_data_[o_idx++] = (output_byte | adp4_sample);
 
-      shift = !shift;
+      pending = !pending;
+    }
+
+  s.pending      = pending;
+  s.pending_byte = output_byte;
+  *encoder_ = s;
+
+  return o_idx;
+}
+
+u32
+adp4_encoder_flush(adp4_encoder_t *encoder_,
+                   u8             *output_data_)
+{
+  u32 rv;
+
+  rv = 0;
+  if(encoder_->pending)
+    output_data_[rv++] = encoder_->pending_byte;
+
+  adp4_encoder_init(encoder_,encoder_->num_channels);
+
+  return rv;
+}
+
+void
+adp4_encode(const s16 *input_data_,
+            const u32  sample_count_,
+            const u8   num_channels_,
+            u8        *output_data_)
+{
+  u32 o_idx;
+  adp4_encoder_t encoder;
+
+  adp4_encoder_init(&encoder,num_channels_);
+  o_idx = adp4_encoder_feed(&encoder,
+                            input_data_,
+                            sample_count_,
+                            output_data_);
+  adp4_encoder_flush(&encoder,&output_data_[o_idx]);
+}
+
+static
+__attribute__((constructor))
+void
+_build_tables(void)
+{
+  for(int i = 0; i < STEPSIZE_TABLE_SIZE; i++)
+    {
+      g_STEPSIZE_TABLE_S32[i] = g_STEPSIZE_TABLE[i];
+      for(u8 nibble = 0; nibble < 16; nibble++)
+        {
+          g_DIFF_TABLE[i][nibble] = _adp4_decode_difference(g_STEPSIZE_TABLE[i],nibble);
+          g_NEXT_INDEX_TABLE[i][nibble] = _clamp_s32(i + g_INDEX_TABLE[nibble],
+                                                     0,
+                                                     STEPSIZE_TABLE_MAX);
+        }
     }
+}
+
+/*
+  Lane kernels take count_ samples per lane, transposed so in_[i] is
+  sample i of every lane, and write count_ / 2 bytes per lane the
+  same way. They compute exactly what _adp4_encode_sample() does.
+  Quantizing subtracts the full stepsize for every set bit, not the
+  halved one, and the vector code keeps that.
+*/
+typedef struct adp4_lanes_t adp4_lanes_t;
+struct adp4_lanes_t
+{
+  s32 predicted_sample[ADP4_LANES];
+  s32 index[ADP4_LANES];
+};
+
+typedef void (*adp4_lanes_fn)(adp4_lanes_t*,
+                              const s16 (*)[ADP4_LANES],
+                              const u32,
+                              u8 (*)[ADP4_LANES]);
+
+static
+void
+_adp4_encode_lanes_scalar(adp4_lanes_t *lanes_,
+                          const s16   (*in_)[ADP4_LANES],
+                          const u32     count_,
+                          u8          (*out_)[ADP4_LANES])
+{
+  for(u32 l = 0; l < ADP4_LANES; l++)
+    {
+      adp4_encoder_channel_t s;
+
+      s.predicted_sample = lanes_->predicted_sample[l];
+      s.index            = lanes_->index[l];
+      s.stepsize         = g_STEPSIZE_TABLE[s.index];
+      for(u32 i = 0; i < count_; i += 2)
+        {
+          u8 adp4_sample;
 
-  if(!shift)
-    output_data_[o_idx] = output_byte;
+          adp4_sample = _adp4_encode_sample(&s,in_[i + 0][l]);
+          out_[i / 2][l] = ((adp4_sample << 4) |
+                            _adp4_encode_sample(&s,in_[i + 1][l]));
+        }
+      lanes_->predicted_sample[l] = s.predicted_sample;
+      lanes_->index[l]            = s.index;
+    }
+}
+
+#if defined ADP4_ENCODE_X86
+
+__attribute__((target("avx2")))
+static
+inline
+__m256i
+_avx2_encode_sample(__m256i       *predicted_sample_,
+                    __m256i       *index_,
+                    const __m256i  sample_)
+{
+  __m256i m0;
+  __m256i m1;
+  __m256i m2;
+  __m256i s1;
+  __m256i s2;
+  __m256i sign;
+  __m256i code;
+  __m256i stepsize;
+  __m256i difference;
+
+  stepsize = _mm256_i32gather_epi32(g_STEPSIZE_TABLE_S32,*index_,4);
+  s1 = _mm256_srai_epi32(stepsize,1);
+  s2 = _mm256_srai_epi32(stepsize,2);
+
+  difference = _mm256_sub_epi32(sample_,*predicted_sample_);
+  difference = _mm256_max_epi32(_mm256_min_epi32(difference,_mm256_set1_epi32(32767)),
+                                _mm256_set1_epi32(-32768));
+  sign       = _mm256_srai_epi32(difference,31);
+  difference = _mm256_abs_epi32(difference);
+
+  // mN is set where bit N of the code is clear
+  m2 = _mm256_cmpgt_epi32(stepsize,difference);
+  difference = _mm256_sub_epi32(difference,_mm256_andnot_si256(m2,stepsize));
+  m1 = _mm256_cmpgt_epi32(s1,difference);
+  difference = _mm256_sub_epi32(difference,_mm256_andnot_si256(m1,stepsize));
+  m0 = _mm256_cmpgt_epi32(s2,difference);
+
+  difference = _mm256_srai_epi32(stepsize,3);
+  difference = _mm256_add_epi32(difference,_mm256_andnot_si256(m2,stepsize));
+  difference = _mm256_add_epi32(difference,_mm256_andnot_si256(m1,s1));
+  difference = _mm256_add_epi32(difference,_mm256_andnot_si256(m0,s2));
+  difference = _mm256_sub_epi32(_mm256_xor_si256(difference,sign),sign);
+
+  *predicted_sample_ = _mm256_add_epi32(*predicted_sample_,difference);
+  *predicted_sample_ = _mm256_max_epi32(_mm256_min_epi32(*predicted_sample_,
+                                                         _mm256_set1_epi32(32767)),
+                                        _mm256_set1_epi32(-32768));
+
+  code = _mm256_andnot_si256(m2,_mm256_set1_epi32(4));
+  code = _mm256_or_si256(code,_mm256_andnot_si256(m1,_mm256_set1_epi32(2)));
+  code = _mm256_or_si256(code,_mm256_andnot_si256(m0,_mm256_set1_epi32(1)));
+
+  // g_INDEX_TABLE: -1 below 4, otherwise (code * 2) - 6
+  *index_ = _mm256_add_epi32(*index_,
+                             _mm256_blendv_epi8(_mm256_sub_epi32(_mm256_slli_epi32(code,1),
+                                                                 _mm256_set1_epi32(6)),
+                                                _mm256_set1_epi32(-1),
+                                                m2));
+  *index_ = _mm256_max_epi32(_mm256_min_epi32(*index_,
+                                              _mm256_set1_epi32(STEPSIZE_TABLE_MAX)),
+                             _mm256_setzero_si256());
+
+  return _mm256_or_si256(code,_mm256_and_si256(sign,_mm256_set1_epi32(8)));
+}
+
+/*
+  Two vectors of 8 lanes each so the two gathers' latency overlaps.
+*/
+__attribute__((target("avx2")))
+static
+void
+_adp4_encode_lanes_avx2(adp4_lanes_t *lanes_,
+                        const s16   (*in_)[ADP4_LANES],
+                        const u32     count_,
+                        u8          (*out_)[ADP4_LANES])
+{
+  __m256i p[2];
+  __m256i x[2];
+
+  p[0] = _mm256_loadu_si256((const __m256i*)&lanes_->predicted_sample[0]);
+  p[1] = _mm256_loadu_si256((const __m256i*)&lanes_->predicted_sample[8]);
+  x[0] = _mm256_loadu_si256((const __m256i*)&lanes_->index[0]);
+  x[1] = _mm256_loadu_si256((const __m256i*)&lanes_->index[8]);
+
+  for(u32 i = 0; i < count_; i += 2)
+    {
+      __m256i b[2];
+
+      for(int v = 0; v < 2; v++)
+        {
+          __m256i h;
+          __m256i l;
+
+          h = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)&in_[i + 0][v * 8]));
+          l = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)&in_[i + 1][v * 8]));
+          h = _avx2_encode_sample(&p[v],&x[v],h);
+          l = _avx2_encode_sample(&p[v],&x[v],l);
+          b[v] = _mm256_or_si256(_mm256_slli_epi32(h,4),l);
+        }
+
+      // 16 x s32 -> 16 x u8 in lane order
+      b[0] = _mm256_permute4x64_epi64(_mm256_packs_epi32(b[0],b[1]),0xD8);
+      b[0] = _mm256_packus_epi16(b[0],b[0]);
+      b[0] = _mm256_permute4x64_epi64(b[0],0x08);
+      _mm_storeu_si128((__m128i*)out_[i / 2],_mm256_castsi256_si128(b[0]));
+    }
+
+  _mm256_storeu_si256((__m256i*)&lanes_->predicted_sample[0],p[0]);
+  _mm256_storeu_si256((__m256i*)&lanes_->predicted_sample[8],p[1]);
+  _mm256_storeu_si256((__m256i*)&lanes_->index[0],x[0]);
+  _mm256_storeu_si256((__m256i*)&lanes_->index[8],x[1]);
+}
+
+__attribute__((target("avx512f")))
+static
+inline
+__m512i
+_avx512_encode_sample(__m512i       *predicted_sample_,
+                      __m512i       *index_,
+                      const __m512i  sample_)
+{
+  __m512i s1;
+  __m512i s2;
+  __m512i code;
+  __m512i stepsize;
+  __m512i difference;
+  __mmask16 k0;
+  __mmask16 k1;
+  __mmask16 k2;
+  __mmask16 ks;
+
+  stepsize = _mm512_i32gather_epi32(*index_,g_STEPSIZE_TABLE_S32,4);
+  s1 = _mm512_srai_epi32(stepsize,1);
+  s2 = _mm512_srai_epi32(stepsize,2);
+
+  difference = _mm512_sub_epi32(sample_,*predicted_sample_);
+  difference = _mm512_max_epi32(_mm512_min_epi32(difference,_mm512_set1_epi32(32767)),
+                                _mm512_set1_epi32(-32768));
+  ks = _mm512_cmplt_epi32_mask(difference,_mm512_setzero_si512());
+  difference = _mm512_abs_epi32(difference);
+
+  // kN is set where bit N of the code is set
+  k2 = _mm512_cmpge_epi32_mask(difference,stepsize);
+  difference = _mm512_mask_sub_epi32(difference,k2,difference,stepsize);
+  k1 = _mm512_cmpge_epi32_mask(difference,s1);
+  difference = _mm512_mask_sub_epi32(difference,k1,difference,stepsize);
+  k0 = _mm512_cmpge_epi32_mask(difference,s2);
+
+  difference = _mm512_srai_epi32(stepsize,3);
+  difference = _mm512_mask_add_epi32(difference,k2,difference,stepsize);
+  difference = _mm512_mask_add_epi32(difference,k1,difference,s1);
+  difference = _mm512_mask_add_epi32(difference,k0,difference,s2);
+  difference = _mm512_mask_sub_epi32(difference,ks,_mm512_setzero_si512(),difference);
+
+  *predicted_sample_ = _mm512_add_epi32(*predicted_sample_,difference);
+  *predicted_sample_ = _mm512_max_epi32(_mm512_min_epi32(*predicted_sample_,
+                                                         _mm512_set1_epi32(32767)),
+                                        _mm512_set1_epi32(-32768));
+
+  code = _mm512_maskz_mov_epi32(k2,_mm512_set1_epi32(4));
+  code = _mm512_mask_or_epi32(code,k1,code,_mm512_set1_epi32(2));
+  code = _mm512_mask_or_epi32(code,k0,code,_mm512_set1_epi32(1));
+
+  // g_INDEX_TABLE: -1 below 4, otherwise (code * 2) - 6
+  *index_ = _mm512_add_epi32(*index_,
+                             _mm512_mask_sub_epi32(_mm512_set1_epi32(-1),
+                                                   k2,
+                                                   _mm512_slli_epi32(code,1),
+                                                   _mm512_set1_epi32(6)));
+  *index_ = _mm512_max_epi32(_mm512_min_epi32(*index_,
+                                              _mm512_set1_epi32(STEPSIZE_TABLE_MAX)),
+                             _mm512_setzero_si512());
+
+  return _mm512_mask_or_epi32(code,ks,code,_mm512_set1_epi32(8));
+}
+
+__attribute__((target("avx512f")))
+static
+void
+_adp4_encode_lanes_avx512(adp4_lanes_t *lanes_,
+                          const s16   (*in_)[ADP4_LANES],
+                          const u32     count_,
+                          u8          (*out_)[ADP4_LANES])
+{
+  __m512i p;
+  __m512i x;
+
+  p = _mm512_loadu_si512(lanes_->predicted_sample);
+  x = _mm512_loadu_si512(lanes_->index);
+
+  for(u32 i = 0; i < count_; i += 2)
+    {
+      __m512i h;
+      __m512i l;
+
+      h = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)in_[i + 0]));
+      l = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)in_[i + 1]));
+      h = _avx512_encode_sample(&p,&x,h);
+      l = _avx512_encode_sample(&p,&x,l);
+
+      _mm_storeu_si128((__m128i*)out_[i / 2],
+                       _mm512_cvtepi32_epi8(_mm512_or_si512(_mm512_slli_epi32(h,4),l)));
+    }
+
+  _mm512_storeu_si512(lanes_->predicted_sample,p);
+  _mm512_storeu_si512(lanes_->index,x);
+}
+
+#endif
+
+static
+adp4_lanes_fn
+_adp4_encode_lanes_simd(void)
+{
+#if defined ADP4_ENCODE_X86
+  if(__builtin_cpu_supports("avx512f"))
+    return _adp4_encode_lanes_avx512;
+  if(__builtin_cpu_supports("avx2"))
+    return _adp4_encode_lanes_avx2;
+#endif
+
+  return _adp4_encode_lanes_scalar;
+}
+
+typedef struct adp4_lane_t adp4_lane_t;
+struct adp4_lane_t
+{
+  const s16 *input_data;
+  u32        remaining;
+  u8        *output_data;
+};
+
+static
+int
+_adp4_stream_cmp_longest(const void *a_,
+                         const void *b_)
+{
+  const adp4_stream_t *a = *(const adp4_stream_t* const*)a_;
+  const adp4_stream_t *b = *(const adp4_stream_t* const*)b_;
+
+  if(a->input_data_sample_count > b->input_data_sample_count)
+    return -1;
+  if(a->input_data_sample_count < b->input_data_sample_count)
+    return 1;
+  return 0;
+}
+
+/*
+  Gives lane_ the next non empty stream and resets its predictor.
+  Returns 0 once there are none left.
+*/
+static
+int
+_adp4_lane_assign(adp4_lane_t          *lane_,
+                  adp4_lanes_t         *lanes_,
+                  const u32             l_,
+                  const adp4_stream_t **order_,
+                  const u32             count_,
+                  u32                  *next_)
+{
+  while(*next_ < count_)
+    {
+      const adp4_stream_t *stream = order_[(*next_)++];
+
+      if(stream->input_data_sample_count == 0)
+        continue;
+
+      lane_->input_data  = stream->input_data;
+      lane_->remaining   = stream->input_data_sample_count;
+      lane_->output_data = stream->output_data;
+      lanes_->predicted_sample[l_] = 0;
+      lanes_->index[l_]            = 0;
+
+      return 1;
+    }
+
+  lane_->input_data = NULL;
+  lane_->remaining  = 0;
+
+  return 0;
+}
+
+void
+adp4_encode_streams(const adp4_stream_t *streams_,
+                    const u32            count_)
+{
+  u32 next;
+  u32 active;
+  adp4_lanes_fn fn;
+  adp4_lanes_t lanes;
+  adp4_lane_t lane[ADP4_LANES];
+  s16 itile[LANE_TILE][ADP4_LANES];
+  u8  otile[LANE_TILE / 2][ADP4_LANES];
+  const adp4_stream_t **order;
+
+  order = malloc(count_ * sizeof(*order));
+  if(order == NULL)
+    {
+      for(u32 i = 0; i < count_; i++)
+        adp4_encode(streams_[i].input_data,
+                    streams_[i].input_data_sample_count,
+                    ADP4_MONO,
+                    streams_[i].output_data);
+      return;
+    }
+
+  for(u32 i = 0; i < count_; i++)
+    order[i] = &streams_[i];
+  qsort(order,count_,sizeof(*order),_adp4_stream_cmp_longest);
+
+  fn = _adp4_encode_lanes_simd();
+
+  // Idle lanes encode whatever is left in their column and the
+  // result is dropped.
+  memset(&lanes,0,sizeof(lanes));
+  memset(itile,0,sizeof(itile));
+
+  next   = 0;
+  active = 0;
+  for(u32 l = 0; l < ADP4_LANES; l++)
+    active += _adp4_lane_assign(&lane[l],&lanes,l,order,count_,&next);
+
+  while(active > 0)
+    {
+      u32 n;
+
+      // Run every lane up to the first one to end
+      n = LANE_TILE;
+      for(u32 l = 0; l < ADP4_LANES; l++)
+        {
+          if(lane[l].input_data == NULL)
+            continue;
+          if((lane[l].remaining & ~1U) < n)
+            n = (lane[l].remaining & ~1U);
+        }
+
+      if(n > 0)
+        {
+          for(u32 l = 0; l < ADP4_LANES; l++)
+            {
+              if(lane[l].input_data == NULL)
+                continue;
+              for(u32 i = 0; i < n; i++)
+                itile[i][l] = lane[l].input_data[i];
+            }
+
+          fn(&lanes,itile,n,otile);
+
+          for(u32 l = 0; l < ADP4_LANES; l++)
+            {
+              if(lane[l].input_data == NULL)
+                continue;
+              for(u32 i = 0; i < (n / 2); i++)
+                lane[l].output_data[i] = otile[i][l];
+              lane[l].input_data  += n;
+              lane[l].output_data += (n / 2);
+              lane[l].remaining   -= n;
+            }
+        }
+
+      // An odd last sample goes in the high nibble, as flush() does.
+      for(u32 l = 0; l < ADP4_LANES; l++)
+        {
+          if((lane[l].input_data == NULL) || (lane[l].remaining >= 2))
+            continue;
+
+          if(lane[l].remaining == 1)
+            {
+              adp4_encoder_channel_t s;
+
+              s.predicted_sample = lanes.predicted_sample[l];
+              s.index            = lanes.index[l];
+              s.stepsize         = g_STEPSIZE_TABLE[s.index];
+              lane[l].output_data[0] = (_adp4_encode_sample(&s,lane[l].input_data[0]) << 4);
+            }
+
+          active -= !_adp4_lane_assign(&lane[l],&lanes,l,order,count_,&next);
+        }
+    }
+
+  free(order);
+}
+
+/*
+  Each node of the beam may try the nibbles within TRELLIS_RANGE
+  quantization levels of the one the default encoder picks.
+*/
+#define TRELLIS_RANGE 2
+#define TRELLIS_CHILDREN ((TRELLIS_RANGE * 2) + 1)
+
+typedef struct adp4_trellis_node_t adp4_trellis_node_t;
+struct adp4_trellis_node_t
+{
+  u64 cost;
+  s32 predicted_sample;
+  s32 index;
+};
+
+typedef struct adp4_trellis_cand_t adp4_trellis_cand_t;
+struct adp4_trellis_cand_t
+{
+  u64 cost;
+  s32 predicted_sample;
+  u16 parent;
+  u8  index;
+  u8  code;
+};
+
+typedef struct adp4_trellis_slot_t adp4_trellis_slot_t;
+struct adp4_trellis_slot_t
+{
+  u32 generation;
+  u32 cand;
+};
+
+/*
+  Carves the arena into the two beams, their history rings of
+  lookahead nibbles packed 16 to a word, the
+  candidates, a hash of candidate states used to merge children that
+  decode identically and the selection of the next beam. Returns the bytes needed. base_ may be
+  NULL to only compute the size.
+*/
+typedef struct adp4_trellis_arena_t adp4_trellis_arena_t;
+struct adp4_trellis_arena_t
+{
+  adp4_trellis_node_t *nodes[2];
+  u64                 *hist[2];
+  adp4_trellis_cand_t *cands;
+  adp4_trellis_slot_t *hash;
+  u16                 *top;
+  u32                  hash_bits;
+  u32                  hist_words;
+};
+
+static
+u64
+_adp4_trellis_layout(const u32             beam_,
+                     const u32             lookahead_,
+                     u8                   *base_,
+                     adp4_trellis_arena_t *arena_)
+{
+  u64 offset;
+  u64 hist_size;
+  u32 hash_bits;
+
+  hash_bits = 4;
+  while((1U << hash_bits) < (beam_ * TRELLIS_CHILDREN * 2))
+    hash_bits++;
+
+  arena_->hist_words = ((lookahead_ + 15) / 16);
+  hist_size = ((u64)beam_ * arena_->hist_words * sizeof(u64));
+
+  offset = 0;
+  arena_->nodes[0]  = (adp4_trellis_node_t*)(base_ + offset);
+  offset += (beam_ * sizeof(adp4_trellis_node_t));
+  arena_->nodes[1]  = (adp4_trellis_node_t*)(base_ + offset);
+  offset += (beam_ * sizeof(adp4_trellis_node_t));
+  arena_->cands     = (adp4_trellis_cand_t*)(base_ + offset);
+  offset += (beam_ * TRELLIS_CHILDREN * sizeof(adp4_trellis_cand_t));
+  arena_->hash      = (adp4_trellis_slot_t*)(base_ + offset);
+  offset += ((1ULL << hash_bits) * sizeof(adp4_trellis_slot_t));
+  arena_->top       = (u16*)(base_ + offset);
+  offset += (((beam_ * sizeof(u16)) + 7) & ~7ULL);
+  arena_->hist[0]   = (u64*)(base_ + offset);
+  offset += hist_size;
+  arena_->hist[1]   = (u64*)(base_ + offset);
+  offset += hist_size;
+  arena_->hash_bits = hash_bits;
+
+  return offset;
+}
+
+u64
+adp4_trellis_arena_size(const u32 beam_,
+                        const u32 lookahead_)
+{
+  adp4_trellis_arena_t arena;
+
+  return _adp4_trellis_layout(beam_,lookahead_,NULL,&arena);
+}
+
+static
+inline
+u8
+_adp4_trellis_hist_get(const u64 *hist_,
+                       const u32  pos_)
+{
+  return ((hist_[pos_ / 16] >> ((pos_ % 16) * 4)) & 0xF);
+}
+
+static
+inline
+void
+_adp4_trellis_hist_set(u64       *hist_,
+                       const u32  pos_,
+                       const u8   code_)
+{
+  u32 shift;
+
+  shift = ((pos_ % 16) * 4);
+  hist_[pos_ / 16] = ((hist_[pos_ / 16] & ~(0xFULL << shift)) |
+                      ((u64)code_ << shift));
+}
+
+static
+inline
+void
+_adp4_trellis_hist_copy(u64       *dst_,
+                        const u64 *src_,
+                        const u32  words_)
+{
+  for(u32 w = 0; w < words_; w++)
+    dst_[w] = src_[w];
+}
+
+/*
+  Writes the indexes of the k_ cheapest candidates to top_, cheapest
+  first, and returns how many there are. Once top_ is full most
+  candidates cost more than its last entry and are passed over with
+  a single, well predicted, compare.
+*/
+static
+u32
+_adp4_trellis_select(const adp4_trellis_cand_t *cands_,
+                     const u32                  count_,
+                     const u32                  k_,
+                     u16                       *top_)
+{
+  u32 n;
+
+  n = 0;
+  for(u32 i = 0; i < count_; i++)
+    {
+      u32 j;
+      u64 cost;
+
+      cost = cands_[i].cost;
+      if((n == k_) && (cost >= cands_[top_[n - 1]].cost))
+        continue;
+
+      j = ((n < k_) ? n++ : (n - 1));
+      for(; (j > 0) && (cands_[top_[j - 1]].cost > cost); j--)
+        top_[j] = top_[j - 1];
+      top_[j] = i;
+    }
+
+  return n;
+}
+
+void
+adp4_encode_trellis_channel(const s16 *input_data_,
+                            const u32  sample_count_,
+                            const u8   stride_,
+                            const u32  beam_,
+                            const u32  lookahead_,
+                            const adp4_encoder_channel_t *state_,
+                            void      *arena_,
+                            u8        *codes_)
+{
+  u32 cur;
+  u32 count;
+  u32 generation;
+  adp4_trellis_arena_t a;
+
+  _adp4_trellis_layout(beam_,lookahead_,arena_,&a);
+  memset(a.hash,0,((size_t)1 << a.hash_bits) * sizeof(adp4_trellis_slot_t));
+
+  cur   = 0;
+  count = 1;
+  a.nodes[cur][0].cost             = 0;
+  a.nodes[cur][0].predicted_sample = (state_ ? state_->predicted_sample : 0);
+  a.nodes[cur][0].index            = (state_ ? state_->index : 0);
+
+  generation = 0;
+  for(u32 t = 0; t < sample_count_; t++)
+    {
+      u32 n;
+      u32 pos;
+      u64 min_cost;
+      s32 sample;
+      adp4_trellis_node_t *nodes;
+      adp4_trellis_node_t *next;
+
+      nodes  = a.nodes[cur];
+      next   = a.nodes[!cur];
+      sample = input_data_[(u64)t * stride_];
+      pos    = (t % lookahead_);
+
+      /*
+        The ring slot about to be reused holds the nibble of sample
+        t - lookahead. It is decided by the best node, which the beam
+        is ordered to keep first, and every node which disagrees is
+        dropped so the beam always shares one history up to there.
+      */
+      if(t >= lookahead_)
+        {
+          u8 code;
+          u32 kept;
+
+          code = _adp4_trellis_hist_get(a.hist[cur],pos);
+          codes_[(u64)(t - lookahead_) * stride_] = code;
+
+          kept = 0;
+          for(u32 i = 0; i < count; i++)
+            {
+              if(_adp4_trellis_hist_get(&a.hist[cur][i * a.hist_words],pos) != code)
+                continue;
+              if(kept != i)
+                {
+                  nodes[kept] = nodes[i];
+                  _adp4_trellis_hist_copy(&a.hist[cur][kept * a.hist_words],
+                                          &a.hist[cur][i * a.hist_words],
+                                          a.hist_words);
+                }
+              kept++;
+            }
+          count = kept;
+        }
+
+      generation++;
+      n = 0;
+      for(u32 p = 0; p < count; p++)
+        {
+          s32 lo;
+          s32 hi;
+          s32 level;
+          s32 stepsize;
+          s32 difference;
+          u8  greedy;
+
+          stepsize   = g_STEPSIZE_TABLE[nodes[p].index];
+          difference = _clamp_s32(sample - nodes[p].predicted_sample,-32768,32767);
+          greedy     = _adp4_encode_difference(stepsize,difference);
+
+          // Levels order the 16 nibbles by decoded difference
+          level = ((greedy & 0x8) ? (7 - (greedy & 0x7)) : (8 + greedy));
+          lo = ((level > TRELLIS_RANGE) ? (level - TRELLIS_RANGE) : 0);
+          hi = ((level < (15 - TRELLIS_RANGE)) ? (level + TRELLIS_RANGE) : 15);
+          for(level = lo; level <= hi; level++)
+            {
+              u8  code;
+              u8  index;
+              s32 error;
+              s32 predicted_sample;
+              u64 cost;
+              adp4_trellis_slot_t *slot;
+
+              code  = ((level < 8) ? (0x8 | (7 - level)) : (level - 8));
+              index = g_NEXT_INDEX_TABLE[nodes[p].index][code];
+              predicted_sample = _clamp_s32((s64)nodes[p].predicted_sample +
+                                            g_DIFF_TABLE[nodes[p].index][code],
+                                            -32768,
+                                            32767);
+              error = (sample - predicted_sample);
+              cost  = (nodes[p].cost + (u64)((s64)error * error));
+
+              slot = &a.hash[((((u32)predicted_sample << 7) ^ index) * 2654435761U) >>
+                             (32 - a.hash_bits)];
+              if((slot->generation == generation) &&
+                 (a.cands[slot->cand].predicted_sample == predicted_sample) &&
+                 (a.cands[slot->cand].index == index))
+                {
+                  adp4_trellis_cand_t *cand = &a.cands[slot->cand];
+
+                  if(cost < cand->cost)
+                    {
+                      cand->cost   = cost;
+                      cand->parent = p;
+                      cand->code   = code;
+                    }
+                  continue;
+                }
+
+              a.cands[n].cost             = cost;
+              a.cands[n].predicted_sample = predicted_sample;
+              a.cands[n].parent           = p;
+              a.cands[n].index            = index;
+              a.cands[n].code             = code;
+              slot->generation = generation;
+              slot->cand       = n;
+              n++;
+            }
+        }
+
+      n = _adp4_trellis_select(a.cands,n,beam_,a.top);
+
+      // Costs are kept relative to the best so they can't overflow.
+      min_cost = a.cands[a.top[0]].cost;
+      for(u32 i = 0; i < n; i++)
+        {
+          const adp4_trellis_cand_t *cand = &a.cands[a.top[i]];
+
+          next[i].cost             = (cand->cost - min_cost);
+          next[i].predicted_sample = cand->predicted_sample;
+          next[i].index            = cand->index;
+          _adp4_trellis_hist_copy(&a.hist[!cur][i * a.hist_words],
+                                  &a.hist[cur][cand->parent * a.hist_words],
+                                  a.hist_words);
+          _adp4_trellis_hist_set(&a.hist[!cur][i * a.hist_words],pos,cand->code);
+        }
+
+      cur   = !cur;
+      count = n;
+    }
+
+  for(u32 t = ((sample_count_ > lookahead_) ? (sample_count_ - lookahead_) : 0);
+      t < sample_count_;
+      t++)
+    codes_[(u64)t * stride_] = _adp4_trellis_hist_get(a.hist[cur],(t % lookahead_));
+}
+
+void
+adp4_encoder_channel_advance(adp4_encoder_channel_t *s_,
+                             const u8                code_)
+{
+  s_->predicted_sample = _clamp_s32((s64)s_->predicted_sample +
+                                    g_DIFF_TABLE[s_->index][code_],
+                                    -32768,
+                                    32767);
+  s_->index    = g_NEXT_INDEX_TABLE[s_->index][code_];
+  s_->stepsize = g_STEPSIZE_TABLE[s_->index];
 }
@@ -24,10 +24,108 @@
 extern "C" {
 #endif
 
+#define ADP4_MONO   1
+#define ADP4_STEREO 2
+
+/*
+  Incremental encoder. Samples can be fed in pieces of any size, even
+  ones splitting a stereo frame, and the output is identical to a
+  single adp4_encode() of the concatenated input. Two samples pack
+  into a byte, high nibble first, so an odd sample is held until the
+  next feed(). Stereo input is interleaved and so is the output,
+  which makes each byte one frame with left in the high nibble. Every
+  channel has its own predictor. feed() returns the number of bytes
+  written, at most (count + 1) / 2. flush() writes a held sample with
+  a zero low nibble, returns the number of bytes written (0 or 1) and
+  resets the encoder for a new stream.
+*/
+typedef struct adp4_encoder_channel_t adp4_encoder_channel_t;
+struct adp4_encoder_channel_t
+{
+  s32 predicted_sample;
+  s32 index;
+  s32 stepsize;
+};
+
+typedef struct adp4_encoder_t adp4_encoder_t;
+struct adp4_encoder_t
+{
+  u8                     num_channels;
+  u8                     pending;
+  u8                     pending_byte;
+  adp4_encoder_channel_t channels[ADP4_STEREO];
+};
+
+void adp4_encoder_init(adp4_encoder_t *encoder,
+                       const u8        num_channels);
+u32  adp4_encoder_feed(adp4_encoder_t *encoder,
+                       const s16      *input_data,
+                       const u32       input_data_sample_count,
+                       u8             *output_data);
+u32  adp4_encoder_flush(adp4_encoder_t *encoder,
+                        u8             *output_data);
+
+/*
+  Writes (input_data_sample_count + 1) / 2 bytes.
+*/
 void adp4_encode(const s16 *input_data,
                  const u32  input_data_sample_count,
+                 const u8   num_channels,
                  u8        *output_data);
 
+/*
+  Encodes many independent mono streams at once, one per SIMD lane.
+  Each stream's predictor is still sequential but ADP4_LANES of them
+  advance side by side, so throughput follows the vector width (one
+  AVX-512 vector, two AVX2 vectors) rather than the latency of a
+  single stream. Streams are taken longest first and a lane picks up
+  the next one as soon as its current stream ends which keeps lane
+  groups full when there are many short inputs. Every output is
+  identical to adp4_encode() of that stream alone and is
+  (input_data_sample_count + 1) / 2 bytes.
+*/
+#define ADP4_LANES 16
+
+typedef struct adp4_stream_t adp4_stream_t;
+struct adp4_stream_t
+{
+  const s16 *input_data;
+  u32        input_data_sample_count;
+  u8        *output_data;
+};
+
+void adp4_encode_streams(const adp4_stream_t *streams,
+                         const u32            count);
+
+/*
+  Trellis encoder for one channel. Rather than taking the nibble
+  closest to each sample it keeps the beam cheapest encodings by
+  total squared error and only settles a sample's nibble lookahead
+  samples later, so it can trade error now for a better step size
+  later. All search state lives in the caller's arena of
+  adp4_trellis_arena_size() bytes, a few KiB for typical settings,
+  and nothing is allocated while encoding. Reads sample_count
+  samples stride apart and writes one nibble per byte to codes with
+  the same stride. The search starts from state, or from a fresh
+  encoder's when it is NULL. beam is 1 to 256, lookahead at least 1.
+*/
+u64  adp4_trellis_arena_size(const u32 beam,
+                             const u32 lookahead);
+void adp4_encode_trellis_channel(const s16 *input_data,
+                                 const u32  sample_count,
+                                 const u8   stride,
+                                 const u32  beam,
+                                 const u32  lookahead,
+                                 const adp4_encoder_channel_t *state,
+                                 void      *arena,
+                                 u8        *codes);
+
+/*
+  Moves a channel's predictor past code the way a decoder would.
+*/
+void adp4_encoder_channel_advance(adp4_encoder_channel_t *s,
+                                  const u8                code);
+
 #if defined __cplusplus
 }
 #endif
@@ -0,0 +1,320 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "adp4_encode_trellis.hpp"
+
+#include "adp4_encode.h"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// Below this many samples per segment threading overhead dominates.
+#define MIN_SEGMENT_SAMPLES (1024 * 64)
+// How far a segment is searched past its end while waiting for the
+// next one to reach the same predictor state.
+#define SEGMENT_OVERLAP (1024 * 16)
+
+namespace l
+{
+  struct Segment
+  {
+    u32 begin;
+    u32 end;
+    adp4_encoder_channel_t state;
+    // Written with the input's stride, one nibble per frame.
+    std::vector<u8> codes;
+  };
+
+  static
+  u32
+  channel_samples(const u32 ibuf_len_,
+                  const u8  num_channels_,
+                  const u8  channel_)
+  {
+    if(ibuf_len_ <= channel_)
+      return 0;
+
+    // A trailing partial frame belongs to the first channels.
+    return ((ibuf_len_ - channel_ + num_channels_ - 1) / num_channels_);
+  }
+
+  static
+  bool
+  same_state(const adp4_encoder_channel_t &a_,
+             const adp4_encoder_channel_t &b_)
+  {
+    return ((a_.predicted_sample == b_.predicted_sample) &&
+            (a_.index == b_.index));
+  }
+
+  static
+  void
+  encode_channel(const s16 *ibuf_,
+                 const u32  ibuf_len_,
+                 const u8   num_channels_,
+                 const u8   channel_,
+                 const u32  beam_,
+                 const u32  lookahead_,
+                 u8        *codes_)
+  {
+    std::vector<u8> arena;
+
+    if(ibuf_len_ <= channel_)
+      return;
+
+    arena.resize(adp4_trellis_arena_size(beam_,lookahead_));
+
+    adp4_encode_trellis_channel(&ibuf_[channel_],
+                                l::channel_samples(ibuf_len_,num_channels_,channel_),
+                                num_channels_,
+                                beam_,
+                                lookahead_,
+                                NULL,
+                                arena.data(),
+                                &codes_[channel_]);
+  }
+
+  static
+  void
+  encode_segment(const s16  *ibuf_,
+                 const u8    num_channels_,
+                 const u8    channel_,
+                 const u32   beam_,
+                 const u32   lookahead_,
+                 l::Segment &segment_)
+  {
+    std::vector<u8> arena;
+
+    arena.resize(adp4_trellis_arena_size(beam_,lookahead_));
+    segment_.codes.resize((u64)(segment_.end - segment_.begin) * num_channels_);
+
+    adp4_encode_trellis_channel(&ibuf_[(u64)segment_.begin * num_channels_ + channel_],
+                                (segment_.end - segment_.begin),
+                                num_channels_,
+                                beam_,
+                                lookahead_,
+                                &segment_.state,
+                                arena.data(),
+                                segment_.codes.data());
+  }
+
+  /*
+    Segments start on the same frames in every channel. Each begins
+    from the state the default encoder has there, a cheap guess at
+    where the trellis will be, and all but the last run
+    SEGMENT_OVERLAP samples into the next.
+  */
+  static
+  std::vector<std::vector<l::Segment>>
+  make_segments(const s16 *ibuf_,
+                const u32  ibuf_len_,
+                const u8   num_channels_,
+                const u32  segment_count_)
+  {
+    u32 fed;
+    u32 frames;
+    adp4_encoder_t encoder;
+    std::vector<u8> scratch;
+    std::vector<std::vector<l::Segment>> segments(num_channels_);
+
+    frames = (ibuf_len_ / num_channels_);
+    adp4_encoder_init(&encoder,num_channels_);
+    scratch.resize((MIN_SEGMENT_SAMPLES * ADP4_STEREO + 1) / 2);
+
+    fed = 0;
+    for(u32 i = 0; i < segment_count_; i++)
+      {
+        u32 begin;
+        u32 end;
+
+        begin = (u32)(((u64)frames * i) / segment_count_);
+        end   = (u32)(((u64)frames * (i + 1)) / segment_count_);
+
+        while(fed < (begin * num_channels_))
+          {
+            u32 count;
+
+            count = std::min<u32>((begin * num_channels_) - fed,
+                                  (MIN_SEGMENT_SAMPLES * ADP4_STEREO));
+            adp4_encoder_feed(&encoder,&ibuf_[fed],count,scratch.data());
+            fed += count;
+          }
+
+        for(u8 c = 0; c < num_channels_; c++)
+          {
+            l::Segment segment;
+
+            segment.begin = begin;
+            segment.end   = (((i + 1) == segment_count_) ?
+                             l::channel_samples(ibuf_len_,num_channels_,c) :
+                             (end + SEGMENT_OVERLAP));
+            segment.state = encoder.channels[c];
+
+            segments[c].push_back(std::move(segment));
+          }
+      }
+
+    return segments;
+  }
+
+  /*
+    Joins a channel's segments. The codes of a segment are used until
+    its predictor state matches the next segment's at the same sample,
+    after which the decoder follows exactly the path the next
+    segment's search assumed. If they never meet within the overlap
+    the next segment is searched again from where this one ended.
+  */
+  static
+  void
+  join_segments(const s16                 *ibuf_,
+                const u8                   num_channels_,
+                const u8                   channel_,
+                const u32                  beam_,
+                const u32                  lookahead_,
+                std::vector<l::Segment>   &segments_,
+                u8                        *codes_)
+  {
+    u32 t;
+    adp4_encoder_channel_t state;
+
+    t = 0;
+    state = {0,0,7};
+    for(size_t i = 0; i < segments_.size(); i++)
+      {
+        u32 end;
+        l::Segment &segment = segments_[i];
+
+        end = (((i + 1) < segments_.size()) ? segments_[i + 1].begin : segment.end);
+        for(; t < end; t++)
+          {
+            u8 code;
+
+            code = segment.codes[(u64)(t - segment.begin) * num_channels_];
+            codes_[(u64)t * num_channels_ + channel_] = code;
+            adp4_encoder_channel_advance(&state,code);
+          }
+
+        if((i + 1) == segments_.size())
+          break;
+
+        l::Segment &next = segments_[i + 1];
+        adp4_encoder_channel_t next_state = next.state;
+        for(; t < segment.end; t++)
+          {
+            u8 code;
+
+            if(l::same_state(state,next_state))
+              break;
+
+            code = segment.codes[(u64)(t - segment.begin) * num_channels_];
+            codes_[(u64)t * num_channels_ + channel_] = code;
+            adp4_encoder_channel_advance(&state,code);
+            adp4_encoder_channel_advance(&next_state,next.codes[(u64)(t - next.begin) * num_channels_]);
+          }
+
+        if(l::same_state(state,next_state))
+          continue;
+
+        next.begin = t;
+        next.state = state;
+        l::encode_segment(ibuf_,num_channels_,channel_,beam_,lookahead_,next);
+      }
+  }
+}
+
+void
+adp4_encode_trellis(const s16      *ibuf_,
+                    const u32       ibuf_len_,
+                    const u8        num_channels_,
+                    const u32       beam_,
+                    const u32       lookahead_,
+                    const unsigned  threads_,
+                    u8             *obuf_)
+{
+  u32 i;
+  u32 segment_count;
+  std::vector<u8> codes;
+
+  codes.resize(ibuf_len_);
+
+  segment_count = 1;
+  if(threads_ > num_channels_)
+    segment_count = std::min<u32>((threads_ / num_channels_),
+                                  ((ibuf_len_ / num_channels_) / MIN_SEGMENT_SAMPLES));
+  segment_count = std::max<u32>(segment_count,1);
+
+  if(segment_count > 1)
+    {
+      std::vector<std::vector<l::Segment>> segments;
+
+      segments = l::make_segments(ibuf_,ibuf_len_,num_channels_,segment_count);
+
+      {
+        ThreadPool pool(std::min<u32>(threads_,(num_channels_ * segment_count)));
+
+        for(u8 c = 0; c < num_channels_; c++)
+          {
+            for(u32 s = 0; s < segment_count; s++)
+              {
+                pool.enqueue([&,c,s]()
+                {
+                  l::encode_segment(ibuf_,num_channels_,c,beam_,lookahead_,segments[c][s]);
+                });
+              }
+          }
+
+        pool.wait();
+
+        for(u8 c = 0; c < num_channels_; c++)
+          {
+            pool.enqueue([&,c]()
+            {
+              l::join_segments(ibuf_,num_channels_,c,beam_,lookahead_,segments[c],codes.data());
+            });
+          }
+
+        pool.wait();
+      }
+    }
+  else if((threads_ > 1) && (num_channels_ > 1))
+    {
+      ThreadPool pool(num_channels_);
+
+      for(u8 c = 0; c < num_channels_; c++)
+        {
+          pool.enqueue([&,c]()
+          {
+            l::encode_channel(ibuf_,ibuf_len_,num_channels_,c,beam_,lookahead_,codes.data());
+          });
+        }
+
+      pool.wait();
+    }
+  else
+    {
+      for(u8 c = 0; c < num_channels_; c++)
+        l::encode_channel(ibuf_,ibuf_len_,num_channels_,c,beam_,lookahead_,codes.data());
+    }
+
+  // High nibble first, an odd last sample with a zero low nibble
+  for(i = 0; (i + 1) < ibuf_len_; i += 2)
+    obuf_[i / 2] = ((codes[i] << 4) | codes[i + 1]);
+  if(i < ibuf_len_)
+    obuf_[i / 2] = (codes[i] << 4);
+}
@@ -0,0 +1,42 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "types_ints.h"
+
+/*
+  Encodes like adp4_encode(), writing (ibuf_len + 1) / 2 bytes, but
+  picks nibbles with adp4_encode_trellis_channel(). The channels of a
+  stereo stream are independent and with threads > 1 are searched
+  concurrently. With more threads than channels each channel is also
+  split into segments searched concurrently, every one starting from
+  the default encoder's state at its first sample. A segment's
+  nibbles are kept until its decoder state meets the next segment's,
+  so the output always decodes along the path each search assumed,
+  and a segment that isn't met within a short overlap is searched
+  again once its predecessor is done. The output then differs
+  slightly from a single threaded search.
+*/
+void adp4_encode_trellis(const s16      *ibuf,
+                         const u32       ibuf_len,
+                         const u8        num_channels,
+                         const u32       beam,
+                         const u32       lookahead,
+                         const unsigned  threads,
+                         u8             *obuf);
@@ -0,0 +1,281 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "aiff.hpp"
+
+#include "chunk.hpp"
+#include "file.hpp"
+
+#include "fmt.hpp"
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include <cstdio>
+#include <cstring>
+
+// AIFF-C version 1 timestamp, the only one defined.
+#define AIFC_VERSION_1 0xA2805140
+#define PCM_BLOCK_SIZE (1024 * 4)
+
+namespace l
+{
+  static
+  std::string
+  compression_name(const std::string &compression_)
+  {
+    if(compression_ == "SDX2")
+      return "Squareroot-Delta-Exact compression";
+    if(compression_ == "ADP4")
+      return "4:1 Intel/DVI ADPCM compression";
+    if(compression_ == "NONE")
+      return "not compressed";
+
+    return compression_;
+  }
+
+  static
+  u64
+  padded(const u64 size_)
+  {
+    return (size_ + (size_ & 1));
+  }
+
+  static
+  void
+  write_chunk_header(FILE       *file_,
+                     const char *id_,
+                     const u32   size_)
+  {
+    std::array<u8,8> header;
+
+    memcpy(&header[0],id_,4);
+    header[4] = (size_ >> 24);
+    header[5] = (size_ >> 16);
+    header[6] = (size_ >>  8);
+    header[7] = (size_ >>  0);
+
+    fwrite(header.data(),1,header.size(),file_);
+  }
+
+  static
+  void
+  write_chunk(FILE        *file_,
+              const Chunk &chunk_)
+  {
+    u8 pad = 0;
+
+    write_chunk_header(file_,chunk_.id(),chunk_.data().size());
+    fwrite(chunk_.data().data(),1,chunk_.data().size(),file_);
+    if(chunk_.data().size() & 1)
+      fwrite(&pad,1,1,file_);
+  }
+
+  /*
+    Writes FORM, the fixed chunks and the SSND header. The caller
+    follows with sound_data_size_ bytes of sound data and then
+    finish().
+  */
+  static
+  FILE*
+  start(const std::filesystem::path &filepath_,
+        const char                  *form_type_,
+        const std::vector<Chunk>    &chunks_,
+        const u64                    sound_data_size_)
+  {
+    u64 form_size;
+    FILE *file;
+    Chunk form("FORM");
+    Chunk ssnd("SSND");
+
+    // SSND offset and block size, both unused
+    ssnd.append_be32(0);
+    ssnd.append_be32(0);
+
+    form_size = 4;
+    for(const auto &chunk : chunks_)
+      form_size += (8 + padded(chunk.data().size()));
+    form_size += (8 + padded(ssnd.data().size() + sound_data_size_));
+
+    // Chunk sizes are 32bit
+    if(form_size > 0xFFFFFFFF)
+      throw fmt::exception("{} would be over the 4GiB AIFF limit",filepath_);
+
+    file = file::open_output(filepath_);
+    if(file == NULL)
+      return NULL;
+
+    write_chunk_header(file,form.id(),form_size);
+    fwrite(form_type_,1,4,file);
+    for(const auto &chunk : chunks_)
+      write_chunk(file,chunk);
+    write_chunk_header(file,ssnd.id(),ssnd.data().size() + sound_data_size_);
+    fwrite(ssnd.data().data(),1,ssnd.data().size(),file);
+
+    return file;
+  }
+
+  static
+  void
+  finish(FILE      *file_,
+         const u64  sound_data_size_)
+  {
+    u8 pad = 0;
+
+    if(sound_data_size_ & 1)
+      fwrite(&pad,1,1,file_);
+
+    file::close_output(file_);
+  }
+}
+
+bool
+aiff::parse(const u8  *data_,
+            u64        data_size_,
+            Info      &info_)
+{
+  char id[4];
+  bool comm;
+  bool ssnd;
+  bool aifc;
+  u64 form_size;
+  u64 chunk_size;
+  const u8 *form;
+  const u8 *chunk;
+
+  if(!Chunk::next(data_,data_size_,id,form,form_size) ||
+     memcmp(id,"FORM",4) ||
+     (form_size < 4))
+    return false;
+
+  if(!memcmp(form,"AIFC",4))
+    aifc = true;
+  else if(!memcmp(form,"AIFF",4))
+    aifc = false;
+  else
+    return false;
+
+  comm = false;
+  ssnd = false;
+  form      += 4;
+  form_size -= 4;
+  while(Chunk::next(form,form_size,id,chunk,chunk_size))
+    {
+      if(!memcmp(id,"COMM",4) && (chunk_size >= 18))
+        {
+          info_.channels      = (s16)Chunk::be16(&chunk[0]);
+          info_.sample_frames = Chunk::be32(&chunk[2]);
+          info_.sample_size   = (s16)Chunk::be16(&chunk[6]);
+          info_.freq          = Chunk::extended(&chunk[8]);
+          info_.compression   = "NONE";
+          if(aifc && (chunk_size >= 22))
+            info_.compression.assign((const char*)&chunk[18],4);
+          comm = true;
+        }
+      else if(!memcmp(id,"SSND",4) && (chunk_size >= 8))
+        {
+          u32 offset = Chunk::be32(&chunk[0]);
+
+          if(offset > (chunk_size - 8))
+            return false;
+          info_.sound_data      = &chunk[8 + offset];
+          info_.sound_data_size = (chunk_size - 8 - offset);
+          ssnd = true;
+        }
+    }
+
+  return (comm && ssnd);
+}
+
+u64
+aiff::write_pcm(const s16                   *samples_,
+                const u64                    count_,
+                const std::filesystem::path &filepath_,
+                const int                    channels_,
+                const int                    freq_)
+{
+  u64 rv;
+  FILE *file;
+  std::vector<Chunk> chunks;
+  std::array<u8,PCM_BLOCK_SIZE * 2> buf;
+
+  chunks.emplace_back("COMM");
+  chunks.back().append_be16(channels_);
+  chunks.back().append_be32(count_ / channels_);
+  chunks.back().append_be16(16);
+  chunks.back().append_extended(freq_);
+
+  file = l::start(filepath_,"AIFF",chunks,count_ * sizeof(s16));
+  if(file == NULL)
+    return 0;
+
+  // AIFF sample data is big endian
+  rv = 0;
+  for(u64 i = 0; i < count_; i += PCM_BLOCK_SIZE)
+    {
+      u64 n = std::min<u64>(PCM_BLOCK_SIZE,count_ - i);
+
+      for(u64 j = 0; j < n; j++)
+        {
+          buf[(j * 2) + 0] = ((u16)samples_[i + j] >> 8);
+          buf[(j * 2) + 1] = ((u16)samples_[i + j] >> 0);
+        }
+
+      rv += fwrite(buf.data(),1,n * 2,file);
+    }
+
+  l::finish(file,count_ * sizeof(s16));
+
+  return rv;
+}
+
+u64
+aiff::write_compressed(const void                  *data_,
+                       const u64                    data_size_,
+                       const std::filesystem::path &filepath_,
+                       const std::string           &compression_,
+                       const int                    channels_,
+                       const int                    freq_,
+                       const u32                    sample_frames_)
+{
+  u64 rv;
+  FILE *file;
+  std::vector<Chunk> chunks;
+
+  chunks.emplace_back("FVER");
+  chunks.back().append_be32(AIFC_VERSION_1);
+
+  chunks.emplace_back("COMM");
+  chunks.back().append_be16(channels_);
+  chunks.back().append_be32(sample_frames_);
+  chunks.back().append_be16(16);
+  chunks.back().append_extended(freq_);
+  chunks.back().append_id(compression_.c_str());
+  chunks.back().append_pstring(l::compression_name(compression_));
+
+  file = l::start(filepath_,"AIFC",chunks,data_size_);
+  if(file == NULL)
+    return 0;
+
+  rv = fwrite(data_,1,data_size_,file);
+
+  l::finish(file,data_size_);
+
+  return rv;
+}
@@ -0,0 +1,63 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "types_ints.h"
+
+#include <filesystem>
+#include <string>
+
+/*
+  Native AIFF / AIFF-C container support so wrapping encoded audio
+  doesn't require an ffmpeg process. See docs/AIFF-1.3.pdf and
+  docs/AIFF-C.9.26.91.pdf.
+*/
+namespace aiff
+{
+  struct Info
+  {
+    std::string         compression;
+    int                 channels;
+    u32                 sample_frames;
+    int                 sample_size;
+    int                 freq;
+    const u8           *sound_data;
+    u64                 sound_data_size;
+  };
+
+  bool parse(const u8  *data,
+             const u64  data_size,
+             Info      &info);
+
+  u64
+  write_pcm(const s16                   *samples,
+            const u64                    count,
+            const std::filesystem::path &filepath,
+            const int                    channels,
+            const int                    freq);
+
+  u64
+  write_compressed(const void                  *data,
+                   const u64                    data_size,
+                   const std::filesystem::path &filepath,
+                   const std::string           &compression,
+                   const int                    channels,
+                   const int                    freq,
+                   const u32                    sample_frames);
+}
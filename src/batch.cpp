@@ -0,0 +1,583 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "batch.hpp"
+
+#include "file.hpp"
+#include "thread_pool.hpp"
+
+#include "fmt.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <mutex>
+#include <set>
+#include <system_error>
+#include <thread>
+
+#include <cstdio>
+
+
+namespace l
+{
+  static FILE *g_REPORT_FILE = stdout;
+  static std::atomic<size_t> g_FAILURES = 0;
+
+  /*
+    Each file's report is collected into its own buffer and printed
+    in one go so output from concurrent jobs doesn't interleave.
+  */
+  static
+  void
+  process(const std::filesystem::path &filepath_,
+          const batch::Func           &func_,
+          std::mutex                  &print_mutex_)
+  {
+    std::string output;
+
+    output = fmt::format("{}:\n",filepath_);
+
+    try
+      {
+        std::error_code ec;
+
+        if(!file::is_stdio(filepath_) &&
+           std::filesystem::is_directory(filepath_,ec))
+          throw fmt::exception("is a directory, use --recursive");
+
+        func_(filepath_,output);
+      }
+    catch(const std::system_error &e_)
+      {
+        l::g_FAILURES++;
+        fmt::format_to(std::back_inserter(output),
+                       " - ERROR - {} - {} ({})\n",
+                       filepath_,
+                       e_.what(),
+                       e_.code().message());
+      }
+    catch(const std::runtime_error &e_)
+      {
+        l::g_FAILURES++;
+        fmt::format_to(std::back_inserter(output),
+                       " - ERROR - {} - {}\n",
+                       filepath_,
+                       e_.what());
+      }
+
+    std::lock_guard<std::mutex> lock(print_mutex_);
+
+    fmt::print(g_REPORT_FILE,"{}",output);
+    fflush(g_REPORT_FILE);
+  }
+
+  /*
+    Shell style glob. '*' and '?' stop at '/', '**' doesn't. '[...]'
+    takes ranges and '!' or '^' to negate.
+  */
+  static
+  bool
+  glob_match(const char *pattern_,
+             const char *str_)
+  {
+    while(*pattern_ != '\0')
+      {
+        switch(*pattern_)
+          {
+          case '*':
+            {
+              bool any;
+
+              any = (pattern_[1] == '*');
+              pattern_ += (any ? 2 : 1);
+              // "**/" also matches no directories at all
+              if(any && (*pattern_ == '/') && l::glob_match(pattern_ + 1,str_))
+                return true;
+
+              for(;; str_++)
+                {
+                  if(l::glob_match(pattern_,str_))
+                    return true;
+                  if((*str_ == '\0') || (!any && (*str_ == '/')))
+                    return false;
+                }
+            }
+          case '?':
+            if((*str_ == '\0') || (*str_ == '/'))
+              return false;
+            pattern_++;
+            str_++;
+            break;
+          case '[':
+            {
+              bool negate;
+              bool matched;
+              const char *p;
+
+              if((*str_ == '\0') || (*str_ == '/'))
+                return false;
+
+              p       = pattern_ + 1;
+              negate  = ((*p == '!') || (*p == '^'));
+              p      += negate;
+              matched = false;
+              do
+                {
+                  if((p[1] == '-') && (p[2] != ']') && (p[2] != '\0'))
+                    {
+                      matched |= ((*str_ >= p[0]) && (*str_ <= p[2]));
+                      p += 3;
+                    }
+                  else
+                    {
+                      matched |= (*str_ == *p);
+                      p += 1;
+                    }
+                }
+              while((*p != ']') && (*p != '\0'));
+
+              // Unterminated, treat '[' as a literal
+              if(*p == '\0')
+                {
+                  if(*str_ != '[')
+                    return false;
+                  pattern_++;
+                  str_++;
+                  break;
+                }
+
+              if(matched == negate)
+                return false;
+              pattern_ = p + 1;
+              str_++;
+            }
+            break;
+          default:
+            if(*pattern_ != *str_)
+              return false;
+            pattern_++;
+            str_++;
+            break;
+          }
+      }
+
+    return (*str_ == '\0');
+  }
+
+  static
+  bool
+  glob_match_any(const std::vector<std::string> &patterns_,
+                 const std::filesystem::path    &relpath_)
+  {
+    std::string name;
+    std::string relpath;
+
+    name    = relpath_.filename().generic_string();
+    relpath = relpath_.generic_string();
+    for(const auto &pattern : patterns_)
+      {
+        const std::string &str = ((pattern.find('/') == std::string::npos) ?
+                                  name : relpath);
+
+        if(l::glob_match(pattern.c_str(),str.c_str()))
+          return true;
+      }
+
+    return false;
+  }
+
+  typedef std::function<void(const std::filesystem::path&)> FoundFunc;
+  typedef std::function<void(const std::filesystem::path&,
+                             const std::error_code&)> ErrorFunc;
+
+  static
+  void
+  walk_dir(ThreadPool                  &pool_,
+           const std::filesystem::path &root_,
+           const std::filesystem::path &dirpath_,
+           const batch::Walk           &walk_,
+           const FoundFunc             &found_,
+           const ErrorFunc             &error_)
+  {
+    std::error_code ec;
+    std::filesystem::directory_iterator iter;
+    const auto options = std::filesystem::directory_options::skip_permission_denied;
+
+    iter = std::filesystem::directory_iterator(dirpath_,options,ec);
+    if(ec)
+      return error_(dirpath_,ec);
+
+    for(; iter != std::filesystem::directory_iterator(); iter.increment(ec))
+      {
+        bool is_dir;
+        std::filesystem::path relpath;
+        const auto &entry = *iter;
+
+        if(ec)
+          return error_(dirpath_,ec);
+
+        relpath = entry.path().lexically_relative(root_);
+        if(l::glob_match_any(walk_.exclude,relpath))
+          continue;
+
+        // Symlinked directories aren't followed so cycles can't happen.
+        is_dir = (entry.is_directory(ec) && !entry.is_symlink(ec));
+        if(is_dir)
+          {
+            std::filesystem::path dirpath = entry.path();
+
+            pool_.enqueue([&pool_,&walk_,&found_,&error_,root_,dirpath]()
+            {
+              l::walk_dir(pool_,root_,dirpath,walk_,found_,error_);
+            });
+            continue;
+          }
+
+        if(!entry.is_regular_file(ec))
+          continue;
+        if(!walk_.include.empty() && !l::glob_match_any(walk_.include,relpath))
+          continue;
+
+        found_(entry.path());
+      }
+
+    if(ec)
+      error_(dirpath_,ec);
+  }
+
+  /*
+    Every directory is its own job so wide trees are read in
+    parallel. found_ and error_ get called from the walker threads.
+  */
+  static
+  void
+  walk(const std::vector<std::filesystem::path> &roots_,
+       const batch::Walk                        &walk_,
+       const unsigned                            jobs_,
+       const FoundFunc                          &found_,
+       const ErrorFunc                          &error_)
+  {
+    if(roots_.empty())
+      return;
+
+    ThreadPool pool(jobs_);
+
+    for(const auto &root : roots_)
+      {
+        pool.enqueue([&,root]()
+        {
+          l::walk_dir(pool,root,root,walk_,found_,error_);
+        });
+      }
+
+    pool.wait();
+  }
+
+  /*
+    Directories are only expanded with --recursive. Anything else is
+    passed through and rejected by process() if it is a directory.
+  */
+  static
+  void
+  split(const std::vector<std::filesystem::path> &filepaths_,
+        const batch::Walk                        &walk_,
+        std::vector<std::filesystem::path>       &roots_,
+        std::vector<std::filesystem::path>       &files_)
+  {
+    for(const auto &filepath : filepaths_)
+      {
+        std::error_code ec;
+
+        if(walk_.recursive &&
+           !file::is_stdio(filepath) &&
+           std::filesystem::is_directory(filepath,ec))
+          roots_.emplace_back(filepath);
+        else
+          files_.emplace_back(filepath);
+      }
+  }
+
+  static
+  std::filesystem::path
+  common_dirpath(const std::vector<std::filesystem::path> &dirpaths_)
+  {
+    std::filesystem::path rv;
+
+    if(dirpaths_.empty())
+      return rv;
+
+    rv = dirpaths_[0];
+    for(const auto &dirpath : dirpaths_)
+      {
+        std::filesystem::path common;
+        auto a = rv.begin();
+        auto b = dirpath.begin();
+
+        for(; (a != rv.end()) && (b != dirpath.end()) && (*a == *b); ++a, ++b)
+          common /= *a;
+
+        rv = common;
+      }
+
+    return rv;
+  }
+}
+
+unsigned
+batch::default_jobs(void)
+{
+  unsigned n;
+
+  n = std::thread::hardware_concurrency();
+
+  return ((n > 0) ? n : 1);
+}
+
+void
+batch::set_report_file(FILE *file_)
+{
+  l::g_REPORT_FILE = file_;
+}
+
+FILE*
+batch::report_file(void)
+{
+  return l::g_REPORT_FILE;
+}
+
+size_t
+batch::failures(void)
+{
+  return l::g_FAILURES;
+}
+
+void
+batch::run(const std::vector<std::filesystem::path> &filepaths_,
+           const unsigned                            jobs_,
+           const batch::Func                        &func_)
+{
+  batch::run(filepaths_,batch::Walk{},jobs_,func_);
+}
+
+void
+batch::run(const std::vector<std::filesystem::path> &filepaths_,
+           const batch::Walk                        &walk_,
+           const unsigned                            jobs_,
+           const batch::Func                        &func_)
+{
+  std::mutex print_mutex;
+  std::vector<std::filesystem::path> roots;
+  std::vector<std::filesystem::path> files;
+
+  l::split(filepaths_,walk_,roots,files);
+
+  if(roots.empty() && ((jobs_ <= 1) || (files.size() <= 1)))
+    {
+      for(const auto &filepath : files)
+        l::process(filepath,func_,print_mutex);
+      return;
+    }
+
+  ThreadPool pool(roots.empty() ? std::min<size_t>(jobs_,files.size()) : jobs_);
+
+  auto enqueue = [&](const std::filesystem::path &filepath_)
+  {
+    pool.enqueue([&,filepath_]()
+    {
+      l::process(filepath_,func_,print_mutex);
+    });
+  };
+
+  auto error = [&](const std::filesystem::path &dirpath_,
+                   const std::error_code       &ec_)
+  {
+    auto func = [&](const std::filesystem::path &,
+                    std::string                 &)
+    {
+      throw fmt::exception("unable to read directory ({})",ec_.message());
+    };
+
+    l::process(dirpath_,func,print_mutex);
+  };
+
+  for(const auto &filepath : files)
+    enqueue(filepath);
+
+  // Files are converted as they're found, not after the walk.
+  l::walk(roots,walk_,jobs_,enqueue,error);
+
+  pool.wait();
+}
+
+void
+batch::run_indexed(const std::vector<std::filesystem::path> &labels_,
+                   const unsigned                            jobs_,
+                   const batch::IndexedFunc                 &func_)
+{
+  std::mutex print_mutex;
+
+  auto process = [&](const size_t i_)
+  {
+    auto func = [&](const std::filesystem::path &,
+                    std::string                 &output_)
+    {
+      func_(i_,output_);
+    };
+
+    l::process(labels_[i_],func,print_mutex);
+  };
+
+  if((jobs_ <= 1) || (labels_.size() <= 1))
+    {
+      for(size_t i = 0; i < labels_.size(); i++)
+        process(i);
+      return;
+    }
+
+  ThreadPool pool(std::min<size_t>(jobs_,labels_.size()));
+
+  for(size_t i = 0; i < labels_.size(); i++)
+    {
+      pool.enqueue([&,i]()
+      {
+        process(i);
+      });
+    }
+
+  pool.wait();
+}
+
+std::vector<std::filesystem::path>
+batch::expand(const std::vector<std::filesystem::path> &filepaths_,
+              const batch::Walk                        &walk_,
+              const unsigned                            jobs_)
+{
+  std::mutex mutex;
+  std::vector<std::filesystem::path> roots;
+  std::vector<std::filesystem::path> rv;
+
+  l::split(filepaths_,walk_,roots,rv);
+
+  auto found = [&](const std::filesystem::path &filepath_)
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    rv.emplace_back(filepath_);
+  };
+
+  auto error = [](const std::filesystem::path &,
+                  const std::error_code       &)
+  {
+  };
+
+  l::walk(roots,walk_,jobs_,found,error);
+
+  std::sort(rv.begin(),rv.end());
+
+  return rv;
+}
+
+void
+batch::init_stdio(const std::vector<std::filesystem::path> &filepaths_,
+                  const std::filesystem::path              &output_filepath_)
+{
+  size_t stdin_count;
+
+  stdin_count = std::count_if(filepaths_.begin(),
+                              filepaths_.end(),
+                              file::is_stdio);
+  if(stdin_count > 1)
+    throw std::runtime_error("stdin ('-') can only be given once");
+  if(!output_filepath_.empty() && (filepaths_.size() > 1))
+    throw std::runtime_error("--output takes a single input");
+  if(!output_filepath_.empty() &&
+     !filepaths_.empty() &&
+     !file::is_stdio(filepaths_[0]) &&
+     std::filesystem::is_directory(filepaths_[0]))
+    throw std::runtime_error("--output takes a single input file");
+
+  if(file::is_stdio(output_filepath_) ||
+     (output_filepath_.empty() && (stdin_count > 0)))
+    batch::set_report_file(stderr);
+}
+
+std::filesystem::path
+batch::output_filepath(const std::filesystem::path &filepath_,
+                       const std::filesystem::path &output_filepath_,
+                       const std::filesystem::path &default_filepath_)
+{
+  if(!output_filepath_.empty())
+    return output_filepath_;
+  if(file::is_stdio(filepath_))
+    return "-";
+
+  return default_filepath_;
+}
+
+batch::OutputDirs::OutputDirs(const std::vector<std::filesystem::path> &filepaths_,
+                              const std::filesystem::path              &output_dirpath_)
+  : _output_dirpath(output_dirpath_)
+{
+  std::vector<std::filesystem::path> dirpaths;
+
+  if(_output_dirpath.empty())
+    return;
+
+  for(const auto &filepath : filepaths_)
+    {
+      std::error_code ec;
+      std::filesystem::path dirpath;
+
+      dirpath = std::filesystem::absolute(filepath).lexically_normal();
+      if(!dirpath.has_filename() ||
+         !std::filesystem::is_directory(filepath,ec))
+        dirpath = dirpath.parent_path();
+
+      dirpaths.emplace_back(dirpath);
+    }
+
+  _base = l::common_dirpath(dirpaths);
+}
+
+std::filesystem::path
+batch::OutputDirs::dirpath(const std::filesystem::path &filepath_)
+{
+  std::error_code ec;
+  std::filesystem::path dirpath;
+
+  if(_output_dirpath.empty())
+    return filepath_.parent_path();
+
+  dirpath = std::filesystem::absolute(filepath_).lexically_normal().parent_path();
+  dirpath = (_output_dirpath / dirpath.lexically_relative(_base)).lexically_normal();
+
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  if(!_created.insert(dirpath).second)
+    return dirpath;
+
+  std::filesystem::create_directories(dirpath,ec);
+  if(!std::filesystem::is_directory(dirpath,ec))
+    {
+      _created.erase(dirpath);
+      throw fmt::exception("unable to create output directory {}",dirpath);
+    }
+
+  return dirpath;
+}
@@ -0,0 +1,128 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <cstdio>
+
+namespace batch
+{
+  typedef std::function<void(const std::filesystem::path&,std::string&)> Func;
+  typedef std::function<void(const size_t,std::string&)> IndexedFunc;
+
+  /*
+    How directories given as input are expanded. Globs match a file's
+    name, or its path relative to the directory given when they
+    contain a '/'. '*' and '?' don't match '/', '**' does. Excluded
+    directories aren't descended into. Files listed explicitly are
+    always converted.
+  */
+  struct Walk
+  {
+    bool                     recursive;
+    std::vector<std::string> include;
+    std::vector<std::string> exclude;
+  };
+
+  unsigned default_jobs(void);
+
+  // Where reports go. Set to stderr when output is written to stdout.
+  void  set_report_file(FILE *file);
+  FILE *report_file(void);
+
+  // Number of files whose conversion failed, for the exit status.
+  size_t failures(void);
+
+  void run(const std::vector<std::filesystem::path> &filepaths,
+           const unsigned                            jobs,
+           const Func                               &func);
+
+  /*
+    Directories are walked in parallel and every file found is handed
+    to the conversion workers right away, so conversion starts while
+    the walk is still going.
+  */
+  void run(const std::vector<std::filesystem::path> &filepaths,
+           const Walk                               &walk,
+           const unsigned                            jobs,
+           const Func                               &func);
+
+  /*
+    Calls func with every index into labels, each report headed by its
+    label. For jobs whose inputs may repeat with different settings.
+  */
+  void run_indexed(const std::vector<std::filesystem::path> &labels,
+                   const unsigned                            jobs,
+                   const IndexedFunc                        &func);
+
+  // The full list of files run() would convert, sorted.
+  std::vector<std::filesystem::path>
+  expand(const std::vector<std::filesystem::path> &filepaths,
+         const Walk                               &walk,
+         const unsigned                            jobs);
+
+  /*
+    Rejects stdin given more than once and an explicit output file
+    with several inputs. Reports go to stderr when any output is
+    stdout.
+  */
+  void init_stdio(const std::vector<std::filesystem::path> &filepaths,
+                  const std::filesystem::path              &output_filepath);
+
+  /*
+    An explicit output_filepath is used as is, stdin input defaults to
+    stdout and anything else to default_filepath.
+  */
+  std::filesystem::path
+  output_filepath(const std::filesystem::path &filepath,
+                  const std::filesystem::path &output_filepath,
+                  const std::filesystem::path &default_filepath);
+
+  /*
+    Directory each input's output is written to. Without an output
+    directory that is the input's own directory, otherwise the tree
+    below the inputs' deepest common directory is mirrored into
+    output_dirpath. A directory given as input counts as its own
+    tree. Each directory is created once, on first use.
+  */
+  class OutputDirs
+  {
+  public:
+    OutputDirs(const std::vector<std::filesystem::path> &filepaths,
+               const std::filesystem::path              &output_dirpath);
+
+    OutputDirs(const OutputDirs&) = delete;
+    OutputDirs& operator=(const OutputDirs&) = delete;
+
+  public:
+    std::filesystem::path dirpath(const std::filesystem::path &filepath);
+
+  private:
+    std::filesystem::path           _output_dirpath;
+    std::filesystem::path           _base;
+    std::mutex                      _mutex;
+    std::set<std::filesystem::path> _created;
+  };
+}
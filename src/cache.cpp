@@ -0,0 +1,333 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "cache.hpp"
+
+#include "file.hpp"
+#include "hash.h"
+#include "thread_pool.hpp"
+#include "version.hpp"
+
+#include "fmt.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+namespace l
+{
+  /*
+    Shares the source's extents where the filesystem supports it
+    (btrfs, xfs, ...) so a hit costs no data copy. Anything else gets
+    a plain copy.
+  */
+  static
+  bool
+  clone_file(const std::filesystem::path &src_,
+             const std::filesystem::path &dst_)
+  {
+    std::error_code ec;
+
+#if defined __linux__ && defined FICLONE
+    int rv;
+    int src_fd;
+    int dst_fd;
+
+    src_fd = ::open(src_.c_str(),O_RDONLY|O_CLOEXEC);
+    if(src_fd >= 0)
+      {
+        dst_fd = ::open(dst_.c_str(),O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0644);
+        rv = -1;
+        if(dst_fd >= 0)
+          {
+            rv = ::ioctl(dst_fd,FICLONE,src_fd);
+            ::close(dst_fd);
+          }
+        ::close(src_fd);
+
+        if(rv == 0)
+          return true;
+      }
+#endif
+
+    return std::filesystem::copy_file(src_,
+                                      dst_,
+                                      std::filesystem::copy_options::overwrite_existing,
+                                      ec);
+  }
+
+  static
+  std::filesystem::path
+  tmp_filepath(const std::filesystem::path &filepath_)
+  {
+    static std::atomic<u64> g_ID = 0;
+
+    return fmt::format("{}.tmp.{}.{}",
+                       filepath_.string(),
+                       std::hash<std::thread::id>()(std::this_thread::get_id()),
+                       g_ID++);
+  }
+}
+
+cache::Store::Store(const std::filesystem::path &dirpath_,
+                    const u64                    max_size_,
+                    const std::string           &options_)
+  : _dirpath(dirpath_),
+    _max_size(max_size_),
+    _stats()
+{
+  std::string options;
+  std::error_code ec;
+
+  options = fmt::format("{}.{}.{};{}",MAJOR,MINOR,PATCH,options_);
+  _options_hash = hash64(options.data(),options.size(),0);
+
+  std::filesystem::create_directories(_dirpath,ec);
+  if(!std::filesystem::is_directory(_dirpath,ec))
+    throw fmt::exception("unable to create cache directory {}",_dirpath);
+}
+
+std::string
+cache::Store::key(const std::filesystem::path &filepath_)
+{
+  u64 hash;
+  file::View input;
+  std::string key;
+
+  if(file::is_stdio(filepath_))
+    return {};
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto i = _keys.find(filepath_);
+    if(i != _keys.end())
+      return i->second;
+  }
+
+  if(!input.open(filepath_))
+    return {};
+
+  hash = hash64(input.data(),input.size(),_options_hash);
+  key  = fmt::format("{:016x}{:016x}",hash,_options_hash);
+
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  _keys[filepath_] = key;
+
+  return key;
+}
+
+bool
+cache::Store::contains(const std::filesystem::path &filepath_)
+{
+  std::string key;
+  std::error_code ec;
+
+  key = this->key(filepath_);
+  if(key.empty())
+    return false;
+
+  return std::filesystem::is_regular_file(_dirpath / key,ec);
+}
+
+bool
+cache::Store::fetch(const std::filesystem::path &filepath_,
+                    const std::filesystem::path &output_filepath_)
+{
+  std::string key;
+  std::error_code ec;
+  std::filesystem::path entry;
+
+  key = this->key(filepath_);
+  entry = (_dirpath / key);
+  if(key.empty() ||
+     !std::filesystem::is_regular_file(entry,ec) ||
+     !l::clone_file(entry,output_filepath_))
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stats.misses++;
+      return false;
+    }
+
+  // mtime doubles as last use for eviction.
+  std::filesystem::last_write_time(entry,
+                                   std::filesystem::file_time_type::clock::now(),
+                                   ec);
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  _stats.hits++;
+
+  return true;
+}
+
+void
+cache::Store::insert(const std::filesystem::path &filepath_,
+                     const std::filesystem::path &output_filepath_)
+{
+  std::string key;
+  std::error_code ec;
+  std::filesystem::path tmp;
+
+  key = this->key(filepath_);
+  if(key.empty())
+    return;
+
+  // Written aside and renamed so concurrent runs never see a partial
+  // entry.
+  tmp = l::tmp_filepath(_dirpath / key);
+  if(!l::clone_file(output_filepath_,tmp))
+    {
+      std::filesystem::remove(tmp,ec);
+      return;
+    }
+
+  std::filesystem::rename(tmp,_dirpath / key,ec);
+  if(ec)
+    {
+      std::filesystem::remove(tmp,ec);
+      return;
+    }
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  _stats.inserts++;
+}
+
+void
+cache::Store::trim(void)
+{
+  u64 size;
+  std::error_code ec;
+  struct Entry
+  {
+    std::filesystem::path           filepath;
+    std::filesystem::file_time_type mtime;
+    u64                             size;
+  };
+  std::vector<Entry> entries;
+
+  size = 0;
+  for(const auto &de : std::filesystem::directory_iterator(_dirpath,ec))
+    {
+      Entry entry;
+
+      if(!de.is_regular_file(ec))
+        continue;
+      if(de.path().filename().string().find(".tmp.") != std::string::npos)
+        continue;
+
+      entry.filepath = de.path();
+      entry.mtime    = de.last_write_time(ec);
+      entry.size     = de.file_size(ec);
+      if(ec)
+        continue;
+
+      size += entry.size;
+      entries.emplace_back(std::move(entry));
+    }
+
+  std::sort(entries.begin(),
+            entries.end(),
+            [](const Entry &a_, const Entry &b_)
+            {
+              return (a_.mtime < b_.mtime);
+            });
+
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  for(const auto &entry : entries)
+    {
+      if(size <= _max_size)
+        break;
+      if(!std::filesystem::remove(entry.filepath,ec))
+        continue;
+
+      size -= entry.size;
+      _stats.evictions++;
+    }
+
+  _stats.size = size;
+}
+
+/*
+  Hashes inputs in parallel so work which is only needed for misses,
+  like grouped ffmpeg decoding, can be limited to them. The keys are
+  remembered for the conversion which follows.
+*/
+std::vector<std::filesystem::path>
+cache::Store::uncached(const std::vector<std::filesystem::path> &filepaths_,
+                       const unsigned                            jobs_)
+{
+  std::vector<char> hit;
+  std::vector<std::filesystem::path> rv;
+
+  hit.resize(filepaths_.size());
+
+  {
+    ThreadPool pool(jobs_);
+
+    for(u64 i = 0; i < filepaths_.size(); i++)
+      pool.enqueue([&,i]()
+      {
+        hit[i] = contains(filepaths_[i]);
+      });
+
+    pool.wait();
+  }
+
+  for(u64 i = 0; i < filepaths_.size(); i++)
+    {
+      if(!hit[i])
+        rv.emplace_back(filepaths_[i]);
+    }
+
+  return rv;
+}
+
+cache::Store::Stats
+cache::Store::stats(void)
+{
+  std::lock_guard<std::mutex> lock(_mutex);
+
+  return _stats;
+}
+
+std::string
+cache::Store::summary(void)
+{
+  Stats stats;
+
+  stats = this->stats();
+
+  return fmt::format("cache: {} hits, {} misses, {} inserted, {} evicted, {}b used of {}b\n",
+                     stats.hits,
+                     stats.misses,
+                     stats.inserts,
+                     stats.evictions,
+                     stats.size,
+                     _max_size);
+}
@@ -0,0 +1,83 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "types_ints.h"
+
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace cache
+{
+  /*
+    Content addressed store of conversion outputs. An entry is keyed
+    by the hash of the input's bytes and of the options which affect
+    the output, including the 3at version, so a hit can be copied (or
+    reflinked where the filesystem supports it) without decoding or
+    encoding anything. Hits touch the entry's mtime and trim() drops
+    the least recently used entries once the store exceeds max_size.
+  */
+  class Store
+  {
+  public:
+    struct Stats
+    {
+      u64 hits;
+      u64 misses;
+      u64 inserts;
+      u64 evictions;
+      u64 size;
+    };
+
+  public:
+    Store(const std::filesystem::path &dirpath,
+          const u64                    max_size,
+          const std::string           &options);
+
+    Store(const Store&) = delete;
+    Store& operator=(const Store&) = delete;
+
+  public:
+    std::string key(const std::filesystem::path &filepath);
+    bool        contains(const std::filesystem::path &filepath);
+    bool        fetch(const std::filesystem::path &filepath,
+                      const std::filesystem::path &output_filepath);
+    void        insert(const std::filesystem::path &filepath,
+                       const std::filesystem::path &output_filepath);
+    void        trim(void);
+
+    std::vector<std::filesystem::path>
+    uncached(const std::vector<std::filesystem::path> &filepaths,
+             const unsigned                            jobs);
+
+    Stats       stats(void);
+    std::string summary(void);
+
+  private:
+    std::filesystem::path _dirpath;
+    u64                   _max_size;
+    u64                   _options_hash;
+    std::mutex            _mutex;
+    Stats                 _stats;
+    std::map<std::filesystem::path,std::string> _keys;
+  };
+}
@@ -2,12 +2,155 @@
 
 #include "types_ints.h"
 
+#include <algorithm>
+#include <cstring>
 #include <string>
-#include <span>
+#include <vector>
 
 
+/*
+  An IFF chunk: 4 character id, 32bit big endian payload size and the
+  payload padded to an even length. Only the small fixed chunks are
+  built in memory. Bulk payloads like sound data are written straight
+  after the header by the caller.
+*/
 class Chunk
 {
 public:
-  
+  Chunk(const char *id_)
+  {
+    memcpy(_id,id_,sizeof(_id));
+  }
+
+public:
+  void
+  append_u8(const u8 v_)
+  {
+    _data.push_back(v_);
+  }
+
+  void
+  append_be16(const u16 v_)
+  {
+    append_u8(v_ >> 8);
+    append_u8(v_ >> 0);
+  }
+
+  void
+  append_be32(const u32 v_)
+  {
+    append_be16(v_ >> 16);
+    append_be16(v_ >>  0);
+  }
+
+  void
+  append_id(const char *id_)
+  {
+    _data.insert(_data.end(),id_,id_ + 4);
+  }
+
+  // 80bit IEEE 754 extended, as used for AIFF sample rates.
+  void
+  append_extended(const u32 v_)
+  {
+    u16 exponent;
+    u64 mantissa;
+
+    exponent = 0;
+    mantissa = 0;
+    if(v_ != 0)
+      {
+        int msb = (31 - __builtin_clz(v_));
+
+        exponent = (16383 + msb);
+        mantissa = ((u64)v_ << (63 - msb));
+      }
+
+    append_be16(exponent);
+    append_be32(mantissa >> 32);
+    append_be32(mantissa >>  0);
+  }
+
+  // Pascal string: count byte then text, padded to an even total.
+  void
+  append_pstring(const std::string &s_)
+  {
+    u8 len = std::min<u64>(s_.size(),255);
+
+    append_u8(len);
+    _data.insert(_data.end(),s_.begin(),s_.begin() + len);
+    if((len & 1) == 0)
+      append_u8(0);
+  }
+
+public:
+  const char *id(void) const { return _id; }
+  const std::vector<u8>& data(void) const { return _data; }
+
+public:
+  static
+  u16
+  be16(const u8 *p_)
+  {
+    return ((p_[0] << 8) | p_[1]);
+  }
+
+  static
+  u32
+  be32(const u8 *p_)
+  {
+    return (((u32)be16(&p_[0]) << 16) | be16(&p_[2]));
+  }
+
+  static
+  u32
+  extended(const u8 *p_)
+  {
+    int shift;
+    u64 mantissa;
+
+    mantissa = (((u64)be32(&p_[2]) << 32) | be32(&p_[6]));
+    shift    = (16383 + 63 - (be16(&p_[0]) & 0x7FFF));
+    if((shift < 0) || (shift > 63))
+      return 0;
+
+    return (mantissa >> shift);
+  }
+
+  /*
+    Splits the next chunk off the front of buf_. Returns false at the
+    end of the buffer or if the chunk header claims more data than is
+    present.
+  */
+  static
+  bool
+  next(const u8 *&buf_,
+       u64       &buf_size_,
+       char       id_[4],
+       const u8 *&data_,
+       u64       &data_size_)
+  {
+    u64 size;
+
+    if(buf_size_ < 8)
+      return false;
+
+    memcpy(id_,buf_,4);
+    size = be32(&buf_[4]);
+    if(size > (buf_size_ - 8))
+      return false;
+
+    data_      = &buf_[8];
+    data_size_ = size;
+
+    size = std::min<u64>(8 + size + (size & 1),buf_size_);
+    buf_      += size;
+    buf_size_ -= size;
+
+    return true;
+  }
+
+private:
+  char _id[4];
+  std::vector<u8> _data;
 };
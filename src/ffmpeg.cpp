@@ -1,17 +1,47 @@
 #include "ffmpeg.hpp"
+#include "file.hpp"
 #include "subprocess.h"
 
 #include "types_ints.h"
 
 #include "fmt.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <filesystem>
+#include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include <cstdlib>
+#include <csignal>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
+
+// Bytes per write to ffmpeg's stdin and the pipe size asked for.
+#define WRITE_BLOCK_SIZE (1024 * 64)
+#define WRITE_PIPE_SIZE  (1024 * 1024)
+
 namespace l
 {
+  // A dead ffmpeg should show up as a short write, not kill 3at.
+  static
+  void
+  ignore_sigpipe(void)
+  {
+#ifndef _WIN32
+    static std::once_flag flag;
+
+    std::call_once(flag,[]{ signal(SIGPIPE,SIG_IGN); });
+#endif
+  }
+
   static
   bool
   executable_exists(const std::string &executable_)
@@ -38,6 +68,109 @@ namespace l
 
     return true;
   }
+
+  /*
+    Returns the value for "key_" in ffprobe's JSON output. Only flat
+    string and number values are needed so this is a scan rather than
+    a full JSON parser.
+  */
+  static
+  std::string
+  json_value(const std::string &json_,
+             const std::string &key_)
+  {
+    u64 pos;
+    u64 end;
+
+    pos = json_.find("\"" + key_ + "\"");
+    if(pos == std::string::npos)
+      return {};
+
+    pos = json_.find(':',pos + key_.size() + 2);
+    if(pos == std::string::npos)
+      return {};
+
+    pos = json_.find_first_not_of(" \t\r\n",pos + 1);
+    if(pos == std::string::npos)
+      return {};
+
+    if(json_[pos] == '"')
+      {
+        pos += 1;
+        end  = json_.find('"',pos);
+      }
+    else
+      {
+        end = json_.find_first_of(",}] \t\r\n",pos);
+      }
+
+    if(end == std::string::npos)
+      return {};
+
+    return json_.substr(pos,end - pos);
+  }
+
+  static
+  bool
+  run_ffprobe(const std::filesystem::path &filepath_,
+              ffmpeg::Probe               &probe_)
+  {
+    int rv;
+    u64 n;
+    FILE *outputf;
+    std::string json;
+    std::string filepath;
+    std::array<char,4096> tmpbuf;
+    std::vector<const char*> args;
+    struct subprocess_s subproc;
+
+    filepath = "file:" + filepath_.string();
+    args =
+      {
+        "ffprobe",
+        "-hide_banner",
+        "-loglevel","error",
+        "-select_streams","a:0",
+        "-show_entries",
+        "stream=sample_rate,channels,codec_name,sample_fmt:format=duration",
+        "-of","json",
+        filepath.c_str(),
+        NULL
+      };
+
+    rv = subprocess_create(args.data(),
+                           subprocess_option_inherit_environment|
+                           subprocess_option_search_user_path,
+                           &subproc);
+    if(rv != 0)
+      return false;
+
+    outputf = subprocess_stdout(&subproc);
+    while((n = fread(tmpbuf.data(),1,tmpbuf.size(),outputf)) > 0)
+      json.append(tmpbuf.data(),n);
+
+    rv = -1;
+    subprocess_join(&subproc,&rv);
+    subprocess_destroy(&subproc);
+
+    probe_.codec      = l::json_value(json,"codec_name");
+    probe_.sample_fmt = l::json_value(json,"sample_fmt");
+    probe_.freq       = atoi(l::json_value(json,"sample_rate").c_str());
+    probe_.channels   = atoi(l::json_value(json,"channels").c_str());
+    probe_.duration   = atof(l::json_value(json,"duration").c_str());
+
+    return ((rv == 0) && !probe_.codec.empty());
+  }
+
+  struct ProbeCacheEntry
+  {
+    std::filesystem::file_time_type mtime;
+    ffmpeg::Probe probe;
+    bool          ok;
+  };
+
+  static std::mutex g_PROBE_CACHE_MUTEX;
+  static std::map<std::string,ProbeCacheEntry> g_PROBE_CACHE;
 }
 
 bool
@@ -58,63 +191,90 @@ ffmpeg::ffprobe_available(void)
   return l::executable_exists("ffprobe");
 }
 
+/*
+  One ffprobe run per file gathers everything needed about it. Results
+  are cached by path and modification time so repeated queries on the
+  same input, from any thread, don't spawn again.
+*/
 bool
-ffmpeg::file_recognizable(const std::filesystem::path &path_)
+ffmpeg::probe(const std::filesystem::path &filepath_,
+              Probe                       &probe_)
 {
-  int rv;
-  std::string path;
-  struct subprocess_s subproc;
-  std::vector<const char*> args;
-
-  path = path_.string();
-  args =
-    {
-      "ffmpeg",
-      "-hide_banner",
-      "-loglevel","fatal",
-      "-i",path.c_str(),
-      "-f","null",
-      "-"
-    };
-  args.push_back(NULL);
+  std::error_code ec;
+  l::ProbeCacheEntry entry;
 
-  rv = subprocess_create(args.data(),
-                         subprocess_option_inherit_environment|
-                         subprocess_option_search_user_path,
-                         &subproc);
-  if(rv != 0)
+  entry.mtime = std::filesystem::last_write_time(filepath_,ec);
+  if(ec)
     return false;
 
-  subprocess_join(&subproc,&rv);
-  subprocess_destroy(&subproc);
+  {
+    std::lock_guard<std::mutex> lock(l::g_PROBE_CACHE_MUTEX);
+    auto i = l::g_PROBE_CACHE.find(filepath_.string());
 
-  if(rv == 0)
-    return true;
-  return false;
+    if((i != l::g_PROBE_CACHE.end()) && (i->second.mtime == entry.mtime))
+      {
+        probe_ = i->second.probe;
+        return i->second.ok;
+      }
+  }
+
+  entry.probe = {};
+  entry.ok    = l::run_ffprobe(filepath_,entry.probe);
+
+  {
+    std::lock_guard<std::mutex> lock(l::g_PROBE_CACHE_MUTEX);
+
+    l::g_PROBE_CACHE[filepath_.string()] = entry;
+  }
+
+  probe_ = entry.probe;
+
+  return entry.ok;
 }
 
-std::vector<s16>
-ffmpeg::to_s16le(const std::filesystem::path &filepath_,
-                 const int                    channels_,
-                 const int                    freq_)
+ffmpeg::S16LEReader::S16LEReader()
+  : _subproc(NULL),
+    _use_libav(false)
+{
+}
+
+ffmpeg::S16LEReader::~S16LEReader()
+{
+  close();
+}
+
+bool
+ffmpeg::S16LEReader::open(const std::filesystem::path &filepath_,
+                          const int                    channels_,
+                          const int                    freq_,
+                          const bool                   allow_libav_)
 {
   int rv;
-  FILE *outputf;
   std::string filepath;
   std::string channels;
   std::string freq;
   std::vector<const char*> args;
-  std::vector<s16> buf;
-  struct subprocess_s subproc;
 
-  filepath = "file:" + filepath_.string();
+  close();
+
+  if(allow_libav_ && !file::is_stdio(filepath_))
+    {
+      _use_libav = _libav.open(filepath_,channels_,freq_);
+      if(_use_libav)
+        return true;
+    }
+
+  filepath = (file::is_stdio(filepath_) ? "pipe:0" : "file:" + filepath_.string());
   channels = fmt::format("{}",channels_);
   freq     = fmt::format("{}",freq_);
 
+  // Errors only, stderr is drained and discarded below.
   args =
     {
       "ffmpeg",
       "-hide_banner",
+      "-loglevel","error",
+      "-nostats",
       "-i",filepath.c_str(),
       "-vn",
       "-dn",
@@ -127,130 +287,342 @@ ffmpeg::to_s16le(const std::filesystem::path &filepath_,
       SUBPROCESS_NULL
     };
 
+  _subproc = new struct subprocess_s;
   rv = subprocess_create(args.data(),
                          subprocess_option_inherit_environment|
-                         subprocess_option_search_user_path,
-                         &subproc);
+                         subprocess_option_search_user_path|
+                         subprocess_option_enable_async,
+                         _subproc);
   if(rv != 0)
-    return {};
+    {
+      delete _subproc;
+      _subproc = NULL;
+      return false;
+    }
 
-  outputf = subprocess_stdout(&subproc);
+  // ffmpeg must never block on a full stderr pipe while the caller
+  // waits on stdout.
+  _stderr_drainer = std::thread([subproc = _subproc]()
+  {
+    std::array<char,4096> buf;
+
+    while(subprocess_read_stderr(subproc,buf.data(),buf.size()) > 0)
+      ;
+  });
+
+  if(file::is_stdio(filepath_))
+    {
+      l::ignore_sigpipe();
+      _feeder = std::thread([subproc = _subproc]()
+      {
+        u64 n;
+        file::Reader input;
+        std::array<char,WRITE_BLOCK_SIZE> buf;
+
+        input.open("-");
+        while((n = input.read(buf.data(),buf.size())) > 0)
+          {
+            if(fwrite(buf.data(),1,n,subprocess_stdin(subproc)) != n)
+              break;
+          }
+
+        // ffmpeg only finishes once its stdin is closed.
+        fclose(subprocess_stdin(subproc));
+        subproc->stdin_file = NULL;
+      });
+    }
+
+  return true;
+}
+
+u64
+ffmpeg::S16LEReader::read(s16       *buf_,
+                          const u64  count_)
+{
+  if(_use_libav)
+    return _libav.read(buf_,count_);
+  if(_subproc == NULL)
+    return 0;
+
+  return fread(buf_,sizeof(s16),count_,subprocess_stdout(_subproc));
+}
+
+int
+ffmpeg::S16LEReader::close(void)
+{
+  int rv;
+  FILE *outputf;
+  std::array<s16,4096> tmpbuf;
+
+  if(_use_libav)
+    {
+      _use_libav = false;
+      return _libav.close();
+    }
+
+  if(_subproc == NULL)
+    return -1;
+
+  // Drain so ffmpeg isn't left blocked on a full pipe.
+  outputf = subprocess_stdout(_subproc);
+  while(fread(tmpbuf.data(),sizeof(s16),tmpbuf.size(),outputf) > 0)
+    ;
+
+  if(_feeder.joinable())
+    _feeder.join();
+
+  rv = -1;
+  subprocess_join(_subproc,&rv);
+  if(_stderr_drainer.joinable())
+    _stderr_drainer.join();
+  subprocess_destroy(_subproc);
+  delete _subproc;
+  _subproc = NULL;
+
+  return rv;
+}
 
+std::vector<s16>
+ffmpeg::to_s16le(const std::filesystem::path &filepath_,
+                 const int                    channels_,
+                 const int                    freq_,
+                 const bool                   allow_libav_)
+{
+  std::vector<s16> buf;
   std::vector<s16> tmpbuf;
+  S16LEReader reader;
+
+  if(!reader.open(filepath_,channels_,freq_,allow_libav_))
+    return {};
 
   tmpbuf.resize(1024 * 64);
-  while(!feof(outputf))
+  while(true)
     {
-      size_t n;
+      u64 n;
+
+      n = reader.read(tmpbuf.data(),tmpbuf.size());
+      if(n == 0)
+        break;
 
-      n = fread(tmpbuf.data(),2,tmpbuf.size(),outputf);
-      buf.reserve(buf.size() + n);
       buf.insert(buf.end(),
                  tmpbuf.begin(),
                  tmpbuf.begin() + n);
     }
 
-  subprocess_join(&subproc,&rv);
-  subprocess_destroy(&subproc);
+  // Nothing decoded means ffmpeg didn't know the input and the
+  // caller may try it as raw. A decode that stops part way is an
+  // error.
+  if((reader.close() != 0) && !buf.empty())
+    throw fmt::exception("ffmpeg failed decoding {}",filepath_);
 
   return buf;
 }
 
-int
-ffmpeg::freq(const std::filesystem::path &filepath_)
+ffmpeg::GroupDecoder::GroupDecoder(const std::vector<std::filesystem::path> &filepaths_,
+                                   const unsigned                            group_size_,
+                                   const unsigned                            min_groups_,
+                                   const int                                 channels_,
+                                   const int                                 freq_,
+                                   const bool                                allow_libav_)
+  : _channels(channels_),
+    _freq(freq_),
+    _allow_libav(allow_libav_)
+{
+  u64 count;
+  static std::atomic<u64> g_ID = 0;
+
+  count = ((filepaths_.size() + group_size_ - 1) / std::max(group_size_,1u));
+  count = std::max<u64>(count,min_groups_);
+  count = std::min<u64>(count,filepaths_.size());
+
+  for(u64 i = 0; i < count; i++)
+    {
+      _groups.emplace_back(new Group);
+      _groups.back()->decoded = false;
+      _groups.back()->ok      = false;
+      _groups.back()->dirpath =
+        (std::filesystem::temp_directory_path() /
+         fmt::format("3at-{}-{}",
+                     std::chrono::steady_clock::now().time_since_epoch().count(),
+                     g_ID++));
+    }
+
+  for(u64 i = 0; i < filepaths_.size(); i++)
+    {
+      Group &group = *_groups[i % count];
+
+      // stdin is decoded on its own.
+      if(file::is_stdio(filepaths_[i]) || _index.count(filepaths_[i]))
+        continue;
+
+      _index[filepaths_[i]] = {i % count,group.filepaths.size()};
+      group.filepaths.push_back(filepaths_[i]);
+    }
+}
+
+ffmpeg::GroupDecoder::~GroupDecoder()
+{
+  std::error_code ec;
+
+  for(auto &group : _groups)
+    std::filesystem::remove_all(group->dirpath,ec);
+}
+
+bool
+ffmpeg::GroupDecoder::decode(Group &group_)
 {
   int rv;
+  std::error_code ec;
+  std::string channels;
+  std::string freq;
   FILE *outputf;
-  std::string filepath;
+  std::vector<std::string> strs;
   std::vector<const char*> args;
+  std::array<char,4096> tmpbuf;
   struct subprocess_s subproc;
 
-  filepath = filepath_.string();
+  if(!std::filesystem::create_directories(group_.dirpath,ec))
+    return false;
+
+  channels = fmt::format("{}",_channels);
+  freq     = fmt::format("{}",_freq);
+
+  for(u64 i = 0; i < group_.filepaths.size(); i++)
+    {
+      strs.emplace_back("file:" + group_.filepaths[i].string());
+      strs.emplace_back(fmt::format("{}:a:0",i));
+      strs.emplace_back("file:" + (group_.dirpath / fmt::format("{}.raw",i)).string());
+    }
+
   args =
     {
-      "ffprobe",
+      "ffmpeg",
+      "-y",
       "-hide_banner",
-      "-select_streams","a:0",
-      "-show_entries","stream=sample_rate",
-      "-of","default=noprint_wrappers=1:nokey=1",
-      filepath.c_str(),
-      NULL
+      "-loglevel","error",
+      "-nostats",
+      "-nostdin"
     };
 
+  for(u64 i = 0; i < group_.filepaths.size(); i++)
+    {
+      args.push_back("-i");
+      args.push_back(strs[(i * 3) + 0].c_str());
+    }
+
+  for(u64 i = 0; i < group_.filepaths.size(); i++)
+    {
+      args.insert(args.end(),
+                  {
+                    "-map",strs[(i * 3) + 1].c_str(),
+                    "-ac",channels.c_str(),
+                    "-ar",freq.c_str(),
+                    "-f","s16le",
+                    "-acodec","pcm_s16le",
+                    strs[(i * 3) + 2].c_str()
+                  });
+    }
+
+  args.push_back(NULL);
+
   rv = subprocess_create(args.data(),
                          subprocess_option_inherit_environment|
-                         subprocess_option_search_user_path,
+                         subprocess_option_search_user_path|
+                         subprocess_option_combined_stdout_stderr,
                          &subproc);
   if(rv != 0)
-    return -1;
+    return false;
 
+  // Outputs go to files so the pipe only carries messages. Even at
+  // -loglevel error many bad inputs can fill it, so it's drained
+  // before waiting on ffmpeg.
   outputf = subprocess_stdout(&subproc);
+  while(fread(tmpbuf.data(),1,tmpbuf.size(),outputf) > 0)
+    ;
 
-  fscanf(outputf,"%i",&rv);
-
-  subprocess_join(&subproc,NULL);
+  rv = -1;
+  subprocess_join(&subproc,&rv);
   subprocess_destroy(&subproc);
 
-  return rv;
+  return (rv == 0);
+}
+
+std::vector<s16>
+ffmpeg::GroupDecoder::to_s16le(const std::filesystem::path &filepath_)
+{
+  std::error_code ec;
+  std::vector<s16> buf;
+  std::filesystem::path decoded_filepath;
+
+  // Nothing to amortize when decoding in process.
+  auto i = _index.find(filepath_);
+  if((i == _index.end()) || (_allow_libav && libav::available()))
+    return ffmpeg::to_s16le(filepath_,_channels,_freq,_allow_libav);
+
+  Group &group = *_groups[i->second.first];
+
+  {
+    std::lock_guard<std::mutex> lock(group.mutex);
+
+    if(!group.decoded)
+      {
+        group.ok      = decode(group);
+        group.decoded = true;
+      }
+  }
+
+  if(!group.ok)
+    return ffmpeg::to_s16le(filepath_,_channels,_freq,_allow_libav);
+
+  decoded_filepath = group.dirpath / fmt::format("{}.raw",i->second.second);
+
+  buf = file::load_s16(decoded_filepath);
+  std::filesystem::remove(decoded_filepath,ec);
+
+  return buf;
 }
 
 int
 ffmpeg::channels(const std::filesystem::path &filepath_)
 {
-  int rv;
-  FILE *outputf;
-  std::string filepath;
-  struct subprocess_s subproc;
-  std::vector<const char*> args;
-
-  filepath = filepath_.string();
-  args = 
-    {
-      "ffprobe",
-      "-hide_banner",
-      "-select_streams","a:0",
-      "-show_entries","stream=channels",
-      "-of","default=noprint_wrappers=1:nokey=1",
-      filepath.c_str(),
-      NULL
-    };
+  Probe probe;
 
-  rv = subprocess_create(args.data(),
-                         subprocess_option_inherit_environment|
-                         subprocess_option_search_user_path,
-                         &subproc);
-  if(rv != 0)
+  if(!ffmpeg::probe(filepath_,probe))
     return -1;
 
-  outputf = subprocess_stdout(&subproc);
-
-  fscanf(outputf,"%i",&rv);
+  return probe.channels;
+}
 
-  subprocess_join(&subproc,NULL);
-  subprocess_destroy(&subproc);
+ffmpeg::Writer::Writer()
+  : _subproc(NULL)
+{
+}
 
-  return rv;
+ffmpeg::Writer::~Writer()
+{
+  close();
 }
 
-u64
-ffmpeg::write(const void                  *data_,
-              const u64                    data_size_,
-              const std::filesystem::path &filepath_,
-              const std::string           &format_,
-              const std::string           &codec_,
-              const int                    channels_,
-              const int                    freq_)
+bool
+ffmpeg::Writer::open(const std::filesystem::path &filepath_,
+                     const std::string           &container_,
+                     const std::string           &format_,
+                     const std::string           &codec_,
+                     const int                    channels_,
+                     const int                    freq_)
 {
-  u64 rv;
-  int proc_rv;
-  FILE *stdinf;
+  int rv;
+  int options;
   std::string filepath;
   std::string channels;
   std::string freq;
   std::vector<const char*> args;
-  struct subprocess_s subproc;
 
-  filepath = "file:" + filepath_.string();
+  close();
+
+  l::ignore_sigpipe();
+
+  filepath = (file::is_stdio(filepath_) ? "pipe:1" : "file:" + filepath_.string());
   channels = fmt::format("{}",channels_);
   freq     = fmt::format("{}",freq_);
   args =
@@ -258,28 +630,134 @@ ffmpeg::write(const void                  *data_,
       "ffmpeg",
       "-y",
       "-hide_banner",
+      "-loglevel","error",
+      "-nostats",
       "-f",format_.c_str(),
       "-acodec",codec_.c_str(),
       "-ac",channels.c_str(),
       "-ar",freq.c_str(),
       "-i","pipe:0",
       "-c:a","copy",
+      "-f",container_.c_str(),
       filepath.c_str(),
       NULL
     };
 
-  subprocess_create(args.data(),
-                    subprocess_option_inherit_environment|
-                    subprocess_option_search_user_path,
-                    &subproc);
+  // Muxing to stdout keeps ffmpeg's stdout clean of messages. Its
+  // stderr is then a pipe of its own and drained below.
+  options = (subprocess_option_inherit_environment|
+             subprocess_option_search_user_path|
+             subprocess_option_enable_async);
+  if(!file::is_stdio(filepath_))
+    options |= subprocess_option_combined_stdout_stderr;
 
-  stdinf = subprocess_stdin(&subproc);
+  _subproc = new struct subprocess_s;
+  rv = subprocess_create(args.data(),options,_subproc);
+  if(rv != 0)
+    {
+      delete _subproc;
+      _subproc = NULL;
+      return false;
+    }
 
-  rv = fwrite(data_,1,data_size_,stdinf);
-  fflush(stdinf);
+#ifdef F_SETPIPE_SZ
+  fcntl(fileno(subprocess_stdin(_subproc)),F_SETPIPE_SZ,WRITE_PIPE_SIZE);
+#endif
 
-  subprocess_join(&subproc,&proc_rv);
-  subprocess_destroy(&subproc);
+  _drainer = std::thread([subproc = _subproc,
+                          output = (file::is_stdio(filepath_) ? stdout : NULL)]()
+  {
+    unsigned n;
+    std::array<char,4096> buf;
+
+    while((n = subprocess_read_stdout(subproc,buf.data(),buf.size())) > 0)
+      {
+        if(output != NULL)
+          fwrite(buf.data(),1,n,output);
+      }
+
+    if(output != NULL)
+      fflush(output);
+  });
+
+  // However little ffmpeg logs it must never block on a full stderr
+  // pipe.
+  if(file::is_stdio(filepath_))
+    {
+      _stderr_drainer = std::thread([subproc = _subproc]()
+      {
+        std::array<char,4096> buf;
+
+        while(subprocess_read_stderr(subproc,buf.data(),buf.size()) > 0)
+          ;
+      });
+    }
+
+  return true;
+}
+
+u64
+ffmpeg::Writer::write(const void *data_,
+                      const u64   data_size_)
+{
+  u64 n;
+  u64 rv;
+  FILE *stdinf;
+  const u8 *data = (const u8*)data_;
+
+  if(_subproc == NULL)
+    return 0;
+
+  stdinf = subprocess_stdin(_subproc);
+  for(rv = 0; rv < data_size_; rv += n)
+    {
+      n = fwrite(&data[rv],1,std::min<u64>(WRITE_BLOCK_SIZE,data_size_ - rv),stdinf);
+      if(n == 0)
+        break;
+    }
+
+  return rv;
+}
+
+int
+ffmpeg::Writer::close(void)
+{
+  int rv;
+
+  if(_subproc == NULL)
+    return -1;
+
+  // Closes ffmpeg's stdin so it finishes up and exits.
+  rv = -1;
+  subprocess_join(_subproc,&rv);
+  _drainer.join();
+  if(_stderr_drainer.joinable())
+    _stderr_drainer.join();
+  subprocess_destroy(_subproc);
+  delete _subproc;
+  _subproc = NULL;
+
+  return rv;
+}
+
+u64
+ffmpeg::write(const void                  *data_,
+              const u64                    data_size_,
+              const std::filesystem::path &filepath_,
+              const std::string           &container_,
+              const std::string           &format_,
+              const std::string           &codec_,
+              const int                    channels_,
+              const int                    freq_)
+{
+  u64 rv;
+  Writer writer;
+
+  if(!writer.open(filepath_,container_,format_,codec_,channels_,freq_))
+    return 0;
+
+  rv = writer.write(data_,data_size_);
+  writer.close();
 
   return rv;
 }
@@ -18,32 +18,172 @@
 
 #pragma once
 
+#include "ffmpeg_libav.hpp"
 #include "types_ints.h"
 
 #include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 
+struct subprocess_s;
+
 namespace ffmpeg
 {
   bool ffmpeg_available(void);
   bool ffplay_available(void);
   bool ffprobe_available(void);
 
-  bool file_recognizable(const std::filesystem::path &path);
+  struct Probe
+  {
+    int         freq;
+    int         channels;
+    double      duration;
+    std::string codec;
+    std::string sample_fmt;
+  };
+
+  bool probe(const std::filesystem::path &path,
+             Probe                       &probe);
 
-  int freq(const std::filesystem::path &path);
+  // Channels of the input's first audio stream or -1.
   int channels(const std::filesystem::path &path);
 
+  /*
+    With allow_libav false the ffmpeg executable is used even when the
+    FFmpeg libraries are available. Returns nothing if the input
+    can't be decoded at all and throws if decoding fails part way.
+  */
   std::vector<s16>
   to_s16le(const std::filesystem::path &path,
            const int                    channels,
-           const int                    freq);
+           const int                    freq,
+           const bool                   allow_libav = true);
+
+  /*
+    Decodes a file to interleaved s16le through an ffmpeg pipe and
+    hands it out a block at a time so the whole stream never needs to
+    be in memory. When the FFmpeg libraries can be loaded, and
+    allow_libav is set, the file is decoded in process instead. For
+    "-" a thread copies stdin into ffmpeg.
+  */
+  class S16LEReader
+  {
+  public:
+    S16LEReader();
+    ~S16LEReader();
+
+    S16LEReader(const S16LEReader&) = delete;
+    S16LEReader& operator=(const S16LEReader&) = delete;
+
+  public:
+    bool open(const std::filesystem::path &path,
+              const int                    channels,
+              const int                    freq,
+              const bool                   allow_libav = true);
+    u64  read(s16       *buf,
+              const u64  count);
+    int  close(void);
+
+  private:
+    struct subprocess_s *_subproc;
+    std::thread          _feeder;
+    std::thread          _stderr_drainer;
+    libav::Decoder       _libav;
+    bool                 _use_libav;
+  };
+
+  /*
+    Amortizes ffmpeg startup over many inputs. Files are split into
+    groups and the first request for any file in a group decodes the
+    whole group with a single ffmpeg process, one s16le output per
+    input, into a private temporary directory. Consecutive files land
+    in different groups so concurrent jobs don't wait on each other.
+    Should a group fail, for instance because one member isn't a
+    format ffmpeg knows, its files are decoded one by one instead.
+  */
+  class GroupDecoder
+  {
+  public:
+    GroupDecoder(const std::vector<std::filesystem::path> &filepaths,
+                 const unsigned                            group_size,
+                 const unsigned                            min_groups,
+                 const int                                 channels,
+                 const int                                 freq,
+                 const bool                                allow_libav = true);
+    ~GroupDecoder();
+
+    GroupDecoder(const GroupDecoder&) = delete;
+    GroupDecoder& operator=(const GroupDecoder&) = delete;
+
+  public:
+    std::vector<s16> to_s16le(const std::filesystem::path &filepath);
+
+  private:
+    struct Group
+    {
+      std::mutex                         mutex;
+      bool                               decoded;
+      bool                               ok;
+      std::filesystem::path              dirpath;
+      std::vector<std::filesystem::path> filepaths;
+    };
+
+  private:
+    bool decode(Group &group);
+
+  private:
+    int  _channels;
+    int  _freq;
+    bool _allow_libav;
+    std::vector<std::unique_ptr<Group>> _groups;
+    std::map<std::filesystem::path,std::pair<u64,u64>> _index;
+  };
+
+  /*
+    Feeds raw data to an ffmpeg process which muxes it into filepath
+    as container. Data goes into an enlarged pipe a block at a time
+    while a separate thread drains ffmpeg's output, so the child never
+    stalls on a full pipe and muxing overlaps whatever the caller does
+    between writes. For "-" the drained output is the muxed stream and
+    is copied to stdout while a second thread drains and discards
+    ffmpeg's separate stderr.
+  */
+  class Writer
+  {
+  public:
+    Writer();
+    ~Writer();
+
+    Writer(const Writer&) = delete;
+    Writer& operator=(const Writer&) = delete;
+
+  public:
+    bool open(const std::filesystem::path &filepath,
+              const std::string           &container,
+              const std::string           &format,
+              const std::string           &codec,
+              const int                    channels,
+              const int                    freq);
+    u64  write(const void *data,
+               const u64   data_size);
+    int  close(void);
+
+  private:
+    struct subprocess_s *_subproc;
+    std::thread          _drainer;
+    std::thread          _stderr_drainer;
+  };
 
   u64
   write(const void                  *data,
         const u64                    data_size,
         const std::filesystem::path &filepath,
-        const std::string           &format_,
+        const std::string           &container,
+        const std::string           &format,
         const std::string           &codec,
         const int                    channels,
         const int                    freq);
@@ -0,0 +1,489 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "ffmpeg_libav.hpp"
+
+// Static builds define NO_LIBAV as dlopen() can't load the system
+// libraries into them.
+#if !defined NO_LIBAV                        && \
+    __has_include(<libavformat/avformat.h>) && \
+    __has_include(<libavcodec/avcodec.h>)   && \
+    __has_include(<libswresample/swresample.h>)
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/channel_layout.h>
+#include <libswresample/swresample.h>
+}
+// AVChannelLayout and swr_alloc_set_opts2 arrived in FFmpeg 5.1
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57,24,100)
+#define HAVE_LIBAV 1
+#endif
+#endif
+
+#ifdef HAVE_LIBAV
+
+#include "fmt.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#define API_FUNC(X) decltype(&::X) X
+
+namespace l
+{
+  struct API
+  {
+    API_FUNC(avformat_open_input);
+    API_FUNC(avformat_find_stream_info);
+    API_FUNC(av_find_best_stream);
+    API_FUNC(av_read_frame);
+    API_FUNC(avformat_close_input);
+    API_FUNC(avcodec_alloc_context3);
+    API_FUNC(avcodec_parameters_to_context);
+    API_FUNC(avcodec_open2);
+    API_FUNC(avcodec_send_packet);
+    API_FUNC(avcodec_receive_frame);
+    API_FUNC(avcodec_free_context);
+    API_FUNC(av_packet_alloc);
+    API_FUNC(av_packet_free);
+    API_FUNC(av_packet_unref);
+    API_FUNC(av_frame_alloc);
+    API_FUNC(av_frame_free);
+    API_FUNC(av_channel_layout_default);
+    API_FUNC(av_channel_layout_copy);
+    API_FUNC(av_channel_layout_uninit);
+    API_FUNC(swr_alloc_set_opts2);
+    API_FUNC(swr_init);
+    API_FUNC(swr_convert);
+    API_FUNC(swr_get_out_samples);
+    API_FUNC(swr_free);
+  };
+
+  static API g_API;
+
+  /*
+    Only the major version the headers describe is ABI compatible so
+    the soname is pinned to it.
+  */
+  static
+  void*
+  open_library(const char *name_,
+               const int   major_)
+  {
+    std::string filename;
+
+#if defined(_WIN32)
+    filename = fmt::format("{}-{}.dll",name_,major_);
+    return (void*)LoadLibraryA(filename.c_str());
+#elif defined(__APPLE__)
+    filename = fmt::format("lib{}.{}.dylib",name_,major_);
+    return dlopen(filename.c_str(),RTLD_NOW|RTLD_LOCAL);
+#else
+    filename = fmt::format("lib{}.so.{}",name_,major_);
+    return dlopen(filename.c_str(),RTLD_NOW|RTLD_LOCAL);
+#endif
+  }
+
+  static
+  void*
+  symbol(void       *library_,
+         const char *name_)
+  {
+#ifdef _WIN32
+    return (void*)GetProcAddress((HMODULE)library_,name_);
+#else
+    return dlsym(library_,name_);
+#endif
+  }
+
+#define API_LOAD(LIB,X)                                 \
+  g_API.X = (decltype(g_API.X))l::symbol(LIB,#X);       \
+  if(g_API.X == NULL)                                   \
+    return false;
+
+  static
+  bool
+  load(void)
+  {
+    void *avutil;
+    void *avcodec;
+    void *avformat;
+    void *swresample;
+
+    avutil     = l::open_library("avutil",LIBAVUTIL_VERSION_MAJOR);
+    avcodec    = l::open_library("avcodec",LIBAVCODEC_VERSION_MAJOR);
+    avformat   = l::open_library("avformat",LIBAVFORMAT_VERSION_MAJOR);
+    swresample = l::open_library("swresample",LIBSWRESAMPLE_VERSION_MAJOR);
+    if(!avutil || !avcodec || !avformat || !swresample)
+      return false;
+
+    API_LOAD(avformat,avformat_open_input);
+    API_LOAD(avformat,avformat_find_stream_info);
+    API_LOAD(avformat,av_find_best_stream);
+    API_LOAD(avformat,av_read_frame);
+    API_LOAD(avformat,avformat_close_input);
+    API_LOAD(avcodec,avcodec_alloc_context3);
+    API_LOAD(avcodec,avcodec_parameters_to_context);
+    API_LOAD(avcodec,avcodec_open2);
+    API_LOAD(avcodec,avcodec_send_packet);
+    API_LOAD(avcodec,avcodec_receive_frame);
+    API_LOAD(avcodec,avcodec_free_context);
+    API_LOAD(avcodec,av_packet_alloc);
+    API_LOAD(avcodec,av_packet_free);
+    API_LOAD(avcodec,av_packet_unref);
+    API_LOAD(avutil,av_frame_alloc);
+    API_LOAD(avutil,av_frame_free);
+    API_LOAD(avutil,av_channel_layout_default);
+    API_LOAD(avutil,av_channel_layout_copy);
+    API_LOAD(avutil,av_channel_layout_uninit);
+    API_LOAD(swresample,swr_alloc_set_opts2);
+    API_LOAD(swresample,swr_init);
+    API_LOAD(swresample,swr_convert);
+    API_LOAD(swresample,swr_get_out_samples);
+    API_LOAD(swresample,swr_free);
+
+    return true;
+  }
+}
+
+struct ffmpeg::libav::Decoder::State
+{
+  AVFormatContext *fmt_ctx;
+  AVCodecContext  *codec_ctx;
+  SwrContext      *swr;
+  AVPacket        *packet;
+  AVFrame         *frame;
+  int              stream_idx;
+  int              channels;
+  bool             draining;
+  bool             done;
+  bool             failed;
+};
+
+bool
+ffmpeg::libav::available(void)
+{
+  static bool loaded = false;
+  static std::once_flag flag;
+
+  std::call_once(flag,[]{ loaded = l::load(); });
+
+  return loaded;
+}
+
+ffmpeg::libav::Decoder::Decoder()
+  : _state(NULL),
+    _pending_offset(0)
+{
+}
+
+ffmpeg::libav::Decoder::~Decoder()
+{
+  close();
+}
+
+bool
+ffmpeg::libav::Decoder::open(const std::filesystem::path &filepath_,
+                             const int                    channels_,
+                             const int                    freq_)
+{
+  int rv;
+  std::string filepath;
+  const AVCodec *codec;
+  AVChannelLayout in_layout = {};
+  AVChannelLayout out_layout = {};
+  const l::API &api = l::g_API;
+
+  close();
+
+  if(!libav::available())
+    return false;
+
+  _state = new State();
+  State &s = *_state;
+
+  filepath = filepath_.string();
+  if(api.avformat_open_input(&s.fmt_ctx,filepath.c_str(),NULL,NULL) < 0)
+    return (close(),false);
+  if(api.avformat_find_stream_info(s.fmt_ctx,NULL) < 0)
+    return (close(),false);
+
+  codec = NULL;
+  s.stream_idx = api.av_find_best_stream(s.fmt_ctx,
+                                         AVMEDIA_TYPE_AUDIO,
+                                         -1,
+                                         -1,
+                                         &codec,
+                                         0);
+  if((s.stream_idx < 0) || (codec == NULL))
+    return (close(),false);
+
+  s.codec_ctx = api.avcodec_alloc_context3(codec);
+  if(s.codec_ctx == NULL)
+    return (close(),false);
+  if(api.avcodec_parameters_to_context(s.codec_ctx,
+                                       s.fmt_ctx->streams[s.stream_idx]->codecpar) < 0)
+    return (close(),false);
+  if(api.avcodec_open2(s.codec_ctx,codec,NULL) < 0)
+    return (close(),false);
+
+  // Same as ffmpeg's -ac/-ar: libswresample picks the mix matrix.
+  if(s.codec_ctx->ch_layout.order == AV_CHANNEL_ORDER_UNSPEC)
+    api.av_channel_layout_default(&in_layout,s.codec_ctx->ch_layout.nb_channels);
+  else
+    api.av_channel_layout_copy(&in_layout,&s.codec_ctx->ch_layout);
+  api.av_channel_layout_default(&out_layout,channels_);
+
+  rv = api.swr_alloc_set_opts2(&s.swr,
+                               &out_layout,
+                               AV_SAMPLE_FMT_S16,
+                               freq_,
+                               &in_layout,
+                               s.codec_ctx->sample_fmt,
+                               s.codec_ctx->sample_rate,
+                               0,
+                               NULL);
+  api.av_channel_layout_uninit(&in_layout);
+  api.av_channel_layout_uninit(&out_layout);
+  if((rv < 0) || (api.swr_init(s.swr) < 0))
+    return (close(),false);
+
+  s.packet = api.av_packet_alloc();
+  s.frame  = api.av_frame_alloc();
+  if((s.packet == NULL) || (s.frame == NULL))
+    return (close(),false);
+
+  s.channels = channels_;
+  s.draining = false;
+  s.done     = false;
+  s.failed   = false;
+
+  return true;
+}
+
+/*
+  Converts the next decoded frame, or what libswresample still holds
+  once the decoder is drained. Output goes straight into dst_ when it
+  fits and into _pending otherwise. Returns the number of samples
+  written to dst_ or -1 once the stream is finished. Errors, other
+  than packets the decoder rejects, end the stream early and are
+  recorded for close().
+*/
+s64
+ffmpeg::libav::Decoder::decode_more(s16       *dst_,
+                                    const u64  room_)
+{
+  int rv;
+  u8 *out;
+  int in_frames;
+  int out_frames;
+  const u8 **in;
+  const l::API &api = l::g_API;
+  State &s = *_state;
+
+  while(!s.done)
+    {
+      rv = api.avcodec_receive_frame(s.codec_ctx,s.frame);
+      if(rv == AVERROR(EAGAIN))
+        {
+          if(s.draining)
+            return (s.done = true,-1);
+
+          rv = api.av_read_frame(s.fmt_ctx,s.packet);
+          if(rv < 0)
+            {
+              s.failed   = (rv != AVERROR_EOF);
+              s.draining = true;
+              api.avcodec_send_packet(s.codec_ctx,NULL);
+              continue;
+            }
+
+          // Like ffmpeg, undecodable packets are skipped.
+          if(s.packet->stream_index == s.stream_idx)
+            api.avcodec_send_packet(s.codec_ctx,s.packet);
+          api.av_packet_unref(s.packet);
+          continue;
+        }
+
+      if(rv == AVERROR_EOF)
+        {
+          s.done    = true;
+          in        = NULL;
+          in_frames = 0;
+        }
+      else if(rv == 0)
+        {
+          in        = (const u8**)s.frame->extended_data;
+          in_frames = s.frame->nb_samples;
+        }
+      else
+        {
+          return (s.failed = s.done = true,-1);
+        }
+
+      out_frames = api.swr_get_out_samples(s.swr,in_frames);
+      if((out_frames <= 0) && (in == NULL))
+        continue;
+      out_frames = std::max(out_frames,0);
+
+      if(((u64)out_frames * s.channels) <= room_)
+        {
+          out = (u8*)dst_;
+          rv  = api.swr_convert(s.swr,&out,out_frames,in,in_frames);
+          if(rv < 0)
+            return (s.failed = s.done = true,-1);
+          if(rv > 0)
+            return ((s64)rv * s.channels);
+          continue;
+        }
+
+      _pending.resize((u64)out_frames * s.channels);
+      out = (u8*)_pending.data();
+      rv  = api.swr_convert(s.swr,&out,out_frames,in,in_frames);
+      if(rv < 0)
+        return (s.failed = s.done = true,-1);
+
+      _pending.resize((u64)rv * s.channels);
+      _pending_offset = 0;
+      if(rv > 0)
+        return 0;
+    }
+
+  return -1;
+}
+
+u64
+ffmpeg::libav::Decoder::read(s16       *buf_,
+                             const u64  count_)
+{
+  u64 n;
+  s64 rv;
+  u64 filled;
+
+  if(_state == NULL)
+    return 0;
+
+  filled = 0;
+  while(filled < count_)
+    {
+      if(_pending_offset < _pending.size())
+        {
+          n = std::min(count_ - filled,_pending.size() - _pending_offset);
+          memcpy(&buf_[filled],&_pending[_pending_offset],n * sizeof(s16));
+          filled          += n;
+          _pending_offset += n;
+          continue;
+        }
+
+      rv = decode_more(&buf_[filled],count_ - filled);
+      if(rv < 0)
+        break;
+
+      filled += rv;
+    }
+
+  return filled;
+}
+
+int
+ffmpeg::libav::Decoder::close(void)
+{
+  int rv;
+  const l::API &api = l::g_API;
+
+  if(_state == NULL)
+    return -1;
+
+  rv = (_state->failed ? -1 : 0);
+
+  if(_state->frame)
+    api.av_frame_free(&_state->frame);
+  if(_state->packet)
+    api.av_packet_free(&_state->packet);
+  if(_state->swr)
+    api.swr_free(&_state->swr);
+  if(_state->codec_ctx)
+    api.avcodec_free_context(&_state->codec_ctx);
+  if(_state->fmt_ctx)
+    api.avformat_close_input(&_state->fmt_ctx);
+
+  delete _state;
+  _state = NULL;
+
+  _pending.clear();
+  _pending_offset = 0;
+
+  return rv;
+}
+
+#else
+
+struct ffmpeg::libav::Decoder::State
+{
+};
+
+bool
+ffmpeg::libav::available(void)
+{
+  return false;
+}
+
+ffmpeg::libav::Decoder::Decoder()
+  : _state(NULL),
+    _pending_offset(0)
+{
+}
+
+ffmpeg::libav::Decoder::~Decoder()
+{
+}
+
+bool
+ffmpeg::libav::Decoder::open(const std::filesystem::path &filepath_,
+                             const int                    channels_,
+                             const int                    freq_)
+{
+  return false;
+}
+
+u64
+ffmpeg::libav::Decoder::read(s16       *buf_,
+                             const u64  count_)
+{
+  return 0;
+}
+
+int
+ffmpeg::libav::Decoder::close(void)
+{
+  return -1;
+}
+
+#endif
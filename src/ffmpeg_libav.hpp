@@ -0,0 +1,69 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "types_ints.h"
+
+#include <filesystem>
+#include <vector>
+
+/*
+  In process decoding through libavformat, libavcodec and
+  libswresample. The libraries are loaded with dlopen the first time
+  they're needed so 3at neither links against nor requires them. When
+  built without the FFmpeg headers, or when the matching library
+  versions can't be loaded at runtime, available() is false and
+  callers fall back to running the ffmpeg executable. close() returns
+  non-zero when decoding stopped on an error.
+*/
+namespace ffmpeg
+{
+  namespace libav
+  {
+    bool available(void);
+
+    class Decoder
+    {
+    public:
+      Decoder();
+      ~Decoder();
+
+      Decoder(const Decoder&) = delete;
+      Decoder& operator=(const Decoder&) = delete;
+
+    public:
+      bool open(const std::filesystem::path &filepath,
+                const int                    channels,
+                const int                    freq);
+      u64  read(s16       *buf,
+                const u64  count);
+      int  close(void);
+
+    private:
+      s64  decode_more(s16       *dst,
+                       const u64  room);
+
+    private:
+      struct State;
+      State            *_state;
+      std::vector<s16>  _pending;
+      u64               _pending_offset;
+    };
+  }
+}
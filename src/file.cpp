@@ -21,58 +21,243 @@
 #include <array>
 #include <vector>
 
+#include <cstdint>
 #include <cstdio>
 
-std::vector<u8>
-file::load_u8(const std::filesystem::path &filepath_)
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+namespace l
 {
-  FILE *input;
-  std::vector<u8> buf;
-  std::array<u8,4096> tmpbuf;
+  static
+  FILE*
+  stdio(FILE *file_)
+  {
+#ifdef _WIN32
+    _setmode(_fileno(file_),_O_BINARY);
+#endif
 
-  input = fopen(filepath_.string().c_str(),"rb");
-  if(input == NULL)
-    return {};
+    return file_;
+  }
 
-  while(!feof(input) && !ferror(input))
-    {
-      size_t n;
-        
-      n = fread(tmpbuf.data(),sizeof(u8),tmpbuf.size(),input);
-      buf.reserve(buf.size() + n);
-      buf.insert(buf.end(),
-                 tmpbuf.begin(),
-                 tmpbuf.begin() + n);
-    }
+  template<typename T>
+  static
+  std::vector<T>
+  load(const std::filesystem::path &filepath_)
+  {
+    FILE *input;
+    std::vector<T> buf;
+    std::error_code ec;
+    std::array<T,4096> tmpbuf;
+
+    if(file::is_stdio(filepath_))
+      input = l::stdio(stdin);
+    else
+      input = fopen(filepath_.string().c_str(),"rb");
+    if(input == NULL)
+      return {};
+
+    // Size once up front when possible rather than growing per
+    // read. Pipes, such as /dev/fd/N, have no size and are read
+    // incrementally.
+    if((input != stdin) &&
+       std::filesystem::is_regular_file(filepath_,ec) &&
+       !ec)
+      {
+        std::uintmax_t size;
+
+        size = std::filesystem::file_size(filepath_,ec);
+        if(!ec && (size >= sizeof(T)))
+          {
+            buf.resize(size / sizeof(T));
+            buf.resize(fread(buf.data(),sizeof(T),buf.size(),input));
+            fclose(input);
+            return buf;
+          }
+      }
+
+    while(!feof(input) && !ferror(input))
+      {
+        size_t n;
 
-  fclose(input);
-    
-  return buf;
+        n = fread(tmpbuf.data(),sizeof(T),tmpbuf.size(),input);
+        buf.insert(buf.end(),
+                   tmpbuf.begin(),
+                   tmpbuf.begin() + n);
+      }
+
+    if(input != stdin)
+      fclose(input);
+
+    return buf;
+  }
 }
 
-std::vector<s16>
-file::load_s16(const std::filesystem::path &filepath_)
+bool
+file::is_stdio(const std::filesystem::path &filepath_)
+{
+  return (filepath_ == "-");
+}
+
+file::View::View()
+  : _data(NULL),
+    _size(0),
+    _mapped(false)
+{
+}
+
+file::View::~View()
 {
-  FILE *input;
-  std::vector<s16> buf;
-  std::array<s16,2048> tmpbuf;
+  close();
+}
+
+bool
+file::View::open(const std::filesystem::path &filepath_)
+{
+  close();
+
+#ifndef _WIN32
+  int fd;
+  void *p;
+  struct stat st;
 
-  input = fopen(filepath_.string().c_str(),"rb");
-  if(input == NULL)
-    return {};
+  if(file::is_stdio(filepath_))
+    fd = ::dup(STDIN_FILENO);
+  else
+    fd = ::open(filepath_.string().c_str(),O_RDONLY);
+  if(fd == -1)
+    return false;
 
-  while(!feof(input) && !ferror(input))
+  if((fstat(fd,&st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0))
     {
-      size_t n;
-        
-      n = fread(tmpbuf.data(),sizeof(s16),tmpbuf.size(),input);
-      buf.reserve(buf.size() + n);
-      buf.insert(buf.end(),
-                 tmpbuf.begin(),
-                 tmpbuf.begin() + n);
+      p = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+      if(p != MAP_FAILED)
+        {
+          madvise(p,st.st_size,MADV_SEQUENTIAL);
+          ::close(fd);
+
+          _data   = (const u8*)p;
+          _size   = st.st_size;
+          _mapped = true;
+
+          return true;
+        }
     }
 
-  fclose(input);
-    
-  return buf;
+  ::close(fd);
+#endif
+
+  _buf  = l::load<u8>(filepath_);
+  _data = _buf.data();
+  _size = _buf.size();
+
+  return !_buf.empty();
+}
+
+void
+file::View::close(void)
+{
+#ifndef _WIN32
+  if(_mapped)
+    munmap((void*)_data,_size);
+#endif
+
+  _buf.clear();
+  _buf.shrink_to_fit();
+  _data   = NULL;
+  _size   = 0;
+  _mapped = false;
+}
+
+file::Reader::Reader()
+  : _file(NULL)
+{
+}
+
+file::Reader::~Reader()
+{
+  close();
+}
+
+bool
+file::Reader::open(const std::filesystem::path &filepath_)
+{
+  close();
+
+  if(file::is_stdio(filepath_))
+    _file = l::stdio(stdin);
+  else
+    _file = fopen(filepath_.string().c_str(),"rb");
+
+  return (_file != NULL);
+}
+
+u64
+file::Reader::read(void      *buf_,
+                   const u64  size_)
+{
+  if(_file == NULL)
+    return 0;
+
+  return fread(buf_,1,size_,_file);
+}
+
+void
+file::Reader::close(void)
+{
+  if((_file != NULL) && (_file != stdin))
+    fclose(_file);
+  _file = NULL;
+}
+
+FILE*
+file::open_output(const std::filesystem::path &filepath_)
+{
+  if(file::is_stdio(filepath_))
+    return l::stdio(stdout);
+
+  return fopen(filepath_.string().c_str(),"wb");
+}
+
+int
+file::close_output(FILE *file_)
+{
+  if(file_ == stdout)
+    return fflush(file_);
+
+  return fclose(file_);
+}
+
+// Drops what a failed conversion left behind. Only regular files are
+// removed, stdout or a device given as output is left alone.
+void
+file::remove_output(const std::filesystem::path &filepath_)
+{
+  std::error_code ec;
+
+  if(file::is_stdio(filepath_))
+    return;
+  if(!std::filesystem::is_regular_file(filepath_,ec))
+    return;
+
+  std::filesystem::remove(filepath_,ec);
+}
+
+std::vector<u8>
+file::load_u8(const std::filesystem::path &filepath_)
+{
+  return l::load<u8>(filepath_);
+}
+
+std::vector<s16>
+file::load_s16(const std::filesystem::path &filepath_)
+{
+  return l::load<s16>(filepath_);
 }
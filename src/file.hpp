@@ -23,8 +23,74 @@
 #include <filesystem>
 #include <vector>
 
+#include <cstdio>
+
 namespace file
 {
+  // "-" as a path means stdin for input and stdout for output.
+  bool is_stdio(const std::filesystem::path &filepath);
+
+  /*
+    Read only view of a whole file. Regular files are memory mapped
+    and advised for sequential access. Anything else, or platforms
+    without mmap, is read into a buffer owned by the view.
+  */
+  class View
+  {
+  public:
+    View();
+    ~View();
+
+    View(const View&) = delete;
+    View& operator=(const View&) = delete;
+
+  public:
+    bool open(const std::filesystem::path &filepath);
+    void close(void);
+
+    const u8 *data(void) const { return _data; }
+    u64       size(void) const { return _size; }
+    bool      empty(void) const { return (_size == 0); }
+
+    template<typename T>
+    const T *data_as(void) const { return (const T*)_data; }
+    template<typename T>
+    u64 size_as(void) const { return (_size / sizeof(T)); }
+
+  private:
+    const u8        *_data;
+    u64              _size;
+    bool             _mapped;
+    std::vector<u8>  _buf;
+  };
+
+  /*
+    Sequential reader for input which may be a pipe. read() only
+    returns less than asked for at the end of the input.
+  */
+  class Reader
+  {
+  public:
+    Reader();
+    ~Reader();
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+  public:
+    bool open(const std::filesystem::path &filepath);
+    u64  read(void      *buf,
+              const u64  size);
+    void close(void);
+
+  private:
+    FILE *_file;
+  };
+
+  FILE *open_output(const std::filesystem::path &filepath);
+  int   close_output(FILE *file);
+  void  remove_output(const std::filesystem::path &filepath);
+
   std::vector<u8>  load_u8(const std::filesystem::path &filepath);
   std::vector<s16> load_s16(const std::filesystem::path &filepath);
 }
@@ -0,0 +1,164 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "hash.h"
+
+#include <string.h>
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static
+u64
+_rotl64(const u64 v_,
+        const int r_)
+{
+  return ((v_ << r_) | (v_ >> (64 - r_)));
+}
+
+// Unaligned little endian loads.
+static
+u64
+_read64(const u8 *p_)
+{
+  u64 v;
+
+  memcpy(&v,p_,sizeof(v));
+#if defined __BYTE_ORDER__ && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  v = __builtin_bswap64(v);
+#endif
+
+  return v;
+}
+
+static
+u32
+_read32(const u8 *p_)
+{
+  u32 v;
+
+  memcpy(&v,p_,sizeof(v));
+#if defined __BYTE_ORDER__ && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+  v = __builtin_bswap32(v);
+#endif
+
+  return v;
+}
+
+static
+u64
+_round(u64       acc_,
+       const u64 input_)
+{
+  acc_ += (input_ * PRIME64_2);
+  acc_  = _rotl64(acc_,31);
+  acc_ *= PRIME64_1;
+
+  return acc_;
+}
+
+static
+u64
+_merge_round(u64       acc_,
+             const u64 val_)
+{
+  acc_ ^= _round(0,val_);
+  acc_  = ((acc_ * PRIME64_1) + PRIME64_4);
+
+  return acc_;
+}
+
+u64
+hash64(const void *data_,
+       const u64   len_,
+       const u64   seed_)
+{
+  u64 h;
+  const u8 *p;
+  const u8 *end;
+
+  p   = (const u8*)data_;
+  end = (p + len_);
+
+  if(len_ >= 32)
+    {
+      u64 v1;
+      u64 v2;
+      u64 v3;
+      u64 v4;
+      const u8 *limit;
+
+      v1 = (seed_ + PRIME64_1 + PRIME64_2);
+      v2 = (seed_ + PRIME64_2);
+      v3 = (seed_ + 0);
+      v4 = (seed_ - PRIME64_1);
+
+      limit = (end - 32);
+      do
+        {
+          v1 = _round(v1,_read64(p + 0));
+          v2 = _round(v2,_read64(p + 8));
+          v3 = _round(v3,_read64(p + 16));
+          v4 = _round(v4,_read64(p + 24));
+          p += 32;
+        }
+      while(p <= limit);
+
+      h = (_rotl64(v1,1) + _rotl64(v2,7) + _rotl64(v3,12) + _rotl64(v4,18));
+      h = _merge_round(h,v1);
+      h = _merge_round(h,v2);
+      h = _merge_round(h,v3);
+      h = _merge_round(h,v4);
+    }
+  else
+    {
+      h = (seed_ + PRIME64_5);
+    }
+
+  h += len_;
+
+  for(; (p + 8) <= end; p += 8)
+    {
+      h ^= _round(0,_read64(p));
+      h  = ((_rotl64(h,27) * PRIME64_1) + PRIME64_4);
+    }
+
+  if((p + 4) <= end)
+    {
+      h ^= ((u64)_read32(p) * PRIME64_1);
+      h  = ((_rotl64(h,23) * PRIME64_2) + PRIME64_3);
+      p += 4;
+    }
+
+  for(; p < end; p++)
+    {
+      h ^= (*p * PRIME64_5);
+      h  = (_rotl64(h,11) * PRIME64_1);
+    }
+
+  h ^= (h >> 33);
+  h *= PRIME64_2;
+  h ^= (h >> 29);
+  h *= PRIME64_3;
+  h ^= (h >> 32);
+
+  return h;
+}
@@ -21,8 +21,59 @@
 #include "version.hpp"
 #include "options.hpp"
 
+#include "batch.hpp"
 #include "subcmd.hpp"
 
+// Inputs may also be "-" for stdin or directories with --recursive.
+static
+CLI::Validator
+existing_path_or_stdin(void)
+{
+  return CLI::Validator([](std::string &filepath_) -> std::string
+  {
+    if(filepath_ == "-")
+      return {};
+    return CLI::ExistingPath(filepath_);
+  },
+  "PATH");
+}
+
+static
+void
+add_walk_options(CLI::App                 *subcmd_,
+                 bool                     &recursive_,
+                 std::vector<std::string> &include_,
+                 std::vector<std::string> &exclude_)
+{
+  recursive_ = false;
+  subcmd_->add_flag("-r,--recursive",recursive_)
+    ->description("Convert every file below directories given as input.\n"
+                  "Conversion starts while the tree is still being read.");
+  subcmd_->add_option("--include",include_)
+    ->description("With --recursive only convert files matching GLOB.\n"
+                  "Matched against the file name, or the path below the\n"
+                  "input directory if GLOB contains a '/'. May be repeated.")
+    ->type_name("GLOB")
+    ->allow_extra_args(false);
+  subcmd_->add_option("--exclude",exclude_)
+    ->description("With --recursive skip files and directories matching\n"
+                  "GLOB. May be repeated.")
+    ->type_name("GLOB")
+    ->allow_extra_args(false);
+}
+
+static
+void
+add_output_file_option(CLI::App              *subcmd_,
+                       std::filesystem::path &output_file_)
+{
+  subcmd_->add_option("-o,--output",output_file_)
+    ->description("Write the output to PATH instead of a name derived\n"
+                  "from the input. '-' is stdout, which is also the\n"
+                  "default when the input is '-'. Single input only.")
+    ->type_name("PATH");
+}
+
 static
 void
 generate_version_argparser(CLI::App &app_)
@@ -44,30 +95,98 @@ generate_to_adp4_argparser(CLI::App      &app_,
 
   subcmd = app_.add_subcommand("to-adp4","Convert input to Intel/DVI ADP4 codec");
   subcmd->add_option("filepaths",opts.filepaths)
-    ->description("Path to source file")
+    ->description("Path to source file or directory")
     ->type_name("PATH")
-    ->check(CLI::ExistingFile)
+    ->check(existing_path_or_stdin())
     ->required();
+  add_walk_options(subcmd,opts.recursive,opts.include,opts.exclude);
   subcmd->add_option("--input-type",opts.input_type)
     ->description("raw: Load file as raw data. Channels and freq ignored.\n"
                   "auto: Try to use ffmpeg to load file and fall back to raw.")
     ->check(CLI::IsMember({"raw","auto"}))
     ->default_val("auto");
+  subcmd->add_option("--input-channels",opts.input_channels)
+    ->description("Channels of raw input. 0: same as output")
+    ->check(CLI::IsMember({0,1,2}))
+    ->default_val(opts.input_channels);
+  subcmd->add_option("--input-freq",opts.input_freq)
+    ->description("Frequency of raw input. 0: same as output")
+    ->type_name("HZ")
+    ->check(CLI::NonNegativeNumber)
+    ->default_val(opts.input_freq);
+  subcmd->add_option("--resample-quality",opts.resample_quality)
+    ->description("Filter used when resampling raw input")
+    ->check(CLI::IsMember({"fast","medium","high"}))
+    ->default_val(opts.resample_quality);
   subcmd->add_option("--output-type",opts.output_type)
     ->description("Output format")
     ->check(CLI::IsMember({"raw","aifc"}))
     ->default_val("raw");
   subcmd->add_option("--encoder",opts.encoder)
     ->description("Encoder to use\n"
-                  "default: Intel/DVI encoder by trapexit")
-    ->check(CLI::IsMember({"default"}))
-    ->default_val("default");
+                  "default: Intel/DVI encoder by trapexit\n"
+                  "trellis: searches ahead for the nibbles giving the\n"
+                  "  least total error. Slower but lower noise.")
+    ->check(CLI::IsMember({"default","trellis"}))
+    ->default_val(opts.encoder);
+  subcmd->add_option("--trellis-beam",opts.trellis_beam)
+    ->description("Candidate encodings the trellis encoder keeps")
+    ->type_name("N")
+    ->check(CLI::Range(1,256))
+    ->default_val(opts.trellis_beam);
+  subcmd->add_option("--trellis-lookahead",opts.trellis_lookahead)
+    ->description("Samples the trellis encoder looks ahead before\n"
+                  "settling on a nibble")
+    ->type_name("N")
+    ->check(CLI::Range(1,1024))
+    ->default_val(opts.trellis_lookahead);
+  subcmd->add_option("--threads",opts.threads)
+    ->description("Threads used to encode each file. The trellis\n"
+                  "encoder searches channels and segments of long\n"
+                  "inputs concurrently.")
+    ->type_name("N")
+    ->check(CLI::PositiveNumber)
+    ->default_val(opts.threads);
+  subcmd->add_option("--channels",opts.output_channels)
+    ->description("Number of output audio channels. Stereo is\n"
+                  "interleaved a frame per byte, left in the high nibble.\n"
+                  "0: same as input, probed with ffprobe")
+    ->check(CLI::IsMember({0,1,2}))
+    ->default_val(1);
   subcmd->add_option("--freq",opts.output_freq)
     ->description("Output frequency")
     ->check(CLI::IsMember({22050,44100}))
     ->default_val(22050);
 
-  subcmd->footer("NOTE: Currently only outputs raw files.");
+  subcmd->add_option("--ffmpeg-group",opts.ffmpeg_group)
+    ->description("Decode up to N input files with each ffmpeg process\n"
+                  "to amortize process startup over many small files")
+    ->type_name("N")
+    ->check(CLI::PositiveNumber)
+    ->default_val(1);
+
+  subcmd->add_option("--output-dir",opts.output_path)
+    ->description("Write outputs into PATH, mirroring the directory\n"
+                  "tree of the inputs, instead of next to each input")
+    ->type_name("PATH");
+  subcmd->add_option("--cache-dir",opts.cache_dir)
+    ->description("Reuse outputs of earlier conversions of identical\n"
+                  "input and options stored in PATH. Off by default.")
+    ->type_name("PATH");
+  subcmd->add_option("--cache-size",opts.cache_size)
+    ->description("Least recently used cache entries are removed once\n"
+                  "the cache is larger than SIZE")
+    ->type_name("SIZE")
+    ->transform(CLI::AsSizeValue(false))
+    ->default_val("1GB");
+
+  add_output_file_option(subcmd,opts.output_file);
+
+  subcmd->add_option("-j,--jobs",opts.jobs)
+    ->description("Number of files to convert concurrently")
+    ->type_name("N")
+    ->check(CLI::PositiveNumber)
+    ->default_val(batch::default_jobs());
 
   auto func = std::bind(SubCmd::to_adp4,
                         std::cref(opts));
@@ -85,15 +204,29 @@ generate_to_sdx2_argparser(CLI::App      &app_,
 
   subcmd = app_.add_subcommand("to-sdx2","Convert input to SDX2 codec");
   subcmd->add_option("filepaths",opts.filepaths)
-    ->description("Path to source file")
+    ->description("Path to source file or directory")
     ->type_name("PATH")
-    ->check(CLI::ExistingFile)
+    ->check(existing_path_or_stdin())
     ->required();
+  add_walk_options(subcmd,opts.recursive,opts.include,opts.exclude);
   subcmd->add_option("--input-type",opts.input_type)
     ->description("raw: Load file as raw data. Channels and freq ignored.\n"
                   "auto: Try to use ffmpeg to load file and fall back to raw.")
     ->check(CLI::IsMember({"raw","auto"}))
     ->default_val("auto");
+  subcmd->add_option("--input-channels",opts.input_channels)
+    ->description("Channels of raw input. 0: same as output")
+    ->check(CLI::IsMember({0,1,2}))
+    ->default_val(opts.input_channels);
+  subcmd->add_option("--input-freq",opts.input_freq)
+    ->description("Frequency of raw input. 0: same as output")
+    ->type_name("HZ")
+    ->check(CLI::NonNegativeNumber)
+    ->default_val(opts.input_freq);
+  subcmd->add_option("--resample-quality",opts.resample_quality)
+    ->description("Filter used when resampling raw input")
+    ->check(CLI::IsMember({"fast","medium","high"}))
+    ->default_val(opts.resample_quality);
   subcmd->add_option("--output-type",opts.output_type)
     ->description("Output format")
     ->check(CLI::IsMember({"raw","aifc"}))
@@ -102,17 +235,59 @@ generate_to_sdx2_argparser(CLI::App      &app_,
     ->description("Encoder to use\n"
                   "default: SDX2 3DO encoder ported by trapexit")
     ->check(CLI::IsMember({"default"}))
-    ->default_val("default");
+    ->default_val(opts.encoder);
+  subcmd->add_option("--threads",opts.threads)
+    ->description("Threads used to encode each file. Above 1 the stream\n"
+                  "is split into segments which start with an exact\n"
+                  "encoded frame.")
+    ->type_name("N")
+    ->check(CLI::PositiveNumber)
+    ->default_val(opts.threads);
+  subcmd->add_option("--resync-max-error",opts.resync_max_error)
+    ->description("Only split a multithreaded encode where the exact\n"
+                  "encoding error of every channel is at most N")
+    ->type_name("N")
+    ->check(CLI::NonNegativeNumber)
+    ->default_val(opts.resync_max_error);
   subcmd->add_option("--channels",opts.output_channels)
-    ->description("Number of output audio channels")
-    ->check(CLI::IsMember({1,2}))
+    ->description("Number of output audio channels\n"
+                  "0: same as input, probed with ffprobe")
+    ->check(CLI::IsMember({0,1,2}))
     ->default_val(1);
   subcmd->add_option("--freq",opts.output_freq)
     ->description("Output frequency")
     ->check(CLI::IsMember({22050,44100}))
     ->default_val(22050);
 
-  subcmd->footer("NOTE: Currently only outputs raw files.");
+  subcmd->add_option("--ffmpeg-group",opts.ffmpeg_group)
+    ->description("Decode up to N input files with each ffmpeg process\n"
+                  "to amortize process startup over many small files")
+    ->type_name("N")
+    ->check(CLI::PositiveNumber)
+    ->default_val(1);
+
+  subcmd->add_option("--output-dir",opts.output_path)
+    ->description("Write outputs into PATH, mirroring the directory\n"
+                  "tree of the inputs, instead of next to each input")
+    ->type_name("PATH");
+  subcmd->add_option("--cache-dir",opts.cache_dir)
+    ->description("Reuse outputs of earlier conversions of identical\n"
+                  "input and options stored in PATH. Off by default.")
+    ->type_name("PATH");
+  subcmd->add_option("--cache-size",opts.cache_size)
+    ->description("Least recently used cache entries are removed once\n"
+                  "the cache is larger than SIZE")
+    ->type_name("SIZE")
+    ->transform(CLI::AsSizeValue(false))
+    ->default_val("1GB");
+
+  add_output_file_option(subcmd,opts.output_file);
+
+  subcmd->add_option("-j,--jobs",opts.jobs)
+    ->description("Number of files to convert concurrently")
+    ->type_name("N")
+    ->check(CLI::PositiveNumber)
+    ->default_val(batch::default_jobs());
 
   auto func = std::bind(SubCmd::to_sdx2,
                         std::cref(opts));
@@ -131,10 +306,15 @@ generate_from_adp4_argparser(CLI::App      &app_,
   subcmd = app_.add_subcommand("from-adp4",
                                "Convert from raw Intel/DVI ADP4");
   subcmd->add_option("filepaths",opts.filepaths)
-    ->description("Path to source file")
+    ->description("Path to source file or directory")
     ->type_name("PATH")
-    ->check(CLI::ExistingFile)
+    ->check(existing_path_or_stdin())
     ->required();
+  add_walk_options(subcmd,opts.recursive,opts.include,opts.exclude);
+  subcmd->add_option("--channels",opts.channels)
+    ->description("Number of channels")
+    ->check(CLI::IsMember({1,2}))
+    ->default_val(1);
   subcmd->add_option("--output-type",opts.output_type)
     ->description("")
     ->check(CLI::IsMember({"raw","aiff","wav"}))
@@ -144,7 +324,15 @@ generate_from_adp4_argparser(CLI::App      &app_,
     ->check(CLI::IsMember({22050,44100}))
     ->default_val(22050);
 
-  subcmd->footer("NOTE: Currently only outputs raw files.");
+  add_output_file_option(subcmd,opts.output_file);
+
+  subcmd->add_option("-j,--jobs",opts.jobs)
+    ->description("Number of files to convert concurrently")
+    ->type_name("N")
+    ->check(CLI::PositiveNumber)
+    ->default_val(batch::default_jobs());
+
+  subcmd->footer("NOTE: AIFF-C input overrides --channels and --freq.");
 
   auto func = std::bind(SubCmd::from_adp4,
                         std::cref(opts));
@@ -162,10 +350,11 @@ generate_from_sdx2_argparser(CLI::App      &app_,
 
   subcmd = app_.add_subcommand("from-sdx2","Convert from raw SDX2");
   subcmd->add_option("filepaths",opts.filepaths)
-    ->description("Path to source file")
+    ->description("Path to source file or directory")
     ->type_name("PATH")
-    ->check(CLI::ExistingFile)
+    ->check(existing_path_or_stdin())
     ->required();
+  add_walk_options(subcmd,opts.recursive,opts.include,opts.exclude);
   subcmd->add_option("--channels",opts.channels)
     ->description("Number of channels")
     ->check(CLI::IsMember({1,2}))
@@ -179,7 +368,15 @@ generate_from_sdx2_argparser(CLI::App      &app_,
     ->check(CLI::IsMember({22050,44100}))
     ->default_val(22050);  
 
-  subcmd->footer("NOTE: Currently only outputs raw files.");
+  add_output_file_option(subcmd,opts.output_file);
+
+  subcmd->add_option("-j,--jobs",opts.jobs)
+    ->description("Number of files to convert concurrently")
+    ->type_name("N")
+    ->check(CLI::PositiveNumber)
+    ->default_val(batch::default_jobs());
+
+  subcmd->footer("NOTE: AIFF-C input overrides --channels and --freq.");
 
   auto func = std::bind(SubCmd::from_sdx2,
                         std::cref(opts));
@@ -187,6 +384,140 @@ generate_from_sdx2_argparser(CLI::App      &app_,
   subcmd->callback(func);
 }
 
+static
+void
+generate_transcode_argparser(CLI::App      &app_,
+                             Opts::Options &opts_)
+{
+  CLI::App *subcmd;
+  Opts::Transcode &opts = opts_.transcode;
+
+  subcmd = app_.add_subcommand("transcode",
+                               "Convert between SDX2 and ADP4 directly");
+  subcmd->add_option("filepaths",opts.filepaths)
+    ->description("Path to source file or directory")
+    ->type_name("PATH")
+    ->check(existing_path_or_stdin())
+    ->required();
+  add_walk_options(subcmd,opts.recursive,opts.include,opts.exclude);
+  subcmd->add_option("--to",opts.to)
+    ->description("Output codec. Input is the other one.")
+    ->check(CLI::IsMember({"adp4","sdx2"}))
+    ->default_val("adp4");
+  subcmd->add_option("--output-type",opts.output_type)
+    ->description("")
+    ->check(CLI::IsMember({"raw","aifc"}))
+    ->default_val("raw");
+  subcmd->add_option("--channels",opts.channels)
+    ->description("Number of channels of raw input")
+    ->check(CLI::IsMember({1,2}))
+    ->default_val(1);
+  subcmd->add_option("--output-channels",opts.output_channels)
+    ->description("Number of output channels. Stereo input is\n"
+                  "downmixed and mono input duplicated in process.\n"
+                  "0: same as input")
+    ->check(CLI::IsMember({0,1,2}))
+    ->default_val(0);
+  subcmd->add_option("--freq",opts.freq)
+    ->description("Frequency of raw input")
+    ->check(CLI::IsMember({22050,44100}))
+    ->default_val(22050);
+
+  add_output_file_option(subcmd,opts.output_file);
+
+  subcmd->add_option("-j,--jobs",opts.jobs)
+    ->description("Number of files to convert concurrently")
+    ->type_name("N")
+    ->check(CLI::PositiveNumber)
+    ->default_val(batch::default_jobs());
+
+  subcmd->footer("NOTE: AIFF-C input overrides --channels and --freq.");
+
+  auto func = std::bind(SubCmd::transcode,
+                        std::cref(opts));
+
+  subcmd->callback(func);
+}
+
+static
+void
+generate_manifest_argparser(CLI::App      &app_,
+                            Opts::Options &opts_)
+{
+  CLI::App *subcmd;
+  Opts::Manifest &opts = opts_.manifest;
+
+  subcmd = app_.add_subcommand("manifest",
+                               "Convert the files listed in a manifest");
+  subcmd->add_option("filepath",opts.filepath)
+    ->description("Manifest listing one conversion per line. '-' is stdin.")
+    ->type_name("PATH")
+    ->check(existing_path_or_stdin())
+    ->required();
+  subcmd->add_option("--format",opts.format)
+    ->description("jsonl: one JSON object per line\n"
+                  "csv: comma separated with a header row\n"
+                  "auto: by extension, else by the first character")
+    ->check(CLI::IsMember({"auto","jsonl","csv"}))
+    ->default_val("auto");
+  subcmd->add_option("-j,--jobs",opts.jobs)
+    ->description("Number of files to convert concurrently")
+    ->type_name("N")
+    ->check(CLI::PositiveNumber)
+    ->default_val(batch::default_jobs());
+
+  subcmd->footer("FIELDS: input (required), codec (adp4|sdx2, required),\n"
+                 "  channels (1), freq (22050), output, input_type (auto),\n"
+                 "  output_type (raw). Relative paths are resolved against\n"
+                 "  the manifest's directory.");
+
+  auto func = std::bind(SubCmd::manifest,
+                        std::cref(opts));
+
+  subcmd->callback(func);
+}
+
+static
+void
+generate_bench_argparser(CLI::App      &app_,
+                         Opts::Options &opts_)
+{
+  CLI::App *subcmd;
+  Opts::Bench &opts = opts_.bench;
+
+  subcmd = app_.add_subcommand("bench","Measure conversion throughput");
+  subcmd->add_option("filepaths",opts.filepaths)
+    ->description("Path to source file")
+    ->type_name("PATH")
+    ->check(CLI::ExistingFile);
+  subcmd->add_option("--target",opts.target)
+    ->description("ffmpeg-decode: files/sec decoding inputs with one\n"
+                  "  ffmpeg process per file vs per --ffmpeg-group files,\n"
+                  "  and in process when the FFmpeg libraries load\n"
+                  "adp4-decode: samples/sec of the table driven ADP4\n"
+                  "  decoder vs the reference, on raw ADP4 inputs or noise\n"
+                  "adp4-encode: samples/sec encoding many mono streams\n"
+                  "  one per SIMD lane vs one after another, on raw s16\n"
+                  "  inputs or noise")
+    ->check(CLI::IsMember({"ffmpeg-decode","adp4-decode","adp4-encode"}))
+    ->default_val("ffmpeg-decode");
+  subcmd->add_option("--ffmpeg-group",opts.ffmpeg_group)
+    ->description("Input files per ffmpeg process for grouped decoding")
+    ->type_name("N")
+    ->check(CLI::PositiveNumber)
+    ->default_val(16);
+  subcmd->add_option("-j,--jobs",opts.jobs)
+    ->description("Number of files to decode concurrently")
+    ->type_name("N")
+    ->check(CLI::PositiveNumber)
+    ->default_val(batch::default_jobs());
+
+  auto func = std::bind(SubCmd::bench,
+                        std::cref(opts));
+
+  subcmd->callback(func);
+}
+
 static
 void
 generate_argparser(CLI::App      &app_,
@@ -200,6 +531,9 @@ generate_argparser(CLI::App      &app_,
   generate_to_sdx2_argparser(app_,opts_);
   generate_from_adp4_argparser(app_,opts_);
   generate_from_sdx2_argparser(app_,opts_);
+  generate_transcode_argparser(app_,opts_);
+  generate_manifest_argparser(app_,opts_);
+  generate_bench_argparser(app_,opts_);
   generate_version_argparser(app_);
 }
 
@@ -245,12 +579,14 @@ main(int    argc_,
     }
   catch(const std::system_error &e_)
     {
-      fmt::print("{} ({})\n",e_.what(),e_.code().message());
+      fmt::print(stderr,"{} ({})\n",e_.what(),e_.code().message());
+      return 1;
     }
   catch(const std::runtime_error &e_)
     {
-      fmt::print("{}\n",e_.what());
+      fmt::print(stderr,"{}\n",e_.what());
+      return 1;
     }
 
-  return 0;
+  return ((batch::failures() > 0) ? 1 : 0);
 }
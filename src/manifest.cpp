@@ -0,0 +1,527 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "manifest.hpp"
+
+#include "file.hpp"
+
+#include "fmt.hpp"
+
+#include "types_ints.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+#include <cctype>
+#include <cstdlib>
+
+
+namespace l
+{
+  typedef std::map<std::string,std::string> Fields;
+
+  static
+  bool
+  is_space(const char c_)
+  {
+    return isspace((u8)c_);
+  }
+
+  static
+  void
+  skip_ws(const std::string &line_,
+          size_t            &i_)
+  {
+    while((i_ < line_.size()) && l::is_space(line_[i_]))
+      i_++;
+  }
+
+  static
+  void
+  append_utf8(std::string &str_,
+              u32          cp_)
+  {
+    if(cp_ < 0x80)
+      {
+        str_ += (char)cp_;
+      }
+    else if(cp_ < 0x800)
+      {
+        str_ += (char)(0xC0 | (cp_ >> 6));
+        str_ += (char)(0x80 | (cp_ & 0x3F));
+      }
+    else if(cp_ < 0x10000)
+      {
+        str_ += (char)(0xE0 | (cp_ >> 12));
+        str_ += (char)(0x80 | ((cp_ >> 6) & 0x3F));
+        str_ += (char)(0x80 | (cp_ & 0x3F));
+      }
+    else
+      {
+        str_ += (char)(0xF0 | (cp_ >> 18));
+        str_ += (char)(0x80 | ((cp_ >> 12) & 0x3F));
+        str_ += (char)(0x80 | ((cp_ >> 6) & 0x3F));
+        str_ += (char)(0x80 | (cp_ & 0x3F));
+      }
+  }
+
+  static
+  u32
+  parse_hex4(const std::string &line_,
+             size_t            &i_)
+  {
+    u32 rv;
+
+    if((i_ + 4) > line_.size())
+      throw std::runtime_error("truncated \\u escape");
+
+    rv = 0;
+    for(size_t end = i_ + 4; i_ < end; i_++)
+      {
+        char c = line_[i_];
+
+        rv <<= 4;
+        if((c >= '0') && (c <= '9'))
+          rv |= (c - '0');
+        else if((c >= 'a') && (c <= 'f'))
+          rv |= (c - 'a' + 10);
+        else if((c >= 'A') && (c <= 'F'))
+          rv |= (c - 'A' + 10);
+        else
+          throw std::runtime_error("invalid \\u escape");
+      }
+
+    return rv;
+  }
+
+  static
+  std::string
+  parse_json_string(const std::string &line_,
+                    size_t            &i_)
+  {
+    std::string rv;
+
+    if((i_ >= line_.size()) || (line_[i_] != '"'))
+      throw std::runtime_error("expected string");
+
+    for(i_++; i_ < line_.size(); i_++)
+      {
+        char c = line_[i_];
+
+        if(c == '"')
+          {
+            i_++;
+            return rv;
+          }
+        if(c != '\\')
+          {
+            rv += c;
+            continue;
+          }
+
+        if(++i_ >= line_.size())
+          break;
+
+        switch(line_[i_])
+          {
+          case '"':  rv += '"';  break;
+          case '\\': rv += '\\'; break;
+          case '/':  rv += '/';  break;
+          case 'b':  rv += '\b'; break;
+          case 'f':  rv += '\f'; break;
+          case 'n':  rv += '\n'; break;
+          case 'r':  rv += '\r'; break;
+          case 't':  rv += '\t'; break;
+          case 'u':
+            {
+              u32 cp;
+
+              i_++;
+              cp = l::parse_hex4(line_,i_);
+              // Surrogate pair
+              if((cp >= 0xD800) && (cp < 0xDC00) &&
+                 ((i_ + 1) < line_.size()) &&
+                 (line_[i_] == '\\') &&
+                 (line_[i_ + 1] == 'u'))
+                {
+                  u32 lo;
+
+                  i_ += 2;
+                  lo = l::parse_hex4(line_,i_);
+                  cp = (0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00));
+                }
+              l::append_utf8(rv,cp);
+              i_--;
+            }
+            break;
+          default:
+            throw std::runtime_error("invalid escape");
+          }
+      }
+
+    throw std::runtime_error("unterminated string");
+  }
+
+  /*
+    Manifest values are strings, numbers, booleans or null, so only
+    flat objects are accepted. Numbers and booleans are kept as their
+    text and null as if the key were absent.
+  */
+  static
+  Fields
+  parse_json(const std::string &line_)
+  {
+    size_t i;
+    Fields rv;
+
+    i = 0;
+    l::skip_ws(line_,i);
+    if((i >= line_.size()) || (line_[i] != '{'))
+      throw std::runtime_error("expected a JSON object");
+    i++;
+
+    l::skip_ws(line_,i);
+    if((i < line_.size()) && (line_[i] == '}'))
+      {
+        i++;
+      }
+    else
+      {
+        while(true)
+          {
+            std::string key;
+            std::string value;
+
+            l::skip_ws(line_,i);
+            key = l::parse_json_string(line_,i);
+            l::skip_ws(line_,i);
+            if((i >= line_.size()) || (line_[i] != ':'))
+              throw std::runtime_error("expected ':'");
+            i++;
+            l::skip_ws(line_,i);
+
+            if(i >= line_.size())
+              throw std::runtime_error("expected value");
+            if(line_[i] == '"')
+              {
+                rv[key] = l::parse_json_string(line_,i);
+              }
+            else if((line_[i] == '{') || (line_[i] == '['))
+              {
+                throw fmt::exception("'{}' must be a string or number",key);
+              }
+            else
+              {
+                size_t start = i;
+
+                while((i < line_.size()) &&
+                      (line_[i] != ',') &&
+                      (line_[i] != '}') &&
+                      !l::is_space(line_[i]))
+                  i++;
+
+                value = line_.substr(start,i - start);
+                if(value.empty())
+                  throw std::runtime_error("expected value");
+                if(value != "null")
+                  rv[key] = value;
+              }
+
+            l::skip_ws(line_,i);
+            if((i < line_.size()) && (line_[i] == ','))
+              {
+                i++;
+                continue;
+              }
+            if((i < line_.size()) && (line_[i] == '}'))
+              {
+                i++;
+                break;
+              }
+
+            throw std::runtime_error("expected ',' or '}'");
+          }
+      }
+
+    l::skip_ws(line_,i);
+    if(i != line_.size())
+      throw std::runtime_error("trailing data after object");
+
+    return rv;
+  }
+
+  // RFC 4180 fields. Quoted fields may not span lines.
+  static
+  std::vector<std::string>
+  parse_csv(const std::string &line_)
+  {
+    size_t i;
+    std::string field;
+    std::vector<std::string> rv;
+
+    i = 0;
+    while(true)
+      {
+        field.clear();
+        if((i < line_.size()) && (line_[i] == '"'))
+          {
+            for(i++; true; i++)
+              {
+                if(i >= line_.size())
+                  throw std::runtime_error("unterminated quoted field");
+                if(line_[i] != '"')
+                  {
+                    field += line_[i];
+                    continue;
+                  }
+                if(((i + 1) < line_.size()) && (line_[i + 1] == '"'))
+                  {
+                    field += '"';
+                    i++;
+                    continue;
+                  }
+                i++;
+                break;
+              }
+            if((i < line_.size()) && (line_[i] != ','))
+              throw std::runtime_error("expected ',' after quoted field");
+          }
+        else
+          {
+            while((i < line_.size()) && (line_[i] != ','))
+              field += line_[i++];
+          }
+
+        rv.emplace_back(field);
+        if(i >= line_.size())
+          break;
+        i++;
+      }
+
+    return rv;
+  }
+
+  static
+  int
+  to_int(const Fields      &fields_,
+         const std::string &key_,
+         const int          default_)
+  {
+    long rv;
+    char *end;
+    auto i = fields_.find(key_);
+
+    if((i == fields_.end()) || i->second.empty())
+      return default_;
+
+    rv = strtol(i->second.c_str(),&end,10);
+    if((*end != '\0') || (end == i->second.c_str()))
+      throw fmt::exception("'{}' is not an integer: '{}'",key_,i->second);
+
+    return rv;
+  }
+
+  static
+  std::string
+  to_string(const Fields      &fields_,
+            const std::string &key_,
+            const std::string &default_)
+  {
+    auto i = fields_.find(key_);
+
+    if((i == fields_.end()) || i->second.empty())
+      return default_;
+
+    return i->second;
+  }
+
+  static
+  std::filesystem::path
+  to_path(const Fields                &fields_,
+          const std::string           &key_,
+          const std::filesystem::path &dirpath_)
+  {
+    std::filesystem::path rv;
+
+    rv = l::to_string(fields_,key_,"");
+    if(rv.empty())
+      return rv;
+    if(file::is_stdio(rv))
+      throw fmt::exception("'{}' can't be stdin or stdout",key_);
+
+    return (dirpath_ / rv).lexically_normal();
+  }
+
+  static
+  manifest::Entry
+  to_entry(const Fields                &fields_,
+           const std::filesystem::path &dirpath_)
+  {
+    manifest::Entry rv;
+    static const std::set<std::string> keys =
+      {"input","output","codec","input_type","output_type","channels","freq"};
+
+    for(const auto &kv : fields_)
+      {
+        if(!keys.count(kv.first))
+          throw fmt::exception("unknown field '{}'",kv.first);
+      }
+
+    rv.input       = l::to_path(fields_,"input",dirpath_);
+    rv.output      = l::to_path(fields_,"output",dirpath_);
+    rv.codec       = l::to_string(fields_,"codec","");
+    rv.input_type  = l::to_string(fields_,"input_type","auto");
+    rv.output_type = l::to_string(fields_,"output_type","raw");
+    rv.channels    = l::to_int(fields_,"channels",1);
+    rv.freq        = l::to_int(fields_,"freq",22050);
+
+    if(rv.input.empty())
+      throw std::runtime_error("missing 'input'");
+    if((rv.codec != "adp4") && (rv.codec != "sdx2"))
+      throw fmt::exception("codec must be adp4 or sdx2, not '{}'",rv.codec);
+    if((rv.input_type != "auto") && (rv.input_type != "raw"))
+      throw fmt::exception("input_type must be auto or raw, not '{}'",
+                           rv.input_type);
+    if((rv.output_type != "raw") && (rv.output_type != "aifc"))
+      throw fmt::exception("output_type must be raw or aifc, not '{}'",
+                           rv.output_type);
+    if((rv.channels < 0) || (rv.channels > 2))
+      throw fmt::exception("unsupported channel count {}",rv.channels);
+    if((rv.freq != 22050) && (rv.freq != 44100))
+      throw fmt::exception("freq must be 22050 or 44100, not {}",rv.freq);
+
+    return rv;
+  }
+
+  static
+  std::string
+  detect_format(const std::filesystem::path &filepath_,
+                const std::string           &data_)
+  {
+    size_t i;
+    std::string ext;
+
+    ext = filepath_.extension().string();
+    std::transform(ext.begin(),ext.end(),ext.begin(),::tolower);
+    if((ext == ".jsonl") || (ext == ".ndjson") || (ext == ".json"))
+      return "jsonl";
+    if(ext == ".csv")
+      return "csv";
+
+    i = 0;
+    l::skip_ws(data_,i);
+
+    return (((i < data_.size()) && (data_[i] == '{')) ? "jsonl" : "csv");
+  }
+}
+
+std::vector<manifest::Entry>
+manifest::load(const std::filesystem::path &filepath_,
+               const std::string           &format_)
+{
+  size_t lineno;
+  size_t start;
+  std::string data;
+  std::string format;
+  std::filesystem::path dirpath;
+  std::vector<std::string> header;
+  std::vector<manifest::Entry> rv;
+  std::map<std::filesystem::path,size_t> outputs;
+
+  {
+    std::vector<u8> buf;
+
+    buf = file::load_u8(filepath_);
+    data.assign(buf.begin(),buf.end());
+  }
+
+  if(!file::is_stdio(filepath_))
+    dirpath = filepath_.parent_path();
+
+  format = format_;
+  if(format == "auto")
+    format = l::detect_format(filepath_,data);
+
+  lineno = 0;
+  start  = 0;
+  while(start < data.size())
+    {
+      size_t end;
+      std::string line;
+      l::Fields fields;
+
+      end = data.find('\n',start);
+      if(end == std::string::npos)
+        end = data.size();
+
+      line  = data.substr(start,end - start);
+      start = end + 1;
+      lineno++;
+
+      if(!line.empty() && (line.back() == '\r'))
+        line.pop_back();
+      if(std::all_of(line.begin(),line.end(),l::is_space))
+        continue;
+
+      try
+        {
+          if(format == "jsonl")
+            {
+              fields = l::parse_json(line);
+            }
+          else if(header.empty())
+            {
+              header = l::parse_csv(line);
+              for(auto &name : header)
+                name.erase(std::remove_if(name.begin(),name.end(),l::is_space),
+                           name.end());
+              continue;
+            }
+          else
+            {
+              std::vector<std::string> values;
+
+              values = l::parse_csv(line);
+              if(values.size() > header.size())
+                throw fmt::exception("{} fields but the header has {}",
+                                     values.size(),
+                                     header.size());
+              for(size_t i = 0; i < values.size(); i++)
+                fields[header[i]] = values[i];
+            }
+
+          rv.emplace_back(l::to_entry(fields,dirpath));
+          rv.back().line = lineno;
+
+          // Concurrent entries can't share an output.
+          if(!rv.back().output.empty() &&
+             !outputs.emplace(rv.back().output,lineno).second)
+            throw fmt::exception("output {} is also written by line {}",
+                                 rv.back().output,
+                                 outputs[rv.back().output]);
+        }
+      catch(const std::runtime_error &e_)
+        {
+          throw fmt::exception("{}:{}: {}",filepath_,lineno,e_.what());
+        }
+    }
+
+  return rv;
+}
@@ -0,0 +1,52 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace manifest
+{
+  /*
+    One conversion. Relative paths are resolved against the
+    manifest's directory. An empty output means the name to-adp4 or
+    to-sdx2 would have picked, next to the input.
+  */
+  struct Entry
+  {
+    size_t                line;
+    std::filesystem::path input;
+    std::filesystem::path output;
+    std::string           codec;
+    std::string           input_type;
+    std::string           output_type;
+    int                   channels;
+    int                   freq;
+  };
+
+  /*
+    Reads JSON Lines, one flat object per line, or CSV with a header
+    row. format is "jsonl", "csv" or "auto" which goes by the file
+    extension and then by the first character. Every entry is checked
+    before any is returned and errors name the offending line.
+  */
+  std::vector<Entry> load(const std::filesystem::path &filepath,
+                          const std::string           &format);
+}
@@ -1,6 +1,9 @@
 #pragma once
 
+#include "types_ints.h"
+
 #include <filesystem>
+#include <string>
 #include <vector>
 
 namespace Opts
@@ -8,44 +11,116 @@ namespace Opts
   struct ToADP4
   {
     std::vector<std::filesystem::path> filepaths;
+    bool recursive;
+    std::vector<std::string> include;
+    std::vector<std::string> exclude;
+    unsigned jobs;
+    unsigned ffmpeg_group;
     std::string input_type;
+    int input_channels = 0;
+    int input_freq = 0;
+    std::string resample_quality = "medium";
     std::string output_type;
-    std::string encoder;
+    std::filesystem::path output_file;
+    std::string encoder = "default";
+    int output_channels;
     int output_freq;
+    unsigned trellis_beam = 8;
+    unsigned trellis_lookahead = 32;
+    unsigned threads = 1;
     std::filesystem::path output_path;
+    std::filesystem::path cache_dir;
+    u64 cache_size;
   };
 
   struct ToSDX2
   {
     std::vector<std::filesystem::path> filepaths;
+    bool recursive;
+    std::vector<std::string> include;
+    std::vector<std::string> exclude;
+    unsigned jobs;
+    unsigned ffmpeg_group;
     std::string input_type;
+    int input_channels = 0;
+    int input_freq = 0;
+    std::string resample_quality = "medium";
     std::string output_type;    
-    std::string encoder;
+    std::filesystem::path output_file;
+    std::string encoder = "default";
     int output_channels;
     int output_freq;
+    unsigned threads = 1;
+    int resync_max_error = 8;
     std::filesystem::path output_path;    
+    std::filesystem::path cache_dir;
+    u64 cache_size;
   };
 
   struct FromADP4
   {
     std::vector<std::filesystem::path> filepaths;
+    bool recursive;
+    std::vector<std::string> include;
+    std::vector<std::string> exclude;
+    unsigned jobs;
     std::string output_type;
+    std::filesystem::path output_file;
+    int channels;
     int freq;
   };
 
   struct FromSDX2
   {
     std::vector<std::filesystem::path> filepaths;
+    bool recursive;
+    std::vector<std::string> include;
+    std::vector<std::string> exclude;
+    unsigned jobs;
+    std::string output_type;
+    std::filesystem::path output_file;
+    int channels;
+    int freq;
+  };
+
+  struct Transcode
+  {
+    std::vector<std::filesystem::path> filepaths;
+    bool recursive;
+    std::vector<std::string> include;
+    std::vector<std::string> exclude;
+    unsigned jobs;
+    std::string to;
     std::string output_type;
+    std::filesystem::path output_file;
     int channels;
+    int output_channels;
     int freq;
   };
 
+  struct Manifest
+  {
+    std::filesystem::path filepath;
+    std::string format;
+    unsigned jobs;
+  };
+
+  struct Bench
+  {
+    std::vector<std::filesystem::path> filepaths;
+    unsigned jobs;
+    unsigned ffmpeg_group;
+    std::string target;
+  };
+
   struct Options
   {
     ToADP4   to_adp4;
     ToSDX2   to_sdx2;
     FromADP4 from_adp4;
     FromSDX2 from_sdx2;    
+    Transcode transcode;
+    Manifest manifest;
+    Bench    bench;
   };
 }
@@ -0,0 +1,144 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "pcm.hpp"
+
+#include "fmt.hpp"
+
+// Input samples converted per feed call by convert().
+#define CONVERT_BLOCK_SIZE (1024 * 64)
+
+u8
+pcm::resample_quality(const std::string &name_)
+{
+  if(name_ == "fast")
+    return RESAMPLE_QUALITY_FAST;
+  if(name_ == "high")
+    return RESAMPLE_QUALITY_HIGH;
+
+  return RESAMPLE_QUALITY_MEDIUM;
+}
+
+pcm::Converter::Converter()
+  : _active(false)
+{
+}
+
+pcm::Converter::~Converter()
+{
+  if(_active)
+    resampler_free(&_resampler);
+}
+
+void
+pcm::Converter::init(const int in_channels_,
+                     const int in_freq_,
+                     const int out_channels_,
+                     const int out_freq_,
+                     const u8  quality_)
+{
+  s32 rv;
+  int in_channels;
+  int in_freq;
+
+  if(_active)
+    resampler_free(&_resampler);
+  _active = false;
+
+  in_channels = ((in_channels_ > 0) ? in_channels_ : out_channels_);
+  in_freq     = ((in_freq_ > 0) ? in_freq_ : out_freq_);
+  if((in_channels == out_channels_) && (in_freq == out_freq_))
+    return;
+
+  rv = resampler_init(&_resampler,
+                      in_channels,
+                      out_channels_,
+                      in_freq,
+                      out_freq_,
+                      quality_);
+  if(rv == RESAMPLE_ERR_UNSUPPORTED_CHANNELS)
+    throw fmt::exception("unsupported channel conversion {} -> {}",
+                         in_channels,
+                         out_channels_);
+  if(rv != RESAMPLE_SUCCESS)
+    throw fmt::exception("unable to resample {}hz -> {}hz",
+                         in_freq,
+                         out_freq_);
+
+  _active = true;
+}
+
+const s16*
+pcm::Converter::feed(const s16 *ibuf_,
+                     const u64  count_,
+                     u64       &out_count_)
+{
+  u32 frames;
+
+  frames = (count_ / _resampler.in_channels);
+  _obuf.resize((u64)resampler_max_output(&_resampler,frames) * _resampler.out_channels);
+
+  frames     = resampler_feed(&_resampler,ibuf_,frames,_obuf.data());
+  out_count_ = ((u64)frames * _resampler.out_channels);
+
+  return _obuf.data();
+}
+
+const s16*
+pcm::Converter::flush(u64 &out_count_)
+{
+  u32 frames;
+
+  _obuf.resize((u64)resampler_max_output(&_resampler,0) * _resampler.out_channels);
+
+  frames     = resampler_flush(&_resampler,_obuf.data());
+  out_count_ = ((u64)frames * _resampler.out_channels);
+
+  return _obuf.data();
+}
+
+std::vector<s16>
+pcm::convert(std::vector<s16> &&input_,
+             const int          in_channels_,
+             const int          in_freq_,
+             const int          out_channels_,
+             const int          out_freq_,
+             const u8           quality_)
+{
+  u64 n;
+  const s16 *p;
+  Converter converter;
+  std::vector<s16> output;
+
+  converter.init(in_channels_,in_freq_,out_channels_,out_freq_,quality_);
+  if(!converter.active())
+    return std::move(input_);
+
+  for(u64 i = 0; i < input_.size(); i += CONVERT_BLOCK_SIZE)
+    {
+      p = converter.feed(&input_[i],
+                         std::min<u64>(CONVERT_BLOCK_SIZE,input_.size() - i),
+                         n);
+      output.insert(output.end(),p,p + n);
+    }
+
+  p = converter.flush(n);
+  output.insert(output.end(),p,p + n);
+
+  return output;
+}
@@ -0,0 +1,77 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "resample.h"
+
+#include "types_ints.h"
+
+#include <string>
+#include <vector>
+
+/*
+  Channel mixing and resampling of raw s16 input so it doesn't need
+  ffmpeg. A channel count or frequency of 0 means the same as the
+  output.
+*/
+namespace pcm
+{
+  u8 resample_quality(const std::string &name);
+
+  std::vector<s16>
+  convert(std::vector<s16> &&input,
+          const int          in_channels,
+          const int          in_freq,
+          const int          out_channels,
+          const int          out_freq,
+          const u8           quality);
+
+  /*
+    Streaming wrapper around resampler_t. Input is whole frames;
+    a trailing partial frame is dropped.
+  */
+  class Converter
+  {
+  public:
+    Converter();
+    ~Converter();
+
+    Converter(const Converter&) = delete;
+    Converter& operator=(const Converter&) = delete;
+
+  public:
+    void init(const int in_channels,
+              const int in_freq,
+              const int out_channels,
+              const int out_freq,
+              const u8  quality);
+
+    bool active(void) const { return _active; }
+
+    const s16 *feed(const s16 *ibuf,
+                    const u64  count,
+                    u64       &out_count);
+    const s16 *flush(u64 &out_count);
+
+  private:
+    bool             _active;
+    resampler_t      _resampler;
+    std::vector<s16> _obuf;
+  };
+}
@@ -0,0 +1,512 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "resample.h"
+
+#include "clamp.h"
+
+#include "types_ints.h"
+
+#include <math.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined __x86_64__ || defined __i386__
+#define RESAMPLE_X86
+#include <immintrin.h>
+#elif defined __aarch64__
+#define RESAMPLE_NEON
+#include <arm_neon.h>
+#endif
+
+// Input frames converted to float per pass.
+#define RESAMPLE_BLOCK 4096
+#define RESAMPLE_MAX_TAPS 1024
+// Beyond this many phases the filter bank is interpolated.
+#define RESAMPLE_MAX_PHASES 1024
+
+typedef float (*resample_dot_fn)(const float*,const float*,const u32);
+
+/*
+  Zero crossings per side of the sinc, Kaiser beta and cutoff relative
+  to the lower of the two Nyquist frequencies.
+*/
+static const struct
+{
+  u32    zero_crossings;
+  double beta;
+  double rolloff;
+} g_QUALITY[] =
+  {
+    {  4, 5.0, 0.85 },
+    {  8, 7.0, 0.91 },
+    { 16, 9.0, 0.95 }
+  };
+
+/*
+  Taps are always a multiple of 16 so the dot products need no tail
+  handling.
+*/
+static
+float
+_resample_dot_scalar(const float *a_,
+                     const float *b_,
+                     const u32    n_)
+{
+  float acc[4] = {0,0,0,0};
+
+  for(u32 i = 0; i < n_; i += 4)
+    {
+      acc[0] += (a_[i+0] * b_[i+0]);
+      acc[1] += (a_[i+1] * b_[i+1]);
+      acc[2] += (a_[i+2] * b_[i+2]);
+      acc[3] += (a_[i+3] * b_[i+3]);
+    }
+
+  return ((acc[0] + acc[1]) + (acc[2] + acc[3]));
+}
+
+#if defined RESAMPLE_X86
+
+__attribute__((target("avx2,fma")))
+static
+float
+_resample_dot_avx2(const float *a_,
+                   const float *b_,
+                   const u32    n_)
+{
+  __m128 s;
+  __m256 acc0;
+  __m256 acc1;
+
+  acc0 = _mm256_setzero_ps();
+  acc1 = _mm256_setzero_ps();
+  for(u32 i = 0; i < n_; i += 16)
+    {
+      acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(&a_[i+0]),_mm256_loadu_ps(&b_[i+0]),acc0);
+      acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(&a_[i+8]),_mm256_loadu_ps(&b_[i+8]),acc1);
+    }
+
+  acc0 = _mm256_add_ps(acc0,acc1);
+  s = _mm_add_ps(_mm256_castps256_ps128(acc0),_mm256_extractf128_ps(acc0,1));
+  s = _mm_add_ps(s,_mm_movehl_ps(s,s));
+  s = _mm_add_ss(s,_mm_shuffle_ps(s,s,1));
+
+  return _mm_cvtss_f32(s);
+}
+
+#elif defined RESAMPLE_NEON
+
+static
+float
+_resample_dot_neon(const float *a_,
+                   const float *b_,
+                   const u32    n_)
+{
+  float32x4_t acc[4];
+
+  acc[0] = vdupq_n_f32(0);
+  acc[1] = vdupq_n_f32(0);
+  acc[2] = vdupq_n_f32(0);
+  acc[3] = vdupq_n_f32(0);
+  for(u32 i = 0; i < n_; i += 16)
+    {
+      acc[0] = vfmaq_f32(acc[0],vld1q_f32(&a_[i+ 0]),vld1q_f32(&b_[i+ 0]));
+      acc[1] = vfmaq_f32(acc[1],vld1q_f32(&a_[i+ 4]),vld1q_f32(&b_[i+ 4]));
+      acc[2] = vfmaq_f32(acc[2],vld1q_f32(&a_[i+ 8]),vld1q_f32(&b_[i+ 8]));
+      acc[3] = vfmaq_f32(acc[3],vld1q_f32(&a_[i+12]),vld1q_f32(&b_[i+12]));
+    }
+
+  return vaddvq_f32(vaddq_f32(vaddq_f32(acc[0],acc[1]),
+                              vaddq_f32(acc[2],acc[3])));
+}
+
+#endif
+
+static
+resample_dot_fn
+_resample_dot(void)
+{
+#if defined RESAMPLE_X86
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return _resample_dot_avx2;
+#elif defined RESAMPLE_NEON
+  return _resample_dot_neon;
+#endif
+
+  return _resample_dot_scalar;
+}
+
+static
+u32
+_gcd(u32 a_,
+     u32 b_)
+{
+  while(b_ != 0)
+    {
+      u32 t = (a_ % b_);
+      a_ = b_;
+      b_ = t;
+    }
+
+  return a_;
+}
+
+// Zeroth order modified Bessel function of the first kind.
+static
+double
+_bessel_i0(const double x_)
+{
+  double sum;
+  double term;
+
+  sum  = 1;
+  term = 1;
+  for(int k = 1; k < 64; k++)
+    {
+      term *= ((x_ / (2 * k)) * (x_ / (2 * k)));
+      sum  += term;
+      if(term < (sum * 1e-12))
+        break;
+    }
+
+  return sum;
+}
+
+/*
+  Phase p holds the taps for an output that falls p/phases of the way
+  between two input samples. Each phase is normalized to unity DC
+  gain. An interpolated bank has an extra last phase, a whole sample
+  along, so every position has a phase on either side.
+*/
+static
+void
+_build_coeffs(resampler_t *r_,
+              const u8     quality_)
+{
+  u32 rows;
+  double fc;
+  double half;
+  double delay;
+
+  fc    = (g_QUALITY[quality_].rolloff * 0.5);
+  if(r_->up < r_->down)
+    fc *= ((double)r_->up / r_->down);
+  half  = (r_->taps / 2);
+  delay = (half - 1);
+
+  rows = (r_->phases + (r_->phases < r_->up));
+  for(u32 p = 0; p < rows; p++)
+    {
+      double sum;
+      float *h = &r_->coeffs[p * r_->taps];
+
+      sum = 0;
+      for(u32 k = 0; k < r_->taps; k++)
+        {
+          double x;
+          double w;
+          double s;
+
+          x = (k - delay - ((double)p / r_->phases));
+          w = (1 - ((x / half) * (x / half)));
+          w = ((w > 0) ? (_bessel_i0(g_QUALITY[quality_].beta * sqrt(w)) /
+                          _bessel_i0(g_QUALITY[quality_].beta)) : 0);
+          s = ((x == 0) ? 1 : (sin(M_PI * 2 * fc * x) / (M_PI * 2 * fc * x)));
+
+          h[k] = (2 * fc * s * w);
+          sum += h[k];
+        }
+
+      for(u32 k = 0; k < r_->taps; k++)
+        h[k] /= sum;
+    }
+}
+
+static
+inline
+s16
+_to_s16(const float v_)
+{
+  if(v_ >= S16_MAX)
+    return S16_MAX;
+  if(v_ <= S16_MIN)
+    return S16_MIN;
+
+  return (s16)((v_ < 0) ? (v_ - 0.5f) : (v_ + 0.5f));
+}
+
+static
+void
+_mix_s16(const resampler_t *r_,
+         const s16         *ibuf_,
+         const u32          frames_,
+         s16               *obuf_)
+{
+  if(r_->in_channels == r_->out_channels)
+    {
+      memmove(obuf_,ibuf_,(u64)frames_ * r_->in_channels * sizeof(s16));
+      return;
+    }
+
+  if(r_->in_channels == 2)
+    {
+      for(u32 i = 0; i < frames_; i++)
+        obuf_[i] = ((ibuf_[(i * 2) + 0] + ibuf_[(i * 2) + 1]) >> 1);
+      return;
+    }
+
+  for(u32 i = frames_; i-- > 0;)
+    {
+      obuf_[(i * 2) + 0] = ibuf_[i];
+      obuf_[(i * 2) + 1] = ibuf_[i];
+    }
+}
+
+static
+void
+_append_float(resampler_t *r_,
+              const s16   *ibuf_,
+              const u32    frames_)
+{
+  float *dst[RESAMPLE_MAX_CHANNELS];
+
+  for(u8 c = 0; c < r_->out_channels; c++)
+    dst[c] = &r_->buf[c][r_->buf_len];
+
+  if(ibuf_ == NULL)
+    {
+      for(u8 c = 0; c < r_->out_channels; c++)
+        memset(dst[c],0,frames_ * sizeof(float));
+    }
+  else if(r_->in_channels == r_->out_channels)
+    {
+      for(u32 i = 0; i < frames_; i++)
+        for(u8 c = 0; c < r_->out_channels; c++)
+          dst[c][i] = ibuf_[(i * r_->in_channels) + c];
+    }
+  else if(r_->in_channels == 2)
+    {
+      for(u32 i = 0; i < frames_; i++)
+        dst[0][i] = ((ibuf_[(i * 2) + 0] + ibuf_[(i * 2) + 1]) * 0.5f);
+    }
+  else
+    {
+      for(u32 i = 0; i < frames_; i++)
+        dst[0][i] = dst[1][i] = ibuf_[i];
+    }
+
+  r_->buf_len += frames_;
+}
+
+/*
+  Produces every output whose filter window is fully buffered, but no
+  more than limit_, then drops input no later window needs.
+*/
+static
+u32
+_drain(resampler_t *r_,
+       s16         *obuf_,
+       const u64    limit_)
+{
+  u32 n;
+  u64 i;
+
+  n = 0;
+  while(((r_->pos / r_->up) + r_->taps) <= r_->buf_len)
+    {
+      const float *h;
+
+      if(r_->out_frames >= limit_)
+        break;
+
+      i = (r_->pos / r_->up);
+      if(r_->phases == r_->up)
+        {
+          h = &r_->coeffs[(r_->pos % r_->up) * r_->taps];
+          for(u8 c = 0; c < r_->out_channels; c++)
+            obuf_[(n * r_->out_channels) + c] = _to_s16(r_->dot(&r_->buf[c][i],h,r_->taps));
+        }
+      else
+        {
+          u64 q;
+          float f;
+
+          // Output is linear in the taps so blending the two dot
+          // products equals filtering with the blended phase.
+          q = ((r_->pos % r_->up) * r_->phases);
+          f = ((float)(q % r_->up) / r_->up);
+          h = &r_->coeffs[(q / r_->up) * r_->taps];
+          for(u8 c = 0; c < r_->out_channels; c++)
+            obuf_[(n * r_->out_channels) + c] =
+              _to_s16(((1 - f) * r_->dot(&r_->buf[c][i],h,r_->taps)) +
+                      (f * r_->dot(&r_->buf[c][i],h + r_->taps,r_->taps)));
+        }
+
+      r_->pos += r_->down;
+      r_->out_frames++;
+      n++;
+    }
+
+  i = (r_->pos / r_->up);
+  if(i > r_->buf_len)
+    i = r_->buf_len;
+  for(u8 c = 0; c < r_->out_channels; c++)
+    memmove(r_->buf[c],&r_->buf[c][i],(r_->buf_len - i) * sizeof(float));
+  r_->buf_len -= i;
+  r_->pos     -= (i * r_->up);
+
+  return n;
+}
+
+s32
+resampler_init(resampler_t *r_,
+               const u8     in_channels_,
+               const u8     out_channels_,
+               const u32    in_freq_,
+               const u32    out_freq_,
+               const u8     quality_)
+{
+  u32 g;
+  u32 rows;
+  u32 ratio;
+  u32 capacity;
+
+  memset(r_,0,sizeof(*r_));
+
+  if((in_channels_ < 1) || (in_channels_ > RESAMPLE_MAX_CHANNELS) ||
+     (out_channels_ < 1) || (out_channels_ > RESAMPLE_MAX_CHANNELS))
+    return RESAMPLE_ERR_UNSUPPORTED_CHANNELS;
+  if((in_freq_ == 0) || (out_freq_ == 0) || (quality_ > RESAMPLE_QUALITY_HIGH))
+    return RESAMPLE_ERR_INVALID_FREQ;
+
+  g = _gcd(in_freq_,out_freq_);
+  r_->in_channels  = in_channels_;
+  r_->out_channels = out_channels_;
+  r_->up           = (out_freq_ / g);
+  r_->down         = (in_freq_ / g);
+  r_->dot          = _resample_dot();
+
+  // Same rate is only a channel mix.
+  if(r_->up == r_->down)
+    return RESAMPLE_SUCCESS;
+
+  // Widen the filter when downsampling to keep the transition band.
+  ratio    = ((r_->down + r_->up - 1) / r_->up);
+  r_->taps = (2 * g_QUALITY[quality_].zero_crossings * ratio);
+  r_->taps = (((r_->taps + 15) / 16) * 16);
+  if(r_->taps > RESAMPLE_MAX_TAPS)
+    r_->taps = RESAMPLE_MAX_TAPS;
+
+  // Rates without a large common divisor, 44101hz to 22050hz say,
+  // would otherwise need tens of thousands of phases.
+  r_->phases = r_->up;
+  rows       = r_->up;
+  if(r_->up > RESAMPLE_MAX_PHASES)
+    {
+      r_->phases = RESAMPLE_MAX_PHASES;
+      rows       = (RESAMPLE_MAX_PHASES + 1);
+    }
+
+  capacity   = ((r_->taps * 2) + RESAMPLE_BLOCK);
+  r_->coeffs = malloc((u64)rows * r_->taps * sizeof(float));
+  for(u8 c = 0; c < out_channels_; c++)
+    r_->buf[c] = malloc(capacity * sizeof(float));
+  if((r_->coeffs == NULL) || (r_->buf[0] == NULL) ||
+     ((out_channels_ == 2) && (r_->buf[1] == NULL)))
+    {
+      resampler_free(r_);
+      return RESAMPLE_ERR_NO_MEMORY;
+    }
+
+  _build_coeffs(r_,quality_);
+
+  // History before the first sample is silence.
+  _append_float(r_,NULL,(r_->taps / 2) - 1);
+
+  return RESAMPLE_SUCCESS;
+}
+
+void
+resampler_free(resampler_t *r_)
+{
+  free(r_->coeffs);
+  free(r_->buf[0]);
+  free(r_->buf[1]);
+  r_->coeffs = NULL;
+  r_->buf[0] = NULL;
+  r_->buf[1] = NULL;
+}
+
+u32
+resampler_max_output(const resampler_t *r_,
+                     const u32          in_frames_)
+{
+  // Includes output held back waiting on the filter's lookahead.
+  return (((((u64)in_frames_ + r_->taps) * r_->up) + r_->down - 1) / r_->down) + 1;
+}
+
+u32
+resampler_feed(resampler_t *r_,
+               const s16   *ibuf_,
+               const u32    in_frames_,
+               s16         *obuf_)
+{
+  u32 n;
+
+  if(r_->taps == 0)
+    {
+      _mix_s16(r_,ibuf_,in_frames_,obuf_);
+      return in_frames_;
+    }
+
+  n = 0;
+  for(u32 i = 0; i < in_frames_; i += RESAMPLE_BLOCK)
+    {
+      u32 frames;
+
+      frames = (in_frames_ - i);
+      if(frames > RESAMPLE_BLOCK)
+        frames = RESAMPLE_BLOCK;
+
+      _append_float(r_,&ibuf_[(u64)i * r_->in_channels],frames);
+      r_->in_frames += frames;
+
+      n += _drain(r_,&obuf_[(u64)n * r_->out_channels],(u64)-1);
+    }
+
+  return n;
+}
+
+u32
+resampler_flush(resampler_t *r_,
+                s16         *obuf_)
+{
+  u64 owed;
+
+  if(r_->taps == 0)
+    return 0;
+
+  // Output positions before the end of the input.
+  owed = ((r_->in_frames * r_->up) + r_->down - 1) / r_->down;
+
+  _append_float(r_,NULL,r_->taps);
+
+  return _drain(r_,obuf_,owed);
+}
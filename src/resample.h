@@ -0,0 +1,95 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "types_ints.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RESAMPLE_SUCCESS                  0
+#define RESAMPLE_ERR_UNSUPPORTED_CHANNELS 1
+#define RESAMPLE_ERR_INVALID_FREQ         2
+#define RESAMPLE_ERR_NO_MEMORY            3
+
+#define RESAMPLE_QUALITY_FAST   0
+#define RESAMPLE_QUALITY_MEDIUM 1
+#define RESAMPLE_QUALITY_HIGH   2
+
+#define RESAMPLE_MAX_CHANNELS 2
+
+/*
+  Streaming channel mixer and polyphase resampler for interleaved
+  s16. Stereo to mono averages the channels and mono to stereo
+  duplicates. The resampler is a Kaiser windowed sinc filter bank
+  with one phase per output position between input samples, so the
+  rate ratio is exact. Ratios that would need more phases than the
+  table holds interpolate between neighbouring phases instead, which
+  keeps the ratio exact and the table small. Input can be fed in
+  pieces of any size and output is identical to feeding it all at
+  once.
+*/
+typedef struct resampler_t resampler_t;
+struct resampler_t
+{
+  u8     in_channels;
+  u8     out_channels;
+  u32    up;
+  u32    down;
+  u32    phases;
+  u32    taps;
+  float *coeffs;
+  float *buf[RESAMPLE_MAX_CHANNELS];
+  u32    buf_len;
+  u64    pos;
+  u64    in_frames;
+  u64    out_frames;
+  float (*dot)(const float*,const float*,const u32);
+};
+
+s32 resampler_init(resampler_t *resampler,
+                   const u8     in_channels,
+                   const u8     out_channels,
+                   const u32    in_freq,
+                   const u32    out_freq,
+                   const u8     quality);
+
+void resampler_free(resampler_t *resampler);
+
+/* Upper bound of output frames from feeding in_frames. */
+u32 resampler_max_output(const resampler_t *resampler,
+                         const u32          in_frames);
+
+/* Returns the number of output frames written to obuf. */
+u32 resampler_feed(resampler_t *resampler,
+                   const s16   *ibuf,
+                   const u32    in_frames,
+                   s16         *obuf);
+
+/*
+  Emits the output still owed for the input fed so far. At most
+  resampler_max_output(resampler,0) frames.
+*/
+u32 resampler_flush(resampler_t *resampler,
+                    s16         *obuf);
+
+#ifdef __cplusplus
+}
+#endif
@@ -22,81 +22,525 @@
 
 #include "types_ints.h"
 
-#define LOOKUP_TABLE_SIZE 256
+#include <stddef.h>
+
+#if defined __x86_64__ || defined __i386__
+#define SDX2_DECODE_X86
+#include <immintrin.h>
+#elif defined __aarch64__
+#define SDX2_DECODE_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+  The SIMD decoders return how many input bytes they consumed, always
+  a whole number of blocks, and leave the per channel predictor in
+  state_ for the scalar decoder to pick up the tail.
+*/
+typedef u32 (*sdx2_decode_simd_fn)(const u8*,const u32,const u8,s16*,s32*);
+
+static
+inline
+s16
+_sdx2_square(const s8 x_)
+{
+  s32 x = x_;
+
+  return (s16)(x * ((x < 0) ? -x : x) * 2);
+}
 
 static
 void
-_build_lookup_table(s16 lookup_table_[LOOKUP_TABLE_SIZE])
+_sdx2_decode_scalar(const u8  *ibuf_,
+                    const u32  ibuf_len_,
+                    const u8   num_channels_,
+                    s16       *obuf_,
+                    s32       *state_,
+                    u8         c_)
 {
-  for(int i = -128; i < 128; i++)
+  u8 c;
+
+  c = c_;
+  for(u32 i = 0; i < ibuf_len_; i++)
     {
-      s16 square = (i * i * 2);
+      s8 x;
 
-      lookup_table_[i+128] = ((i < 0) ? -square : square);
+      x = ibuf_[i];
+      if(!(x & 1))
+        state_[c] = 0;
+      state_[c] += _sdx2_square(x);
+      state_[c] = clamp_s32_to_s16(state_[c]);
+      obuf_[i] = state_[c];
+
+      if(++c == num_channels_)
+        c = 0;
     }
 }
 
+/*
+  Decoding is a segmented prefix sum: every exact byte starts a new
+  segment and every delta byte adds to the running value of its
+  channel. The SIMD decoders compute the sums of a block in 32bit
+  lanes without clamping. If any lane leaves the s16 range the block
+  is redone with the scalar decoder so output is always bit exact.
+  Stereo is interleaved so a channel's previous sample is two lanes
+  back and the scan only needs the 2 lane step.
+*/
+
+#if defined SDX2_DECODE_X86
+
+__attribute__((target("sse2")))
 static
 inline
-s32
-_sdx2_decode_mono(const u8  *ibuf_,
+__m128i
+_sse2_seg_scan(__m128i       v_,
+               __m128i      *f_,
+               const __m128i carry_,
+               const int     stereo_)
+{
+  __m128i t;
+  __m128i tf;
+
+  if(!stereo_)
+    {
+      t  = _mm_slli_si128(v_,4);
+      tf = _mm_slli_si128(*f_,4);
+      v_ = _mm_add_epi32(v_,_mm_andnot_si128(*f_,t));
+      *f_ = _mm_or_si128(*f_,tf);
+    }
+
+  t  = _mm_slli_si128(v_,8);
+  tf = _mm_slli_si128(*f_,8);
+  v_ = _mm_add_epi32(v_,_mm_andnot_si128(*f_,t));
+  *f_ = _mm_or_si128(*f_,tf);
+
+  return _mm_add_epi32(v_,_mm_andnot_si128(*f_,carry_));
+}
+
+__attribute__((target("sse2")))
+static
+inline
+u32
+_sdx2_decode_sse2_channels(const u8  *ibuf_,
+                           const u32  ibuf_len_,
+                           s16       *obuf_,
+                           s32       *state_,
+                           const int  stereo_)
+{
+  u32 i;
+  const __m128i zero    = _mm_setzero_si128();
+  const __m128i one     = _mm_set1_epi16(1);
+  const __m128i s16_max = _mm_set1_epi32(S16_MAX);
+  const __m128i s16_min = _mm_set1_epi32(S16_MIN);
+
+  for(i = 0; (i + 16) <= ibuf_len_; i += 16)
+    {
+      __m128i x8;
+      __m128i oor;
+      __m128i carry;
+      __m128i x16[2];
+      __m128i v16[2];
+      __m128i f16[2];
+      __m128i v[4];
+      __m128i f[4];
+
+      x8 = _mm_loadu_si128((const __m128i*)&ibuf_[i]);
+      x16[0] = _mm_srai_epi16(_mm_unpacklo_epi8(x8,x8),8);
+      x16[1] = _mm_srai_epi16(_mm_unpackhi_epi8(x8,x8),8);
+      for(int k = 0; k < 2; k++)
+        {
+          __m128i abs;
+
+          abs    = _mm_max_epi16(x16[k],_mm_sub_epi16(zero,x16[k]));
+          v16[k] = _mm_slli_epi16(_mm_mullo_epi16(x16[k],abs),1);
+          f16[k] = _mm_cmpeq_epi16(_mm_and_si128(x16[k],one),zero);
+
+          v[k*2+0] = _mm_srai_epi32(_mm_unpacklo_epi16(v16[k],v16[k]),16);
+          v[k*2+1] = _mm_srai_epi32(_mm_unpackhi_epi16(v16[k],v16[k]),16);
+          f[k*2+0] = _mm_srai_epi32(_mm_unpacklo_epi16(f16[k],f16[k]),16);
+          f[k*2+1] = _mm_srai_epi32(_mm_unpackhi_epi16(f16[k],f16[k]),16);
+        }
+
+      if(stereo_)
+        carry = _mm_setr_epi32(state_[0],state_[1],state_[0],state_[1]);
+      else
+        carry = _mm_set1_epi32(state_[0]);
+
+      oor = zero;
+      for(int k = 0; k < 4; k++)
+        {
+          v[k] = _sse2_seg_scan(v[k],&f[k],carry,stereo_);
+          if(stereo_)
+            carry = _mm_shuffle_epi32(v[k],_MM_SHUFFLE(3,2,3,2));
+          else
+            carry = _mm_shuffle_epi32(v[k],_MM_SHUFFLE(3,3,3,3));
+
+          oor = _mm_or_si128(oor,_mm_cmpgt_epi32(v[k],s16_max));
+          oor = _mm_or_si128(oor,_mm_cmplt_epi32(v[k],s16_min));
+        }
+
+      if(_mm_movemask_epi8(oor))
+        {
+          _sdx2_decode_scalar(&ibuf_[i],16,(stereo_ ? 2 : 1),&obuf_[i],state_,0);
+          continue;
+        }
+
+      _mm_storeu_si128((__m128i*)&obuf_[i+0],_mm_packs_epi32(v[0],v[1]));
+      _mm_storeu_si128((__m128i*)&obuf_[i+8],_mm_packs_epi32(v[2],v[3]));
+
+      state_[0] = _mm_cvtsi128_si32(carry);
+      state_[1] = _mm_cvtsi128_si32(_mm_shuffle_epi32(carry,_MM_SHUFFLE(1,1,1,1)));
+    }
+
+  return i;
+}
+
+__attribute__((target("sse2")))
+static
+u32
+_sdx2_decode_sse2(const u8  *ibuf_,
                   const u32  ibuf_len_,
+                  const u8   num_channels_,
                   s16       *obuf_,
-                  const u32  obuf_len_)
+                  s32       *state_)
 {
-  s32 sample;
-  s16 lookup_table[256];
+  if(num_channels_ == SDX2_STEREO)
+    return _sdx2_decode_sse2_channels(ibuf_,ibuf_len_,obuf_,state_,1);
+  return _sdx2_decode_sse2_channels(ibuf_,ibuf_len_,obuf_,state_,0);
+}
 
-  _build_lookup_table(lookup_table);
+__attribute__((target("avx2")))
+static
+inline
+__m256i
+_avx2_seg_scan(__m256i       v_,
+               __m256i      *f_,
+               const __m256i carry_,
+               const int     stereo_)
+{
+  __m256i t;
+  __m256i tf;
+  __m256i idx;
+  const __m256i hi_mask = _mm256_setr_epi32(0,0,0,0,-1,-1,-1,-1);
 
-  for(u32 i = 0; i < ibuf_len_; i++)
+  // Scan within each 128bit half.
+  if(!stereo_)
     {
-      s8 x;
+      t  = _mm256_slli_si256(v_,4);
+      tf = _mm256_slli_si256(*f_,4);
+      v_ = _mm256_add_epi32(v_,_mm256_andnot_si256(*f_,t));
+      *f_ = _mm256_or_si256(*f_,tf);
+    }
 
-      x = ibuf_[i];
-      if(!(x & 1))
-        sample = 0;
-      sample += lookup_table[x + 128];
-      sample = clamp_s32_to_s16(sample);
-      *obuf_++ = sample;
+  t  = _mm256_slli_si256(v_,8);
+  tf = _mm256_slli_si256(*f_,8);
+  v_ = _mm256_add_epi32(v_,_mm256_andnot_si256(*f_,t));
+  *f_ = _mm256_or_si256(*f_,tf);
+
+  // Carry the end of the low half into the high half.
+  if(stereo_)
+    idx = _mm256_setr_epi32(0,0,0,0,2,3,2,3);
+  else
+    idx = _mm256_setr_epi32(0,0,0,0,3,3,3,3);
+
+  t  = _mm256_and_si256(_mm256_permutevar8x32_epi32(v_,idx),hi_mask);
+  tf = _mm256_and_si256(_mm256_permutevar8x32_epi32(*f_,idx),hi_mask);
+  v_ = _mm256_add_epi32(v_,_mm256_andnot_si256(*f_,t));
+  *f_ = _mm256_or_si256(*f_,tf);
+
+  return _mm256_add_epi32(v_,_mm256_andnot_si256(*f_,carry_));
+}
+
+__attribute__((target("avx2")))
+static
+inline
+u32
+_sdx2_decode_avx2_channels(const u8  *ibuf_,
+                           const u32  ibuf_len_,
+                           s16       *obuf_,
+                           s32       *state_,
+                           const int  stereo_)
+{
+  u32 i;
+  __m256i carry_idx;
+  const __m256i zero    = _mm256_setzero_si256();
+  const __m256i one     = _mm256_set1_epi16(1);
+  const __m256i s16_max = _mm256_set1_epi32(S16_MAX);
+  const __m256i s16_min = _mm256_set1_epi32(S16_MIN);
+
+  if(stereo_)
+    carry_idx = _mm256_setr_epi32(6,7,6,7,6,7,6,7);
+  else
+    carry_idx = _mm256_set1_epi32(7);
+
+  for(i = 0; (i + 32) <= ibuf_len_; i += 32)
+    {
+      __m256i x8;
+      __m256i oor;
+      __m256i carry;
+      __m256i x16[2];
+      __m256i v16[2];
+      __m256i f16[2];
+      __m256i v[4];
+      __m256i f[4];
+
+      x8 = _mm256_loadu_si256((const __m256i*)&ibuf_[i]);
+      x16[0] = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(x8));
+      x16[1] = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(x8,1));
+      for(int k = 0; k < 2; k++)
+        {
+          v16[k] = _mm256_mullo_epi16(x16[k],_mm256_abs_epi16(x16[k]));
+          v16[k] = _mm256_slli_epi16(v16[k],1);
+          f16[k] = _mm256_cmpeq_epi16(_mm256_and_si256(x16[k],one),zero);
+
+          v[k*2+0] = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(v16[k]));
+          v[k*2+1] = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(v16[k],1));
+          f[k*2+0] = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(f16[k]));
+          f[k*2+1] = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(f16[k],1));
+        }
+
+      if(stereo_)
+        carry = _mm256_setr_epi32(state_[0],state_[1],state_[0],state_[1],
+                                  state_[0],state_[1],state_[0],state_[1]);
+      else
+        carry = _mm256_set1_epi32(state_[0]);
+
+      oor = zero;
+      for(int k = 0; k < 4; k++)
+        {
+          v[k]  = _avx2_seg_scan(v[k],&f[k],carry,stereo_);
+          carry = _mm256_permutevar8x32_epi32(v[k],carry_idx);
+
+          oor = _mm256_or_si256(oor,_mm256_cmpgt_epi32(v[k],s16_max));
+          oor = _mm256_or_si256(oor,_mm256_cmpgt_epi32(s16_min,v[k]));
+        }
+
+      if(_mm256_movemask_epi8(oor))
+        {
+          _sdx2_decode_scalar(&ibuf_[i],32,(stereo_ ? 2 : 1),&obuf_[i],state_,0);
+          continue;
+        }
+
+      // packs works per 128bit half so the 64bit quarters need reordering.
+      _mm256_storeu_si256((__m256i*)&obuf_[i+0],
+                          _mm256_permute4x64_epi64(_mm256_packs_epi32(v[0],v[1]),
+                                                   _MM_SHUFFLE(3,1,2,0)));
+      _mm256_storeu_si256((__m256i*)&obuf_[i+16],
+                          _mm256_permute4x64_epi64(_mm256_packs_epi32(v[2],v[3]),
+                                                   _MM_SHUFFLE(3,1,2,0)));
+
+      state_[0] = _mm256_extract_epi32(carry,0);
+      state_[1] = _mm256_extract_epi32(carry,1);
     }
-  
-  return SDX2_SUCCESS;
+
+  return i;
 }
 
+__attribute__((target("avx2")))
+static
+u32
+_sdx2_decode_avx2(const u8  *ibuf_,
+                  const u32  ibuf_len_,
+                  const u8   num_channels_,
+                  s16       *obuf_,
+                  s32       *state_)
+{
+  if(num_channels_ == SDX2_STEREO)
+    return _sdx2_decode_avx2_channels(ibuf_,ibuf_len_,obuf_,state_,1);
+  return _sdx2_decode_avx2_channels(ibuf_,ibuf_len_,obuf_,state_,0);
+}
+
+#elif defined SDX2_DECODE_NEON
+
 static
 inline
-s32
-_sdx2_decode_stereo(const u8  *ibuf_,
-                    const u32  ibuf_len_,
-                    s16       *obuf_,
-                    const u32  obuf_len_)
+int32x4_t
+_neon_seg_scan(int32x4_t        v_,
+               int32x4_t       *f_,
+               const int32x4_t  carry_,
+               const int        stereo_)
 {
-  s32 l_sample;
-  s32 r_sample;  
-  s16 lookup_table[256];
+  int32x4_t t;
+  int32x4_t tf;
+  const int32x4_t zero = vdupq_n_s32(0);
 
-  _build_lookup_table(lookup_table);
+  if(!stereo_)
+    {
+      t  = vextq_s32(zero,v_,3);
+      tf = vextq_s32(zero,*f_,3);
+      v_ = vaddq_s32(v_,vbicq_s32(t,*f_));
+      *f_ = vorrq_s32(*f_,tf);
+    }
 
-  for(u32 i = 0; i < ibuf_len_;)
+  t  = vextq_s32(zero,v_,2);
+  tf = vextq_s32(zero,*f_,2);
+  v_ = vaddq_s32(v_,vbicq_s32(t,*f_));
+  *f_ = vorrq_s32(*f_,tf);
+
+  return vaddq_s32(v_,vbicq_s32(carry_,*f_));
+}
+
+static
+inline
+u32
+_sdx2_decode_neon_channels(const u8  *ibuf_,
+                           const u32  ibuf_len_,
+                           s16       *obuf_,
+                           s32       *state_,
+                           const int  stereo_)
+{
+  u32 i;
+  const int16x8_t zero    = vdupq_n_s16(0);
+  const int16x8_t one     = vdupq_n_s16(1);
+  const int32x4_t s16_max = vdupq_n_s32(S16_MAX);
+  const int32x4_t s16_min = vdupq_n_s32(S16_MIN);
+
+  for(i = 0; (i + 16) <= ibuf_len_; i += 16)
     {
-      s8 x;
+      int8x16_t  x8;
+      uint32x4_t oor;
+      int32x4_t  carry;
+      int16x8_t  x16[2];
+      int16x8_t  v16[2];
+      int16x8_t  f16[2];
+      int32x4_t  v[4];
+      int32x4_t  f[4];
 
-      x = ibuf_[i++];
-      if(!(x & 1))
-        l_sample = 0;
-      l_sample += lookup_table[x + 128];
-      l_sample = clamp_s32_to_s16(l_sample);
-      *obuf_++ = l_sample;
+      x8 = vld1q_s8((const s8*)&ibuf_[i]);
+      x16[0] = vmovl_s8(vget_low_s8(x8));
+      x16[1] = vmovl_s8(vget_high_s8(x8));
+      for(int k = 0; k < 2; k++)
+        {
+          v16[k] = vshlq_n_s16(vmulq_s16(x16[k],vabsq_s16(x16[k])),1);
+          f16[k] = vreinterpretq_s16_u16(vceqq_s16(vandq_s16(x16[k],one),zero));
 
-      x = ibuf_[i++];
-      if(!(x & 1))
-        r_sample = 0;
-      r_sample += lookup_table[x + 128];
-      r_sample = clamp_s32_to_s16(r_sample);
-      *obuf_++ = r_sample;      
+          v[k*2+0] = vmovl_s16(vget_low_s16(v16[k]));
+          v[k*2+1] = vmovl_s16(vget_high_s16(v16[k]));
+          f[k*2+0] = vmovl_s16(vget_low_s16(f16[k]));
+          f[k*2+1] = vmovl_s16(vget_high_s16(f16[k]));
+        }
+
+      if(stereo_)
+        carry = vcombine_s32(vld1_s32(state_),vld1_s32(state_));
+      else
+        carry = vdupq_n_s32(state_[0]);
+
+      oor = vdupq_n_u32(0);
+      for(int k = 0; k < 4; k++)
+        {
+          v[k] = _neon_seg_scan(v[k],&f[k],carry,stereo_);
+          if(stereo_)
+            carry = vcombine_s32(vget_high_s32(v[k]),vget_high_s32(v[k]));
+          else
+            carry = vdupq_laneq_s32(v[k],3);
+
+          oor = vorrq_u32(oor,vcgtq_s32(v[k],s16_max));
+          oor = vorrq_u32(oor,vcltq_s32(v[k],s16_min));
+        }
+
+      if(vmaxvq_u32(oor))
+        {
+          _sdx2_decode_scalar(&ibuf_[i],16,(stereo_ ? 2 : 1),&obuf_[i],state_,0);
+          continue;
+        }
+
+      vst1q_s16(&obuf_[i+0],vcombine_s16(vqmovn_s32(v[0]),vqmovn_s32(v[1])));
+      vst1q_s16(&obuf_[i+8],vcombine_s16(vqmovn_s32(v[2]),vqmovn_s32(v[3])));
+
+      state_[0] = vgetq_lane_s32(carry,0);
+      state_[1] = vgetq_lane_s32(carry,1);
     }
-  
+
+  return i;
+}
+
+static
+u32
+_sdx2_decode_neon(const u8  *ibuf_,
+                  const u32  ibuf_len_,
+                  const u8   num_channels_,
+                  s16       *obuf_,
+                  s32       *state_)
+{
+  if(num_channels_ == SDX2_STEREO)
+    return _sdx2_decode_neon_channels(ibuf_,ibuf_len_,obuf_,state_,1);
+  return _sdx2_decode_neon_channels(ibuf_,ibuf_len_,obuf_,state_,0);
+}
+
+#endif
+
+static
+sdx2_decode_simd_fn
+_sdx2_decode_simd(void)
+{
+#if defined SDX2_DECODE_X86
+  if(__builtin_cpu_supports("avx2"))
+    return _sdx2_decode_avx2;
+  if(__builtin_cpu_supports("sse2"))
+    return _sdx2_decode_sse2;
+#elif defined SDX2_DECODE_NEON
+  return _sdx2_decode_neon;
+#endif
+
+  return NULL;
+}
+
+s32
+sdx2_decoder_init(sdx2_decoder_t *decoder_,
+                  const u8        num_channels_)
+{
+  if((num_channels_ != SDX2_MONO) && (num_channels_ != SDX2_STEREO))
+    return SDX2_ERR_UNSUPPORTED_CHANNELS;
+
+  decoder_->num_channels = num_channels_;
+  decoder_->offset       = 0;
+  decoder_->sample[0]    = 0;
+  decoder_->sample[1]    = 0;
+
+  return SDX2_SUCCESS;
+}
+
+s32
+sdx2_decoder_feed(sdx2_decoder_t *decoder_,
+                  const u8       *ibuf_,
+                  const u32       ibuf_len_,
+                  s16            *obuf_,
+                  const u32       obuf_len_)
+{
+  u32 i;
+  u8  c;
+  sdx2_decode_simd_fn simd;
+
+  if(obuf_len_ < ibuf_len_)
+    return SDX2_ERR_INVALID_OBUF_LEN;
+
+  i = 0;
+  c = (decoder_->offset % decoder_->num_channels);
+
+  // The SIMD decoders expect to start on the first channel of a frame.
+  if((c != 0) && (ibuf_len_ > 0))
+    {
+      _sdx2_decode_scalar(ibuf_,1,decoder_->num_channels,obuf_,decoder_->sample,c);
+      i = 1;
+    }
+
+  simd = _sdx2_decode_simd();
+  if(simd != NULL)
+    i += simd(&ibuf_[i],
+              ibuf_len_ - i,
+              decoder_->num_channels,
+              &obuf_[i],
+              decoder_->sample);
+
+  _sdx2_decode_scalar(&ibuf_[i],
+                      ibuf_len_ - i,
+                      decoder_->num_channels,
+                      &obuf_[i],
+                      decoder_->sample,
+                      0);
+
+  decoder_->offset += ibuf_len_;
+
   return SDX2_SUCCESS;
 }
 
@@ -107,13 +551,12 @@ sdx2_decode(const u8  *ibuf_,
             s16       *obuf_,
             const u32  obuf_len_)
 {
-  switch(num_channels_)
-    {
-    case SDX2_MONO:
-      return _sdx2_decode_mono(ibuf_,ibuf_len_,obuf_,obuf_len_);      
-    case SDX2_STEREO:
-      return _sdx2_decode_stereo(ibuf_,ibuf_len_,obuf_,obuf_len_);
-    }
-  
-  return SDX2_SUCCESS;
+  s32 rv;
+  sdx2_decoder_t decoder;
+
+  rv = sdx2_decoder_init(&decoder,num_channels_);
+  if(rv != SDX2_SUCCESS)
+    return rv;
+
+  return sdx2_decoder_feed(&decoder,ibuf_,ibuf_len_,obuf_,obuf_len_);
 }
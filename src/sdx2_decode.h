@@ -30,6 +30,28 @@ extern "C" {
 
 #define SDX2_MONO   1
 #define SDX2_STEREO 2
+
+/*
+  Incremental decoder. Input can be fed in pieces of any size and the
+  output is identical to a single sdx2_decode() of the concatenated
+  input. Every call writes exactly ibuf_len samples.
+*/
+typedef struct sdx2_decoder_t sdx2_decoder_t;
+struct sdx2_decoder_t
+{
+  u8  num_channels;
+  u64 offset;
+  s32 sample[SDX2_STEREO];
+};
+
+s32 sdx2_decoder_init(sdx2_decoder_t *decoder,
+                      const u8        num_channels);
+
+s32 sdx2_decoder_feed(sdx2_decoder_t *decoder,
+                      const u8       *ibuf,
+                      const u32       ibuf_len,
+                      s16            *obuf,
+                      const u32       obuf_len);
   
 s32 sdx2_decode(const u8 *ibuf,
                 const u32  ibuf_len,
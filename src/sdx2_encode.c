@@ -1,6 +1,5 @@
 #include "sdx2_encode.h"
 
-#include <math.h>
 #include <stdint.h>
 
 static
@@ -12,26 +11,59 @@ abs_s16(const s16 v_)
   return ((v_ < 0) ? -v_ : v_);
 }
 
+#define SQRT_TABLE_SIZE   65536
+#define SQUARE_TABLE_SIZE 256
+
+/*
+  square_root() and abs_s16_4x() used to be computed per candidate
+  which put a double precision sqrt in the inner loop. Both only ever
+  see 16bit and 8bit inputs respectively so they are precomputed
+  once at startup. Tables are indexed by the unsigned reinterpretation
+  of the input.
+*/
+static s8  g_SQRT_TABLE[SQRT_TABLE_SIZE];
+static s16 g_SQUARE_TABLE[SQUARE_TABLE_SIZE];
+
+/*
+  square_root(v) == floor(sqrt(|v| / 2)) with the sign of v which is
+  the largest k where 2k^2 <= |v|. -32768 has no positive s16
+  representation and the original double based version yielded 0.
+*/
 static
-s16
-abs_s16_4x(const s16 v_)
+__attribute__((constructor))
+void
+_build_tables(void)
 {
-  return ((v_ * abs_s16(v_)) * 2);
+  s32 k;
+
+  k = 0;
+  for(s32 v = 0; v <= INT16_MAX; v++)
+    {
+      if((2 * (k + 1) * (k + 1)) <= v)
+        k++;
+      g_SQRT_TABLE[(u16)v]  = k;
+      g_SQRT_TABLE[(u16)-v] = -k;
+    }
+  g_SQRT_TABLE[(u16)INT16_MIN] = 0;
+
+  for(s32 i = -128; i < 128; i++)
+    g_SQUARE_TABLE[(u8)i] = (s16)((i * abs_s16(i)) * 2);
 }
 
 static
+inline
 s16
-square_root(s16 sample_)
+abs_s16_4x(const s8 v_)
 {
-  s32 neg;
-
-  neg = (sample_ < 0);
-  if(neg)
-    sample_ = -sample_;
-
-  sample_ = (s16)sqrt(((double)sample_) / 2);
+  return g_SQUARE_TABLE[(u8)v_];
+}
 
-  return (neg ? -sample_ : sample_);
+static
+inline
+s8
+square_root(const s16 sample_)
+{
+  return g_SQRT_TABLE[(u16)sample_];
 }
 
 static
@@ -75,8 +107,9 @@ is_diff_clipping_s16(const s16 sample0_,
 }
 
 static
+inline
 s16
-decode_sample(const s16 curr_sample_,
+decode_sample(const s8  curr_sample_,
               const s16 prev_sample_)
 {
   if(is_delta_mode(curr_sample_))
@@ -99,6 +132,29 @@ delta_sample(const s16 curr_,
 }
 
 
+/*
+  Exact mode ignores the previous sample so the best exact candidate
+  depends only on the current sample.
+*/
+static
+s8
+encode_exact(const s16 curr_sample_)
+{
+  s8 exact;
+  s16 tmp;
+
+  exact = square_root(curr_sample_);
+  exact = set_exact_mode(exact);
+
+  tmp = delta_sample(curr_sample_,exact,0);
+  if(delta_sample(curr_sample_,exact+2,0) < tmp)
+    exact += 2;
+  else if(delta_sample(curr_sample_,exact-2,0) < tmp)
+    exact -= 2;
+
+  return exact;
+}
+
 /*
   See FIG 5 on page 5 of US Patent US005617506A
 
@@ -117,14 +173,7 @@ encode_sample(const s16 curr_sample_,
   s8 delta;
   s16 tmp;
 
-  exact = square_root(curr_sample_);
-  exact = set_exact_mode(exact);
-
-  tmp = delta_sample(curr_sample_,exact,prev_sample_);
-  if(delta_sample(curr_sample_,exact+2,prev_sample_) < tmp)
-    exact += 2;
-  else if(delta_sample(curr_sample_,exact-2,prev_sample_) < tmp)
-    exact -= 2;
+  exact = encode_exact(curr_sample_);
 
   if(is_diff_clipping_s16(curr_sample_,prev_sample_))
     return exact;
@@ -158,87 +207,101 @@ encode_sample(const s16 curr_sample_,
   return delta;
 }
 
+/*
+  The first frame of a stream is exact encoded without refinement and
+  doesn't update the predictor. This matches the original encoder and
+  is kept so output is unchanged.
+*/
 static
 void
-sdx2_encode_mono(const s16 *ibuf_,
-                 const u32  ibuf_len_,
-                 s8        *obuf_)
+sdx2_encode_channels(const s16 *ibuf_,
+                     const u32  ibuf_len_,
+                     const u8   num_channels_,
+                     s8        *obuf_,
+                     const u64  offset_,
+                     s16       *prev_sample_)
 {
-  s32 i;
-  s16 curr_sample = 0;
-  s16 prev_sample = 0;
-  s8  comp_sample = 0;
-
-  curr_sample = ibuf_[0];
-  comp_sample = square_root(curr_sample);
-  comp_sample = set_exact_mode(comp_sample);
-  obuf_[0]    = comp_sample;
+  u32 i;
+  u8  c;
+  s8  comp_sample;
 
-  for(i = 1; i < ibuf_len_; i++)
+  c = (offset_ % num_channels_);
+  for(i = 0; i < ibuf_len_; i++)
     {
-      curr_sample = ibuf_[i];
-
-      comp_sample = encode_sample(curr_sample,prev_sample);
-
-      obuf_[i] = comp_sample;
-
-      prev_sample = decode_sample(comp_sample,prev_sample);
+      if((offset_ + i) < num_channels_)
+        {
+          comp_sample = square_root(ibuf_[i]);
+          obuf_[i]    = set_exact_mode(comp_sample);
+        }
+      else
+        {
+          comp_sample = encode_sample(ibuf_[i],prev_sample_[c]);
+          obuf_[i]    = comp_sample;
+          prev_sample_[c] = decode_sample(comp_sample,prev_sample_[c]);
+        }
+
+      if(++c == num_channels_)
+        c = 0;
     }
 }
 
+/*
+  Unlike sdx2_encode_channels() the predictor is seeded from the
+  decoded value of the leading exact sample(s) so that the stream can
+  be cut at any frame and the pieces encoded independently.
+*/
 static
 void
-sdx2_encode_stereo(const s16 *ibuf_,
-                   const u32  ibuf_len_,
-                   s8        *obuf_)
+sdx2_encode_resync_channels(const s16 *ibuf_,
+                            const u32  ibuf_len_,
+                            const u8   num_channels_,
+                            s8        *obuf_)
 {
-  s32 i;
-  s8  comp_sample       = 0;
-  s16 curr_sample       = 0;
-  s16 prev_left_sample  = 0;
-  s16 prev_right_sample = 0;
+  u32 i;
+  u8  c;
+  s8  comp_sample;
+  s16 prev_sample[SDX2_STEREO] = {0,0};
 
-  curr_sample = ibuf_[0];
-  comp_sample = square_root(curr_sample);
-  comp_sample = set_exact_mode(comp_sample);
-  obuf_[0]    = comp_sample;
+  for(i = 0, c = 0; i < ibuf_len_; i++)
+    {
+      if(i < num_channels_)
+        comp_sample = encode_exact(ibuf_[i]);
+      else
+        comp_sample = encode_sample(ibuf_[i],prev_sample[c]);
 
-  curr_sample = ibuf_[1];
-  comp_sample = square_root(curr_sample);
-  comp_sample = set_exact_mode(comp_sample);
-  obuf_[1]    = comp_sample;
+      obuf_[i] = comp_sample;
+      prev_sample[c] = decode_sample(comp_sample,prev_sample[c]);
 
-  for (i = 2; i < ibuf_len_; i += 2)
-    {
-      curr_sample = ibuf_[i+0];
-      comp_sample = encode_sample(curr_sample, prev_left_sample);
-      obuf_[i+0] = comp_sample;
-      prev_left_sample = decode_sample(comp_sample,prev_left_sample);
-
-      curr_sample = ibuf_[i+1];
-      comp_sample = encode_sample(curr_sample,prev_right_sample);
-      obuf_[i+1] = comp_sample;
-      prev_right_sample = decode_sample(comp_sample,prev_right_sample);
+      if(++c == num_channels_)
+        c = 0;
     }
 }
 
 s32
-sdx2_encode(const s16 *ibuf_,
-            const u32  ibuf_len_,
-            const u8   num_channels_,
-            s8        *obuf_,
-            const u32  obuf_len_)
+sdx2_exact_error(const s16 sample_)
+{
+  s32 error;
+
+  error = ((s32)sample_ - (s32)abs_s16_4x(encode_exact(sample_)));
+
+  return ((error < 0) ? -error : error);
+}
+
+s32
+sdx2_encode_resync(const s16 *ibuf_,
+                   const u32  ibuf_len_,
+                   const u8   num_channels_,
+                   s8        *obuf_,
+                   const u32  obuf_len_)
 {
   if(obuf_len_ < ibuf_len_)
     return SDX2_ERR_INVALID_OBUF_LEN;
-  
+
   switch(num_channels_)
     {
-    case 1:
-      sdx2_encode_mono(ibuf_,ibuf_len_,obuf_);
-      return SDX2_SUCCESS;
-    case 2:
-      sdx2_encode_stereo(ibuf_,ibuf_len_,obuf_);
+    case SDX2_MONO:
+    case SDX2_STEREO:
+      sdx2_encode_resync_channels(ibuf_,ibuf_len_,num_channels_,obuf_);
       return SDX2_SUCCESS;
     default:
       break;
@@ -246,3 +309,69 @@ sdx2_encode(const s16 *ibuf_,
 
   return SDX2_ERR_UNSUPPORTED_CHANNELS;
 }
+
+s32
+sdx2_encoder_init(sdx2_encoder_t *encoder_,
+                  const u8        num_channels_)
+{
+  if((num_channels_ != SDX2_MONO) && (num_channels_ != SDX2_STEREO))
+    return SDX2_ERR_UNSUPPORTED_CHANNELS;
+
+  encoder_->num_channels   = num_channels_;
+  encoder_->offset         = 0;
+  encoder_->prev_sample[0] = 0;
+  encoder_->prev_sample[1] = 0;
+
+  return SDX2_SUCCESS;
+}
+
+s32
+sdx2_encoder_feed(sdx2_encoder_t *encoder_,
+                  const s16      *ibuf_,
+                  const u32       ibuf_len_,
+                  s8             *obuf_,
+                  const u32       obuf_len_)
+{
+  if(obuf_len_ < ibuf_len_)
+    return SDX2_ERR_INVALID_OBUF_LEN;
+
+  sdx2_encode_channels(ibuf_,
+                       ibuf_len_,
+                       encoder_->num_channels,
+                       obuf_,
+                       encoder_->offset,
+                       encoder_->prev_sample);
+
+  encoder_->offset += ibuf_len_;
+
+  return SDX2_SUCCESS;
+}
+
+s32
+sdx2_encoder_flush(sdx2_encoder_t *encoder_,
+                   s8             *obuf_,
+                   const u32       obuf_len_,
+                   u32            *obuf_used_)
+{
+  // Every sample is encoded as it's fed so there is nothing pending.
+  *obuf_used_ = 0;
+
+  return sdx2_encoder_init(encoder_,encoder_->num_channels);
+}
+
+s32
+sdx2_encode(const s16 *ibuf_,
+            const u32  ibuf_len_,
+            const u8   num_channels_,
+            s8        *obuf_,
+            const u32  obuf_len_)
+{
+  s32 rv;
+  sdx2_encoder_t encoder;
+
+  rv = sdx2_encoder_init(&encoder,num_channels_);
+  if(rv != SDX2_SUCCESS)
+    return rv;
+
+  return sdx2_encoder_feed(&encoder,ibuf_,ibuf_len_,obuf_,obuf_len_);
+}
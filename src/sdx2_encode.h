@@ -30,6 +30,36 @@ extern "C" {
 
 #define SDX2_MONO   1
 #define SDX2_STEREO 2
+
+/*
+  Incremental encoder. Samples can be fed in pieces of any size, even
+  ones splitting a stereo frame, and the output is identical to a
+  single sdx2_encode() of the concatenated input. feed() writes
+  exactly ibuf_len bytes. flush() writes anything still pending into
+  obuf, sets *obuf_used to the number of bytes written and resets the
+  encoder for a new stream.
+*/
+typedef struct sdx2_encoder_t sdx2_encoder_t;
+struct sdx2_encoder_t
+{
+  u8  num_channels;
+  u64 offset;
+  s16 prev_sample[SDX2_STEREO];
+};
+
+s32 sdx2_encoder_init(sdx2_encoder_t *encoder,
+                      const u8        num_channels);
+
+s32 sdx2_encoder_feed(sdx2_encoder_t *encoder,
+                      const s16      *ibuf,
+                      const u32       ibuf_len,
+                      s8             *obuf,
+                      const u32       obuf_len);
+
+s32 sdx2_encoder_flush(sdx2_encoder_t *encoder,
+                       s8             *obuf,
+                       const u32       obuf_len,
+                       u32            *obuf_used);
   
 s32 sdx2_encode(const s16 *ibuf,
                 const u32  ibuf_len,
@@ -37,6 +67,20 @@ s32 sdx2_encode(const s16 *ibuf,
                 s8        *obuf,
                 const u32  obuf_len);
 
+/*
+  Same as sdx2_encode() but the leading frame is always exact coded
+  and the predictor is seeded from it. Any frame aligned slice of a
+  buffer can be encoded this way independently of the rest.
+*/
+s32 sdx2_encode_resync(const s16 *ibuf,
+                       const u32  ibuf_len,
+                       const u8   num_channels,
+                       s8        *obuf,
+                       const u32  obuf_len);
+
+/* Absolute error of the best exact mode encoding of a sample. */
+s32 sdx2_exact_error(const s16 sample);
+
 #ifdef __cplusplus
 }
 #endif    
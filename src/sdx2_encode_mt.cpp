@@ -0,0 +1,141 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "sdx2_encode_mt.hpp"
+
+#include "sdx2_encode.h"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// Below this many frames per segment threading overhead dominates.
+#define MIN_SEGMENT_FRAMES (1024 * 64)
+
+namespace l
+{
+  static
+  bool
+  frame_resyncable(const s16 *frame_,
+                   const u8   num_channels_,
+                   const s32  max_resync_error_)
+  {
+    for(u8 c = 0; c < num_channels_; c++)
+      {
+        if(sdx2_exact_error(frame_[c]) > max_resync_error_)
+          return false;
+      }
+
+    return true;
+  }
+
+  /*
+    Returns the frame index of each segment start. The first is
+    always 0 and the list is terminated with the total frame count.
+  */
+  static
+  std::vector<u32>
+  find_splits(const s16      *ibuf_,
+              const u32       frames_,
+              const u8        num_channels_,
+              const unsigned  threads_,
+              const s32       max_resync_error_)
+  {
+    u32 window;
+    u32 segment_frames;
+    std::vector<u32> splits;
+
+    segment_frames = std::max<u32>(frames_ / threads_,MIN_SEGMENT_FRAMES);
+    window = (segment_frames / 4);
+
+    splits.push_back(0);
+    for(u32 target = segment_frames; target < frames_; target += segment_frames)
+      {
+        u32 end;
+
+        target = std::max(target,splits.back() + MIN_SEGMENT_FRAMES);
+        end    = std::min(target + window,frames_ - MIN_SEGMENT_FRAMES);
+        for(u32 f = target; f < end; f++)
+          {
+            if(!l::frame_resyncable(&ibuf_[f * num_channels_],
+                                    num_channels_,
+                                    max_resync_error_))
+              continue;
+
+            splits.push_back(f);
+            break;
+          }
+      }
+    splits.push_back(frames_);
+
+    return splits;
+  }
+}
+
+s32
+sdx2_encode_mt(const s16      *ibuf_,
+               const u32       ibuf_len_,
+               const u8        num_channels_,
+               s8             *obuf_,
+               const u32       obuf_len_,
+               const unsigned  threads_,
+               const s32       max_resync_error_)
+{
+  u32 frames;
+  std::vector<u32> splits;
+
+  if(obuf_len_ < ibuf_len_)
+    return SDX2_ERR_INVALID_OBUF_LEN;
+  if((num_channels_ != SDX2_MONO) && (num_channels_ != SDX2_STEREO))
+    return SDX2_ERR_UNSUPPORTED_CHANNELS;
+
+  frames = (ibuf_len_ / num_channels_);
+  if((threads_ <= 1) || (frames < (MIN_SEGMENT_FRAMES * 2)))
+    return sdx2_encode(ibuf_,ibuf_len_,num_channels_,obuf_,obuf_len_);
+
+  splits = l::find_splits(ibuf_,frames,num_channels_,threads_,max_resync_error_);
+  if(splits.size() <= 2)
+    return sdx2_encode(ibuf_,ibuf_len_,num_channels_,obuf_,obuf_len_);
+
+  ThreadPool pool(std::min<size_t>(threads_,splits.size() - 1));
+
+  for(size_t i = 0; i < (splits.size() - 1); i++)
+    {
+      pool.enqueue([&,i]()
+      {
+        u32 offset;
+        u32 len;
+
+        offset = (splits[i] * num_channels_);
+        if((i + 2) == splits.size())
+          len = (ibuf_len_ - offset);
+        else
+          len = ((splits[i+1] - splits[i]) * num_channels_);
+
+        // The first segment is encoded exactly as the serial encoder would.
+        if(i == 0)
+          sdx2_encode(&ibuf_[offset],len,num_channels_,&obuf_[offset],len);
+        else
+          sdx2_encode_resync(&ibuf_[offset],len,num_channels_,&obuf_[offset],len);
+      });
+    }
+
+  pool.wait();
+
+  return SDX2_SUCCESS;
+}
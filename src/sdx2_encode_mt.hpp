@@ -0,0 +1,38 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "types_ints.h"
+
+/*
+  Splits the input into roughly equal frame aligned segments, encodes
+  them concurrently and writes each into its place in obuf. Every
+  segment after the first begins with a forced exact frame so a split
+  is only placed where that frame's exact encoding error is no more
+  than max_resync_error in every channel. If no such frame is found
+  near a wanted split point the neighbouring segments are merged. With
+  threads <= 1 the result is identical to sdx2_encode().
+*/
+s32 sdx2_encode_mt(const s16      *ibuf,
+                   const u32       ibuf_len,
+                   const u8        num_channels,
+                   s8             *obuf,
+                   const u32       obuf_len,
+                   const unsigned  threads,
+                   const s32       max_resync_error);
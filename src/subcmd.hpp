@@ -20,11 +20,28 @@
 
 #include "options.hpp"
 
+#include <filesystem>
+#include <string>
+
 namespace SubCmd
 {
   void to_adp4(const Opts::ToADP4 &);
   void to_sdx2(const Opts::ToSDX2 &);
   void from_adp4(const Opts::FromADP4 &);
   void from_sdx2(const Opts::FromSDX2 &);
+  void transcode(const Opts::Transcode &);
+  void manifest(const Opts::Manifest &);
+  void bench(const Opts::Bench &);
   void version(void);
+
+  // One file converted with opts' settings and reported into output.
+  // An empty output_filepath means the usual name next to filepath.
+  void to_adp4_file(const Opts::ToADP4          &opts,
+                    const std::filesystem::path &filepath,
+                    const std::filesystem::path &output_filepath,
+                    std::string                 &output);
+  void to_sdx2_file(const Opts::ToSDX2          &opts,
+                    const std::filesystem::path &filepath,
+                    const std::filesystem::path &output_filepath,
+                    std::string                 &output);
 }
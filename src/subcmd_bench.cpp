@@ -0,0 +1,379 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "options.hpp"
+#include "subcmd.hpp"
+
+#include "adp4_decode.h"
+#include "adp4_encode.h"
+#include "ffmpeg.hpp"
+#include "file.hpp"
+#include "thread_pool.hpp"
+
+#include "fmt.hpp"
+
+#include "types_ints.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace l
+{
+  struct Result
+  {
+    double seconds;
+    u64    files;
+    u64    samples;
+  };
+
+  static
+  Result
+  run(const std::vector<std::filesystem::path>                      &filepaths_,
+      const unsigned                                                 jobs_,
+      const std::function<std::vector<s16>(const std::filesystem::path&)> &func_)
+  {
+    Result result;
+    std::atomic<u64> files = 0;
+    std::atomic<u64> samples = 0;
+    std::chrono::steady_clock::time_point start;
+
+    start = std::chrono::steady_clock::now();
+
+    {
+      ThreadPool pool(jobs_);
+
+      for(const auto &filepath : filepaths_)
+        {
+          pool.enqueue([&,filepath]()
+          {
+            std::vector<s16> buf;
+
+            try
+              {
+                buf = func_(filepath);
+              }
+            catch(const std::runtime_error &e_)
+              {
+                return;
+              }
+
+            if(buf.empty())
+              return;
+
+            files   += 1;
+            samples += buf.size();
+          });
+        }
+
+      pool.wait();
+    }
+
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.files   = files;
+    result.samples = samples;
+
+    return result;
+  }
+
+  static
+  void
+  print(const std::string &name_,
+        const Result      &result_)
+  {
+    fmt::print("{}:\n"
+               " - files decoded: {}\n"
+               " - samples decoded: {}\n"
+               " - time: {:.3f}s\n"
+               " - files/sec: {:.1f}\n"
+               ,
+               name_,
+               result_.files,
+               result_.samples,
+               result_.seconds,
+               (result_.files / result_.seconds));
+  }
+
+  /*
+    Both passes run the ffmpeg executable, even when the FFmpeg
+    libraries could decode in process, since process startup is what
+    grouping amortizes. Every input is read and ffmpeg run once
+    beforehand so the first pass doesn't pay for a cold page cache.
+    In process decoding is measured last when the libraries load.
+  */
+  static
+  void
+  bench_ffmpeg_decode(const Opts::Bench &opts_)
+  {
+    Result result;
+    const int channels = 1;
+    const int freq = 22050;
+
+    if(!ffmpeg::ffmpeg_available())
+      throw std::runtime_error("ffmpeg executable not found");
+    if(opts_.filepaths.empty())
+      throw std::runtime_error("no input files given");
+
+    for(const auto &filepath : opts_.filepaths)
+      file::load_u8(filepath);
+    try
+      {
+        ffmpeg::to_s16le(opts_.filepaths[0],channels,freq,false);
+      }
+    catch(const std::runtime_error &e_)
+      {
+      }
+
+    result = l::run(opts_.filepaths,
+                    opts_.jobs,
+                    [&](const std::filesystem::path &filepath_)
+                    {
+                      return ffmpeg::to_s16le(filepath_,channels,freq,false);
+                    });
+    l::print("ffmpeg process per file",result);
+
+    ffmpeg::GroupDecoder group(opts_.filepaths,
+                               opts_.ffmpeg_group,
+                               opts_.jobs,
+                               channels,
+                               freq,
+                               false);
+    result = l::run(opts_.filepaths,
+                    opts_.jobs,
+                    [&](const std::filesystem::path &filepath_)
+                    {
+                      return group.to_s16le(filepath_);
+                    });
+    l::print(fmt::format("ffmpeg process per {} files",opts_.ffmpeg_group),
+             result);
+
+    if(!ffmpeg::libav::available())
+      return;
+
+    result = l::run(opts_.filepaths,
+                    opts_.jobs,
+                    [&](const std::filesystem::path &filepath_)
+                    {
+                      return ffmpeg::to_s16le(filepath_,channels,freq);
+                    });
+    l::print("ffmpeg libraries in process",result);
+  }
+
+  typedef void (*ADP4DecoderFeed)(adp4_decoder_t*,const u8*,const u32,s16*);
+
+  /*
+    Decodes input_ repeatedly for at least a second so short inputs
+    still give a stable figure. Returns samples per second.
+  */
+  static
+  double
+  time_adp4_decoder(ADP4DecoderFeed         feed_,
+                    const std::vector<u8>  &input_,
+                    std::vector<s16>       &output_)
+  {
+    u64 samples;
+    double seconds;
+    adp4_decoder_t decoder;
+    std::chrono::steady_clock::time_point start;
+
+    output_.resize(input_.size() * 2);
+
+    samples = 0;
+    start   = std::chrono::steady_clock::now();
+    do
+      {
+        adp4_decoder_init(&decoder,ADP4_MONO);
+        feed_(&decoder,input_.data(),input_.size(),output_.data());
+        samples += output_.size();
+        seconds  = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      }
+    while(seconds < 1.0);
+
+    return (samples / seconds);
+  }
+
+  static
+  void
+  bench_adp4_decode(const Opts::Bench &opts_)
+  {
+    double lut;
+    double reference;
+    std::vector<u8> input;
+    std::vector<s16> output_lut;
+    std::vector<s16> output_reference;
+
+    // Raw ADP4 files if given, otherwise 16MiB of noise which keeps
+    // the step index moving across the whole table.
+    for(const auto &filepath : opts_.filepaths)
+      {
+        std::vector<u8> buf;
+
+        buf = file::load_u8(filepath);
+        input.insert(input.end(),buf.begin(),buf.end());
+      }
+    if(input.empty())
+      {
+        std::mt19937 rng(0);
+
+        input.resize(16 * 1024 * 1024);
+        for(auto &byte : input)
+          byte = rng();
+      }
+
+    reference = l::time_adp4_decoder(adp4_decoder_feed_reference,
+                                     input,
+                                     output_reference);
+    lut       = l::time_adp4_decoder(adp4_decoder_feed,
+                                     input,
+                                     output_lut);
+
+    if(memcmp(output_lut.data(),
+              output_reference.data(),
+              output_lut.size() * sizeof(s16)))
+      throw std::runtime_error("LUT decoder output differs from reference");
+
+    fmt::print("adp4 decode:\n"
+               " - input size: {}b\n"
+               " - reference: {:.1f} Msamples/sec\n"
+               " - lut: {:.1f} Msamples/sec\n"
+               " - speedup: {:.2f}x\n"
+               " - output: identical\n"
+               ,
+               input.size(),
+               reference / 1000000,
+               lut / 1000000,
+               lut / reference);
+  }
+
+  /*
+    Encodes every input repeatedly for at least a second. Returns
+    samples per second.
+  */
+  static
+  double
+  time_adp4_encoder(const std::function<void()> &encode_,
+                    const u64                    samples_)
+  {
+    u64 samples;
+    double seconds;
+    std::chrono::steady_clock::time_point start;
+
+    samples = 0;
+    start   = std::chrono::steady_clock::now();
+    do
+      {
+        encode_();
+        samples += samples_;
+        seconds  = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      }
+    while(seconds < 1.0);
+
+    return (samples / seconds);
+  }
+
+  static
+  void
+  bench_adp4_encode(const Opts::Bench &opts_)
+  {
+    u64 samples;
+    double lanes;
+    double serial;
+    std::vector<std::vector<s16>> inputs;
+    std::vector<std::vector<u8>> output_lanes;
+    std::vector<std::vector<u8>> output_serial;
+    std::vector<adp4_stream_t> streams;
+
+    // Raw mono s16 files if given, otherwise 256 noise streams of
+    // 0.25 to 2 seconds at 22050Hz like a batch of short SFX.
+    for(const auto &filepath : opts_.filepaths)
+      inputs.emplace_back(file::load_s16(filepath));
+    if(inputs.empty())
+      {
+        std::mt19937 rng(0);
+
+        inputs.resize(256);
+        for(auto &input : inputs)
+          {
+            input.resize(5512 + (rng() % (44100 - 5512)));
+            for(auto &sample : input)
+              sample = rng();
+          }
+      }
+
+    samples = 0;
+    output_lanes.resize(inputs.size());
+    output_serial.resize(inputs.size());
+    for(size_t i = 0; i < inputs.size(); i++)
+      {
+        output_lanes[i].resize((inputs[i].size() + 1) / 2);
+        output_serial[i].resize((inputs[i].size() + 1) / 2);
+        streams.push_back({inputs[i].data(),
+                           (u32)inputs[i].size(),
+                           output_lanes[i].data()});
+        samples += inputs[i].size();
+      }
+
+    serial = l::time_adp4_encoder([&]()
+    {
+      for(size_t i = 0; i < inputs.size(); i++)
+        adp4_encode(inputs[i].data(),
+                    inputs[i].size(),
+                    ADP4_MONO,
+                    output_serial[i].data());
+    },
+    samples);
+    lanes = l::time_adp4_encoder([&]()
+    {
+      adp4_encode_streams(streams.data(),streams.size());
+    },
+    samples);
+
+    if(output_lanes != output_serial)
+      throw std::runtime_error("lane encoder output differs from serial");
+
+    fmt::print("adp4 encode:\n"
+               " - streams: {}\n"
+               " - sample count: {}\n"
+               " - serial: {:.1f} Msamples/sec\n"
+               " - {} lanes: {:.1f} Msamples/sec\n"
+               " - speedup: {:.2f}x\n"
+               " - output: identical\n"
+               ,
+               inputs.size(),
+               samples,
+               serial / 1000000,
+               ADP4_LANES,
+               lanes / 1000000,
+               lanes / serial);
+  }
+}
+
+void
+SubCmd::bench(const Opts::Bench &opts_)
+{
+  if(opts_.target == "ffmpeg-decode")
+    l::bench_ffmpeg_decode(opts_);
+  else if(opts_.target == "adp4-decode")
+    l::bench_adp4_decode(opts_);
+  else if(opts_.target == "adp4-encode")
+    l::bench_adp4_encode(opts_);
+}
@@ -19,6 +19,9 @@
 #include "options.hpp"
 #include "subcmd.hpp"
 
+#include "batch.hpp"
+
+#include "aiff.hpp"
 #include "file.hpp"
 #include "ffmpeg.hpp"
 #include "adp4_decode.h"
@@ -28,115 +31,311 @@
 #include "types_ints.h"
 
 #include <iterator>
+#include <algorithm>
 #include <array>
+#include <functional>
 #include <unistd.h>
 #include <vector>
 #include <cstdio>
+#include <cstring>
 
+// Input bytes decoded per block when streaming.
+#define STREAM_BLOCK_SIZE (1024 * 16)
 
 namespace l
 {
+  /*
+    Decodes a block at a time from input to output so memory use
+    doesn't depend on the input length. Blocks come from next_ which
+    returns 0 at the end of the input. At most sample_count_ samples
+    are written. wav output is piped through ffmpeg which muxes while
+    the next block decodes.
+  */
+  static
+  void
+  from_adp4_stream(const std::function<u64(const u8*&)> &next_,
+                   const std::filesystem::path          &output_filepath_,
+                   const std::string                    &output_type_,
+                   const int                             channels_,
+                   const int                             freq_,
+                   const u64                             sample_count_,
+                   std::string                          &output_)
+  {
+    u64 n;
+    u64 count;
+    u64 samples;
+    u64 input_size;
+    bool failed;
+    bool short_write;
+    FILE *out_file;
+    const u8 *block;
+    std::vector<s16> obuf;
+    adp4_decoder_t decoder;
+    ffmpeg::Writer writer;
+
+    out_file    = NULL;
+    short_write = false;
+    if(output_type_ == "wav")
+      {
+        if(!writer.open(output_filepath_,"wav","s16le","pcm_s16le",channels_,freq_))
+          throw fmt::exception("failed to start ffmpeg for {}",output_filepath_);
+      }
+    else
+      {
+        out_file = file::open_output(output_filepath_);
+        if(out_file == NULL)
+          throw fmt::exception("failed to open output {}",output_filepath_);
+      }
+
+    auto write = [&](const s16 *buf_,
+                     const u64  count_) -> u64
+    {
+      if(out_file != NULL)
+        return fwrite(buf_,sizeof(s16),count_,out_file);
+      return (writer.write(buf_,count_ * sizeof(s16)) / sizeof(s16));
+    };
+
+    adp4_decoder_init(&decoder,channels_);
+    obuf.resize(STREAM_BLOCK_SIZE * 2);
+
+    samples    = 0;
+    input_size = 0;
+    while((samples < sample_count_) && ((n = next_(block)) > 0))
+      {
+        u64 rv;
+
+        // ADP4 is 4bits per sample, 2 samples per byte
+        adp4_decoder_feed(&decoder,
+                          block,
+                          n,
+                          obuf.data());
+
+        input_size += n;
+
+        count = std::min<u64>(n * 2,sample_count_ - samples);
+        rv = write(obuf.data(),count);
+        if(rv != count)
+          {
+            short_write = true;
+            break;
+          }
+
+        samples += count;
+      }
+
+    if(out_file != NULL)
+      failed = (file::close_output(out_file) != 0);
+    else
+      failed = (writer.close() != 0);
+
+    if(short_write || failed)
+      {
+        file::remove_output(output_filepath_);
+        if(short_write || (out_file != NULL))
+          throw fmt::exception("failed to write all data to file {}",
+                               output_filepath_);
+        throw fmt::exception("ffmpeg failed writing {}",output_filepath_);
+      }
+
+    fmt::format_to(std::back_inserter(output_),
+                   " - output file name: {}\n"
+                   " - sample count: {}\n"
+                   " - input data size: {}b\n"
+                   " - output data size: {}b\n"
+                   ,
+                   output_filepath_,
+                   samples,
+                   input_size,
+                   samples * sizeof(s16));
+  }
+
   static
   void
   from_adp4(const std::filesystem::path &filepath_,
+            const std::filesystem::path &output_filepath_,
             const std::string           &output_type_,
-            const int                    freq_)
+            int                          channels_,
+            int                          freq_,
+            std::string                 &output_)
   {
-    std::vector<u8> input_data;
+    u64 rv;
+    u64 count;
+    u64 offset;
+    bool pending;
+    bool streaming;
+    aiff::Info info;
+    file::View input_file;
+    file::Reader input_stdin;
+    u64 input_size;
+    u64 sample_count;
+    const u8 *input_data;
+    std::vector<u8> buf;
     std::vector<s16> output_data;
-    std::filesystem::path output_filepath;
 
-    input_data = file::load_u8(filepath_);
-    if(input_data.empty())
-      throw fmt::exception("failed to load {}",filepath_);
+    sample_count = ~(u64)0;
+    streaming = ((output_type_ == "raw") || (output_type_ == "wav"));
 
-    output_filepath = filepath_;
-    output_filepath += fmt::format(".{}",output_type_);
+    auto next_stdin = [&](const u8 *&block_) -> u64
+    {
+      if(!pending)
+        count = input_stdin.read(buf.data(),buf.size());
+      pending = false;
+      block_  = buf.data();
 
-    // ADP4 is 4bits per sample, 2 samples per byte
-    output_data.resize(input_data.size() * 2);
+      return count;
+    };
 
-    adp4_decode(input_data.data(),
-                input_data.size(),
-                output_data.data());
+    auto next_mapped = [&](const u8 *&block_) -> u64
+    {
+      u64 n;
+
+      n = std::min<u64>(STREAM_BLOCK_SIZE,input_size - offset);
+      block_  = &input_data[offset];
+      offset += n;
+
+      return n;
+    };
 
-    if(output_type_ == "raw")
+    if(file::is_stdio(filepath_))
       {
-        u64 rv;
-        FILE *out_file;
+        input_stdin.open(filepath_);
+        buf.resize(STREAM_BLOCK_SIZE);
+        count   = input_stdin.read(buf.data(),buf.size());
+        pending = true;
+        if(count == 0)
+          throw fmt::exception("failed to load {}",filepath_);
 
-        out_file = fopen(output_filepath.string().c_str(),"wb");
-        if(out_file == NULL)
-          throw fmt::exception("failed to open output {}",output_filepath);
-
-        rv = fwrite(output_data.data(),
-                    sizeof(decltype(output_data)::value_type),
-                    output_data.size(), 
-                    out_file);
-        
-        fclose(out_file);
-        if(rv != output_data.size())
-          fmt::print(" - ERROR: short write {}/{}\n",rv,output_data.size());
+        // Raw ADP4 is decoded as it arrives. AIFF-C has to be parsed
+        // as a whole.
+        if(streaming && ((count < 4) || memcmp(buf.data(),"FORM",4)))
+          return l::from_adp4_stream(next_stdin,
+                                     output_filepath_,
+                                     output_type_,
+                                     channels_,
+                                     freq_,
+                                     sample_count,
+                                     output_);
+
+        std::vector<u8> rest;
+
+        rest = file::load_u8(filepath_);
+        buf.resize(count);
+        buf.insert(buf.end(),rest.begin(),rest.end());
+
+        input_data = buf.data();
+        input_size = buf.size();
       }
-    else if((output_type_ == "aiff") ||
-            (output_type_ == "wav"))
+    else
       {
-        u64 rv;
-        const int channels = 1;
-
-        rv = ffmpeg::write(output_data.data(),
-                           output_data.size() * 2, // 2 bytes per sample
-                           output_filepath,
-                           "s16le",
-                           "pcm_s16le",
-                           channels,
-                           freq_);
-        if(rv != (output_data.size() * sizeof(decltype(output_data)::value_type)))
-          fmt::print(" - ERROR: short write {}/{}\n",rv,output_data.size());
+        input_file.open(filepath_);
+        if(input_file.empty())
+          throw fmt::exception("failed to load {}",filepath_);
+
+        input_data = input_file.data();
+        input_size = input_file.size();
+      }
+
+    // AIFF-C input carries its own layout, otherwise assume raw.
+    if(aiff::parse(input_data,input_size,info))
+      {
+        if(info.compression != "ADP4")
+          throw fmt::exception("AIFF compression type '{}' is not ADP4",
+                               info.compression);
+        if((info.channels < 1) || (info.channels > 2))
+          throw fmt::exception("unsupported channel count {}",info.channels);
+
+        // Sound data may be padded to 4 bytes for 3DO. ADP4 is
+        // 4bits per sample, 2 samples per byte.
+        sample_count = ((u64)info.sample_frames * info.channels);
+        input_data   = info.sound_data;
+        input_size   = std::min<u64>(info.sound_data_size,(sample_count + 1) / 2);
+        channels_    = info.channels;
+        freq_        = info.freq;
+      }
+
+    offset = 0;
+    if(streaming)
+      return l::from_adp4_stream(next_mapped,
+                                 output_filepath_,
+                                 output_type_,
+                                 channels_,
+                                 freq_,
+                                 sample_count,
+                                 output_);
+
+    // ADP4 is 4bits per sample, 2 samples per byte
+    output_data.resize(input_size * 2);
+
+    adp4_decode(input_data,
+                input_size,
+                channels_,
+                output_data.data());
+    output_data.resize(std::min<u64>(output_data.size(),sample_count));
+
+    if(output_type_ == "aiff")
+      {
+        rv = aiff::write_pcm(output_data.data(),
+                             output_data.size(),
+                             output_filepath_,
+                             channels_,
+                             freq_);
       }
     else
       {
-        throw fmt::exception("unknown output type '{}'",output_type_);        
+        throw fmt::exception("unknown output type '{}'",output_type_);
+      }
+
+    if(rv != (output_data.size() * sizeof(decltype(output_data)::value_type)))
+      {
+        file::remove_output(output_filepath_);
+        throw fmt::exception("failed to write all data to file {}",
+                             output_filepath_);
       }
 
-    fmt::print(" - output file name: {}\n"
-               " - sample count: {}\n"
-               " - input data size: {}b\n"
-               " - output data size: {}b\n"
-               ,
-               output_filepath,
-               input_data.size() * 2,
-               input_data.size(),
-               output_data.size() * sizeof(s16));
+    fmt::format_to(std::back_inserter(output_),
+                   " - output file name: {}\n"
+                   " - sample count: {}\n"
+                   " - input data size: {}b\n"
+                   " - output data size: {}b\n"
+                   ,
+                   output_filepath_,
+                   output_data.size(),
+                   input_size,
+                   output_data.size() * sizeof(s16));
   }
 }
 
 void
 SubCmd::from_adp4(const Opts::FromADP4 &opts_)
 {
-  if(opts_.output_type != "raw")
+  if(opts_.output_type == "wav")
     {
       if(!ffmpeg::ffmpeg_available())
         throw std::runtime_error("ffmpeg executable not found");
     }
   
-  for(auto &filepath : opts_.filepaths)
-    {
-      fmt::print("{}:\n",filepath);
-
-      try
-        {
-          l::from_adp4(filepath,
-                       opts_.output_type,
-                       opts_.freq);
-        }
-      catch(const std::system_error &e_)
-        {
-          fmt::print(" - ERROR - {} - {} ({})\n",filepath,e_.what(),e_.code().message());
-        }
-      catch(const std::runtime_error &e_)
-        {
-          fmt::print(" - ERROR - {} - {}\n",filepath,e_.what());
-        }
-    }
+  batch::init_stdio(opts_.filepaths,opts_.output_file);
+
+  auto func = [&](const std::filesystem::path &filepath_,
+                  std::string                 &output_)
+  {
+    std::filesystem::path output_filepath;
+
+    output_filepath  = filepath_;
+    output_filepath += fmt::format(".{}",opts_.output_type);
+
+    l::from_adp4(filepath_,
+                 batch::output_filepath(filepath_,
+                                        opts_.output_file,
+                                        output_filepath),
+                 opts_.output_type,
+                 opts_.channels,
+                 opts_.freq,
+                 output_);
+  };
+
+  batch::run(opts_.filepaths,
+             {opts_.recursive,opts_.include,opts_.exclude},
+             opts_.jobs,
+             func);
 }
@@ -19,6 +19,9 @@
 #include "options.hpp"
 #include "subcmd.hpp"
 
+#include "batch.hpp"
+
+#include "aiff.hpp"
 #include "file.hpp"
 #include "ffmpeg.hpp"
 #include "sdx2_decode.h"
@@ -27,118 +30,299 @@
 
 #include "types_ints.h"
 
+#include <algorithm>
 #include <array>
 #include <cstdio>
+#include <cstring>
+#include <functional>
 #include <iterator>
 #include <unistd.h>
 #include <vector>
 
+// Input bytes decoded per block when streaming.
+#define STREAM_BLOCK_SIZE (1024 * 16)
 
 namespace l
 {
+  /*
+    Decodes a block at a time from input to output so memory use
+    doesn't depend on the input length. Blocks come from next_ which
+    returns 0 at the end of the input. wav output is piped through
+    ffmpeg which muxes while the next block decodes.
+  */
+  static
+  void
+  from_sdx2_stream(const std::function<u64(const u8*&)> &next_,
+                   const std::filesystem::path          &output_filepath_,
+                   const std::string                    &output_type_,
+                   const int                             channels_,
+                   const int                             freq_,
+                   std::string                          &output_)
+  {
+    u64 n;
+    u64 input_size;
+    bool failed;
+    bool short_write;
+    FILE *out_file;
+    const u8 *block;
+    std::vector<s16> obuf;
+    sdx2_decoder_t decoder;
+    ffmpeg::Writer writer;
+
+    out_file    = NULL;
+    short_write = false;
+    if(output_type_ == "wav")
+      {
+        if(!writer.open(output_filepath_,"wav","s16le","pcm_s16le",channels_,freq_))
+          throw fmt::exception("failed to start ffmpeg for {}",output_filepath_);
+      }
+    else
+      {
+        out_file = file::open_output(output_filepath_);
+        if(out_file == NULL)
+          throw fmt::exception("failed to open output {}",output_filepath_);
+      }
+
+    auto write = [&](const s16 *buf_,
+                     const u64  count_) -> u64
+    {
+      if(out_file != NULL)
+        return fwrite(buf_,sizeof(s16),count_,out_file);
+      return (writer.write(buf_,count_ * sizeof(s16)) / sizeof(s16));
+    };
+
+    sdx2_decoder_init(&decoder,channels_);
+    obuf.resize(STREAM_BLOCK_SIZE);
+
+    input_size = 0;
+    while((n = next_(block)) > 0)
+      {
+        u64 rv;
+
+        sdx2_decoder_feed(&decoder,
+                          block,
+                          n,
+                          obuf.data(),
+                          obuf.size());
+
+        input_size += n;
+
+        rv = write(obuf.data(),n);
+        if(rv != n)
+          {
+            short_write = true;
+            break;
+          }
+      }
+
+    if(out_file != NULL)
+      failed = (file::close_output(out_file) != 0);
+    else
+      failed = (writer.close() != 0);
+
+    if(short_write || failed)
+      {
+        file::remove_output(output_filepath_);
+        if(short_write || (out_file != NULL))
+          throw fmt::exception("failed to write all data to file {}",
+                               output_filepath_);
+        throw fmt::exception("ffmpeg failed writing {}",output_filepath_);
+      }
+
+    fmt::format_to(std::back_inserter(output_),
+                   " - output file name: {}\n"
+                   " - sample count: {}\n"
+                   " - input data size: {}b\n"
+                   " - output data size: {}b\n"
+                   ,
+                   output_filepath_,
+                   input_size,
+                   input_size,
+                   input_size * sizeof(s16));
+  }
+
   static
   void
   from_sdx2(const std::filesystem::path &filepath_,
+            const std::filesystem::path &output_filepath_,
             const std::string           &output_type_,
-            const int                    channels_,
-            const int                    freq_)
+            int                          channels_,
+            int                          freq_,
+            std::string                 &output_)
   {
-    std::vector<u8> input_data;
+    u64 rv;
+    u64 count;
+    u64 offset;
+    bool pending;
+    bool streaming;
+    aiff::Info info;
+    file::View input_file;
+    file::Reader input_stdin;
+    u64 input_size;
+    const u8 *input_data;
+    std::vector<u8> buf;
     std::vector<s16> output_data;
-    std::filesystem::path output_filepath;
 
-    input_data = file::load_u8(filepath_);
-    if(input_data.empty())
-      throw fmt::exception("failed to load {}",filepath_);
+    streaming = ((output_type_ == "raw") || (output_type_ == "wav"));
 
-    output_filepath = filepath_;
-    output_filepath += fmt::format(".{}",output_type_);
+    auto next_stdin = [&](const u8 *&block_) -> u64
+    {
+      if(!pending)
+        count = input_stdin.read(buf.data(),buf.size());
+      pending = false;
+      block_  = buf.data();
 
-    output_data.resize(input_data.size());
+      return count;
+    };
 
-    sdx2_decode(input_data.data(),
-                input_data.size(),
-                channels_,
-                output_data.data(),
-                output_data.size());
+    auto next_mapped = [&](const u8 *&block_) -> u64
+    {
+      u64 n;
+
+      n = std::min<u64>(STREAM_BLOCK_SIZE,input_size - offset);
+      block_  = &input_data[offset];
+      offset += n;
 
-    if(output_type_ == "raw")
+      return n;
+    };
+
+    if(file::is_stdio(filepath_))
       {
-        u64 rv;
-        FILE *out_file;
+        input_stdin.open(filepath_);
+        buf.resize(STREAM_BLOCK_SIZE);
+        count   = input_stdin.read(buf.data(),buf.size());
+        pending = true;
+        if(count == 0)
+          throw fmt::exception("failed to load {}",filepath_);
 
-        out_file = fopen(output_filepath.string().c_str(),"wb");
-        if(out_file == NULL)
-          throw fmt::exception("failed to open output {}",output_filepath);
+        // Raw SDX2 is decoded as it arrives. AIFF-C has to be parsed
+        // as a whole.
+        if(streaming && ((count < 4) || memcmp(buf.data(),"FORM",4)))
+          return l::from_sdx2_stream(next_stdin,
+                                     output_filepath_,
+                                     output_type_,
+                                     channels_,
+                                     freq_,
+                                     output_);
+
+        std::vector<u8> rest;
 
-        rv = fwrite(output_data.data(),
-                    sizeof(decltype(output_data)::value_type),
-                    output_data.size(),
-                    out_file);
+        rest = file::load_u8(filepath_);
+        buf.resize(count);
+        buf.insert(buf.end(),rest.begin(),rest.end());
 
-        fclose(out_file);
-        if(rv != output_data.size())
-          fmt::print(" - ERROR: short write {}/{}\n",rv,output_data.size());
+        input_data = buf.data();
+        input_size = buf.size();
       }
-    else if((output_type_ == "aiff") ||
-            (output_type_ == "wav"))
+    else
       {
-        u64 rv;
+        input_file.open(filepath_);
+        if(input_file.empty())
+          throw fmt::exception("failed to load {}",filepath_);
 
-        rv = ffmpeg::write(output_data.data(),
-                           output_data.size() * 2, // 2 bytes per sample
-                           output_filepath,
-                           "s16le",
-                           "pcm_s16le",
-                           channels_,
-                           freq_);
-        if(rv != (output_data.size() * sizeof(decltype(output_data)::value_type)))        
-          fmt::print(" - ERROR: short write {}/{}\n",rv,output_data.size());
+        input_data = input_file.data();
+        input_size = input_file.size();
+      }
+
+    // AIFF-C input carries its own layout, otherwise assume raw.
+    if(aiff::parse(input_data,input_size,info))
+      {
+        if(info.compression != "SDX2")
+          throw fmt::exception("AIFF compression type '{}' is not SDX2",
+                               info.compression);
+        if((info.channels < 1) || (info.channels > 2))
+          throw fmt::exception("unsupported channel count {}",info.channels);
+
+        // Sound data may be padded to 4 bytes for 3DO. SDX2 is a byte
+        // per sample.
+        input_data = info.sound_data;
+        input_size = std::min<u64>(info.sound_data_size,
+                                   (u64)info.sample_frames * info.channels);
+        channels_  = info.channels;
+        freq_      = info.freq;
+      }
+
+    offset = 0;
+    if(streaming)
+      return l::from_sdx2_stream(next_mapped,
+                                 output_filepath_,
+                                 output_type_,
+                                 channels_,
+                                 freq_,
+                                 output_);
+
+    output_data.resize(input_size);
+
+    sdx2_decode(input_data,
+                input_size,
+                channels_,
+                output_data.data(),
+                output_data.size());
+
+    if(output_type_ == "aiff")
+      {
+        rv = aiff::write_pcm(output_data.data(),
+                             output_data.size(),
+                             output_filepath_,
+                             channels_,
+                             freq_);
       }
     else
       {
         throw fmt::exception("unknown output type '{}'",output_type_);
       }
 
-    fmt::print(" - output file name: {}\n"
-               " - sample count: {}\n"
-               " - input data size: {}b\n"
-               " - output data size: {}b\n"
-               ,
-               output_filepath,
-               input_data.size(),
-               input_data.size(),
-               output_data.size() * sizeof(s16));
+    if(rv != (output_data.size() * sizeof(decltype(output_data)::value_type)))
+      {
+        file::remove_output(output_filepath_);
+        throw fmt::exception("failed to write all data to file {}",
+                             output_filepath_);
+      }
+
+    fmt::format_to(std::back_inserter(output_),
+                   " - output file name: {}\n"
+                   " - sample count: {}\n"
+                   " - input data size: {}b\n"
+                   " - output data size: {}b\n"
+                   ,
+                   output_filepath_,
+                   input_size,
+                   input_size,
+                   output_data.size() * sizeof(s16));
   }
 }
 
 void
 SubCmd::from_sdx2(const Opts::FromSDX2 &opts_)
 {
-  if(opts_.output_type != "raw")
+  if(opts_.output_type == "wav")
     {
       if(!ffmpeg::ffmpeg_available())
         throw std::runtime_error("ffmpeg executable not found");
     }
 
-  for(auto &filepath : opts_.filepaths)
-    {
-      fmt::print("{}:\n",filepath);
-
-      try
-        {
-          l::from_sdx2(filepath,
-                       opts_.output_type,
-                       opts_.channels,
-                       opts_.freq);
-        }
-      catch(const std::system_error &e_)
-        {
-          fmt::print(" - ERROR - {} - {} ({})\n",filepath,e_.what(),e_.code().message());
-        }
-      catch(const std::runtime_error &e_)
-        {
-          fmt::print(" - ERROR - {} - {}\n",filepath,e_.what());
-        }
-    }
+  batch::init_stdio(opts_.filepaths,opts_.output_file);
+
+  auto func = [&](const std::filesystem::path &filepath_,
+                  std::string                 &output_)
+  {
+    std::filesystem::path output_filepath;
+
+    output_filepath  = filepath_;
+    output_filepath += fmt::format(".{}",opts_.output_type);
+
+    l::from_sdx2(filepath_,
+                 batch::output_filepath(filepath_,
+                                        opts_.output_file,
+                                        output_filepath),
+                 opts_.output_type,
+                 opts_.channels,
+                 opts_.freq,
+                 output_);
+  };
+
+  batch::run(opts_.filepaths,
+             {opts_.recursive,opts_.include,opts_.exclude},
+             opts_.jobs,
+             func);
 }
@@ -0,0 +1,122 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "options.hpp"
+#include "subcmd.hpp"
+
+#include "batch.hpp"
+#include "manifest.hpp"
+
+#include "fmt.hpp"
+
+#include "types_ints.h"
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+
+namespace l
+{
+  static
+  void
+  convert(const manifest::Entry &entry_,
+          std::string           &output_)
+  {
+    if(entry_.codec == "adp4")
+      {
+        Opts::ToADP4 opts;
+
+        // Everything else keeps to-adp4's defaults.
+        opts.input_type      = entry_.input_type;
+        opts.output_type     = entry_.output_type;
+        opts.output_channels = entry_.channels;
+        opts.output_freq     = entry_.freq;
+
+        SubCmd::to_adp4_file(opts,entry_.input,entry_.output,output_);
+      }
+    else if(entry_.codec == "sdx2")
+      {
+        Opts::ToSDX2 opts;
+
+        // Everything else keeps to-sdx2's defaults.
+        opts.input_type      = entry_.input_type;
+        opts.output_type     = entry_.output_type;
+        opts.output_channels = entry_.channels;
+        opts.output_freq     = entry_.freq;
+
+        SubCmd::to_sdx2_file(opts,entry_.input,entry_.output,output_);
+      }
+  }
+}
+
+/*
+  Every entry runs in this one process so they share the worker
+  pool and ffmpeg's probe cache, and the report ends with a single
+  summary rather than one per invocation.
+*/
+void
+SubCmd::manifest(const Opts::Manifest &opts_)
+{
+  std::atomic<u64> failed;
+  std::vector<manifest::Entry> entries;
+  std::vector<std::filesystem::path> labels;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::duration<double> elapsed;
+
+  entries = manifest::load(opts_.filepath,opts_.format);
+  for(const auto &entry : entries)
+    labels.emplace_back(entry.input);
+
+  auto func = [&](const size_t  i_,
+                  std::string  &output_)
+  {
+    try
+      {
+        fmt::format_to(std::back_inserter(output_),
+                       " - manifest line: {}\n"
+                       " - codec: {} {}ch {}hz\n"
+                       ,
+                       entries[i_].line,
+                       entries[i_].codec,
+                       entries[i_].channels,
+                       entries[i_].freq);
+
+        l::convert(entries[i_],output_);
+      }
+    catch(...)
+      {
+        failed++;
+        throw;
+      }
+  };
+
+  failed = 0;
+  start  = std::chrono::steady_clock::now();
+
+  batch::run_indexed(labels,opts_.jobs,func);
+
+  elapsed = (std::chrono::steady_clock::now() - start);
+
+  fmt::print(batch::report_file(),
+             "manifest: {} entries, {} converted, {} failed in {:.2f}s\n",
+             entries.size(),
+             entries.size() - failed,
+             failed.load(),
+             elapsed.count());
+}
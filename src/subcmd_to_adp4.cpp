@@ -18,20 +18,37 @@
 
 #include "subcmd.hpp"
 
+#include "batch.hpp"
+
+#include "aiff.hpp"
+#include "cache.hpp"
+
 #include "file.hpp"
+#include "pcm.hpp"
 #include "ffmpeg.hpp"
+#include "thread_pool.hpp"
 #include "adp4_encode.h"
+#include "adp4_encode_trellis.hpp"
 
 #include "fmt.hpp"
 
 #include "types_ints.h"
 
+#include <algorithm>
+#include <exception>
 #include <iterator>
+#include <memory>
 #include <array>
 #include <unistd.h>
 #include <vector>
 #include <cstdio>
 
+// Samples per block when streaming.
+#define STREAM_BLOCK_SIZE (1024 * 64)
+
+// Files decoded per lane batch. Bounds memory use while leaving
+// enough streams to keep the lanes full.
+#define LANE_BATCH_SIZE 256
 
 namespace l
 {
@@ -40,46 +57,359 @@ namespace l
   load_file(const std::string           &input_type_,
             const std::filesystem::path &filepath_,
             const int                    channels_,
-            const int                    freq_)
+            const int                    freq_,
+            const int                    input_channels_,
+            const int                    input_freq_,
+            const u8                     quality_,
+            ffmpeg::GroupDecoder        *group_)
   {
+    auto load_raw = [&]()
+    {
+      return pcm::convert(file::load_s16(filepath_),
+                          input_channels_,
+                          input_freq_,
+                          channels_,
+                          freq_,
+                          quality_);
+    };
+
     if(input_type_ == "raw")
-      return file::load_s16(filepath_);
+      return load_raw();
 
     if(input_type_ == "auto")
       {
         std::vector<s16> buf;
 
-        buf = ffmpeg::to_s16le(filepath_,channels_,freq_);
+        if(group_ != NULL)
+          buf = group_->to_s16le(filepath_);
+        else
+          buf = ffmpeg::to_s16le(filepath_,channels_,freq_);
         if(!buf.empty())
           return buf;
 
-        return file::load_s16(filepath_);
+        return load_raw();
       }
 
     return {};
   }
 
+  /*
+    Encodes block by block straight from the decoder's pipe to the
+    output file so memory use doesn't depend on the input length.
+  */
+  static
+  void
+  to_adp4_stream(const std::filesystem::path &filepath_,
+                 const std::filesystem::path &output_filepath_,
+                 const std::string           &input_type_,
+                 const int                    channels_,
+                 const int                    freq_,
+                 const int                    input_channels_,
+                 const int                    input_freq_,
+                 const u8                     quality_,
+                 std::string                 &output_)
+  {
+    u64 n;
+    u64 count;
+    u64 written;
+    u64 samples;
+    u64 padding;
+    u64 raw_offset;
+    bool decoding;
+    bool from_stdin;
+    bool flushed;
+    FILE *out_file;
+    const s16 *block;
+    file::View raw;
+    file::Reader raw_stdin;
+    pcm::Converter converter;
+    std::vector<s16> ibuf;
+    std::vector<u8>  obuf;
+    adp4_encoder_t encoder;
+    ffmpeg::S16LEReader reader;
+
+    ibuf.resize(STREAM_BLOCK_SIZE);
+    obuf.resize(STREAM_BLOCK_SIZE);
+
+    // Raw input is encoded straight out of the mapped file unless it
+    // needs mixing or resampling first. stdin is read a block at a
+    // time.
+    raw_offset = 0;
+    flushed    = false;
+    auto read = [&]() -> u64
+    {
+      u64 count;
+
+      if(raw.empty() && !from_stdin)
+        {
+          block = ibuf.data();
+          return reader.read(ibuf.data(),ibuf.size());
+        }
+
+      while(true)
+        {
+          if(from_stdin)
+            {
+              count = (raw_stdin.read(ibuf.data(),ibuf.size() * sizeof(s16)) / sizeof(s16));
+              block = ibuf.data();
+            }
+          else
+            {
+              count = std::min<u64>(STREAM_BLOCK_SIZE,raw.size_as<s16>() - raw_offset);
+              block = &raw.data_as<s16>()[raw_offset];
+              raw_offset += count;
+            }
+
+          if(count == 0)
+            break;
+          if(!converter.active())
+            return count;
+
+          block = converter.feed(block,count,count);
+          if(count > 0)
+            return count;
+        }
+
+      if(!converter.active() || flushed)
+        return 0;
+
+      flushed = true;
+      block   = converter.flush(count);
+
+      return count;
+    };
+
+    n = 0;
+    from_stdin = false;
+    decoding   = ((input_type_ == "auto") && reader.open(filepath_,channels_,freq_));
+    if(decoding)
+      n = read();
+
+    // Once ffmpeg has consumed stdin there is nothing left to fall
+    // back to.
+    if((n == 0) && !(decoding && file::is_stdio(filepath_)))
+      {
+        reader.close();
+        decoding = false;
+        if(file::is_stdio(filepath_))
+          from_stdin = raw_stdin.open(filepath_);
+        else
+          raw.open(filepath_);
+        converter.init(input_channels_,input_freq_,channels_,freq_,quality_);
+        n = read();
+      }
+
+    if(n == 0)
+      throw fmt::exception("failed to load {}",filepath_);
+
+    out_file = file::open_output(output_filepath_);
+    if(out_file == NULL)
+      throw fmt::exception("failed to open output {}",output_filepath_);
+
+    adp4_encoder_init(&encoder,channels_);
+
+    samples = 0;
+    written = 0;
+    while(n > 0)
+      {
+        u64 rv;
+
+        // 4bits per sample, 2 samples per byte
+        if(obuf.size() < ((n + 1) / 2))
+          obuf.resize((n + 1) / 2);
+
+        count = adp4_encoder_feed(&encoder,block,n,obuf.data());
+
+        rv = fwrite(obuf.data(),sizeof(u8),count,out_file);
+        if(rv != count)
+          break;
+
+        samples += n;
+        written += count;
+        n = read();
+      }
+
+    // Any held odd sample, then pad to word / 4 byte alignment for
+    // use with 3DO
+    count   = adp4_encoder_flush(&encoder,obuf.data());
+    padding = (((written + count + 3) / 4) * 4) - (written + count);
+    std::fill(obuf.begin() + count,obuf.begin() + count + padding,0);
+    fwrite(obuf.data(),sizeof(u8),count + padding,out_file);
+    written += (count + padding);
+
+    file::close_output(out_file);
+
+    if(n != 0)
+      throw fmt::exception("failed to write all data to file {}",
+                           output_filepath_);
+
+    // ffmpeg dying part way through looks like the end of the input
+    // so only its exit status tells a truncated decode apart.
+    if(decoding && (reader.close() != 0))
+      throw fmt::exception("ffmpeg failed decoding {}",filepath_);
+
+    fmt::format_to(std::back_inserter(output_),
+                   " - output file name: {}\n"
+                   " - sample count: {}\n"
+                   " - input data size: {}b\n"
+                   " - output data size: {}b\n"
+                   ,
+                   output_filepath_,
+                   samples,
+                   samples * 2,
+                   written);
+  }
+
+  /*
+    Channels 0 keeps the input's channel count. auto input is probed
+    and input ffprobe can't read is taken as raw with input_channels_.
+    More than two channels are mixed down to stereo.
+  */
+  static
+  int
+  output_channels(const std::filesystem::path &filepath_,
+                  const std::string           &input_type_,
+                  const int                    channels_,
+                  const int                    input_channels_)
+  {
+    int channels;
+
+    if(channels_ != 0)
+      return channels_;
+
+    channels = -1;
+    if((input_type_ == "auto") && !file::is_stdio(filepath_))
+      channels = ffmpeg::channels(filepath_);
+    if(channels < 1)
+      channels = ((input_channels_ != 0) ? input_channels_ : 1);
+
+    return std::min(channels,2);
+  }
+
+  static
+  std::filesystem::path
+  output_filepath(const std::filesystem::path &filepath_,
+                  const std::filesystem::path &dirpath_,
+                  const int                    channels_,
+                  const int                    freq_,
+                  const std::string           &output_type_)
+  {
+    std::filesystem::path output_filepath;
+
+    output_filepath  = (dirpath_ / filepath_.filename());
+    output_filepath += fmt::format(".adp4.{}ch.{}hz.{}",channels_,freq_,output_type_);
+
+    return output_filepath;
+  }
+
+  static
+  void
+  write_output(const std::filesystem::path &output_filepath_,
+               const std::string           &output_type_,
+               const int                    channels_,
+               const int                    freq_,
+               const u64                    sample_count_,
+               const std::vector<u8>       &output_data_,
+               std::string                 &output_)
+  {
+    if(output_type_ == "raw")
+      {
+        u64 rv;
+        FILE *out_file;
+
+        out_file = file::open_output(output_filepath_);
+        if(out_file == NULL)
+          throw fmt::exception("failed to open output {}",output_filepath_);
+
+        rv = fwrite(output_data_.data(),
+                    sizeof(u8),
+                    output_data_.size(),
+                    out_file);
+
+        file::close_output(out_file);
+
+        if(rv != output_data_.size())
+          throw fmt::exception("failed to write all data to file {} / {}",
+                               rv,
+                               output_data_.size());
+      }
+    else if(output_type_ == "aifc")
+      {
+        u64 rv;
+
+        rv = aiff::write_compressed(output_data_.data(),
+                                    output_data_.size(),
+                                    output_filepath_,
+                                    "ADP4",
+                                    channels_,
+                                    freq_,
+                                    sample_count_ / channels_);
+        if(rv != output_data_.size())
+          throw fmt::exception("failed to write all data to file {} / {}",
+                               rv,
+                               output_data_.size());
+      }
+
+    fmt::format_to(std::back_inserter(output_),
+                   " - output file name: {}\n"
+                   " - sample count: {}\n"
+                   " - input data size: {}b\n"
+                   " - output data size: {}b\n"
+                   ,
+                   output_filepath_,
+                   sample_count_,
+                   sample_count_ * 2,
+                   output_data_.size());
+  }
+
   static
   void
   to_adp4(const std::filesystem::path &filepath_,
+          const std::filesystem::path &output_filepath_,
           const std::string           &input_type_,
           const std::string           &output_type_,
           const std::string           &encoder_,
-          const int                    freq_)
+          const int                    channels_,
+          const int                    freq_,
+          const unsigned               trellis_beam_,
+          const unsigned               trellis_lookahead_,
+          const unsigned               threads_,
+          const int                    input_channels_,
+          const int                    input_freq_,
+          const u8                     quality_,
+          ffmpeg::GroupDecoder        *group_,
+          std::string                 &output_)
   {
     std::vector<s16> input_data;
     std::vector<u8> output_data;
-    std::filesystem::path output_filepath;
 
-    input_data = l::load_file(input_type_,filepath_,1,freq_);
+    // Group decoding needs the whole input up front.
+    if((output_type_ == "raw") &&
+       (encoder_ == "default") &&
+       ((group_ == NULL) || file::is_stdio(filepath_)))
+      return l::to_adp4_stream(filepath_,
+                               output_filepath_,
+                               input_type_,
+                               channels_,
+                               freq_,
+                               input_channels_,
+                               input_freq_,
+                               quality_,
+                               output_);
+
+    input_data = l::load_file(input_type_,
+                              filepath_,
+                              channels_,
+                              freq_,
+                              input_channels_,
+                              input_freq_,
+                              quality_,
+                              group_);
     if(input_data.empty())
       throw fmt::exception("failed to load {}",filepath_);
 
-    output_filepath = filepath_;
-    output_filepath += fmt::format(".adp4.1ch.{}hz.{}",freq_,output_type_);
-
     // 4bits per sample, 2 samples per byte
-    output_data.resize(input_data.size() >> 1);
+    output_data.resize((input_data.size() + 1) >> 1);
 
     // Pad to word / 4 byte alignment for use with 3DO
     output_data.resize(((output_data.size() + 3) / 4) * 4);
@@ -88,94 +418,377 @@ namespace l
       {
         adp4_encode(input_data.data(),
                     input_data.size(),
+                    channels_,
                     output_data.data());
       }
+    else if(encoder_ == "trellis")
+      {
+        adp4_encode_trellis(input_data.data(),
+                            input_data.size(),
+                            channels_,
+                            trellis_beam_,
+                            trellis_lookahead_,
+                            threads_,
+                            output_data.data());
+      }
     else
       {
         throw fmt::exception("unknown encoder '{}'",encoder_);
       }
 
-    if(output_type_ == "raw")
-      {
-        u64 rv;
-        FILE *out_file;
+    l::write_output(output_filepath_,
+                    output_type_,
+                    channels_,
+                    freq_,
+                    input_data.size(),
+                    output_data,
+                    output_);
+  }
 
-        out_file = fopen(output_filepath.string().c_str(),"wb");
-        if(out_file == NULL)
-          throw fmt::exception("failed to open output {}",output_filepath);
+  /*
+    Inputs in a lane batch are decoded in parallel, then every mono
+    stream is encoded together by adp4_encode_streams() which runs one
+    stream per SIMD lane, and finally written out. Output is identical
+    to encoding each file on its own.
+  */
+  struct LaneJob
+  {
+    std::filesystem::path filepath;
+    std::filesystem::path output_filepath;
+    bool                  cacheable;
+    bool                  cached;
+    std::exception_ptr    error;
+    std::vector<s16>      input_data;
+    std::vector<u8>       output_data;
+  };
 
-        rv = fwrite(output_data.data(),
-                    sizeof(decltype(output_data)::value_type),
-                    output_data.size(),
-                    out_file);
+  static
+  void
+  encode_lanes(std::vector<LaneJob> &jobs_,
+               const unsigned        threads_)
+  {
+    u64 tasks;
+    std::vector<adp4_stream_t> streams;
+    std::vector<std::vector<adp4_stream_t>> groups;
 
-        fclose(out_file);
+    for(auto &job : jobs_)
+      {
+        if(job.input_data.empty())
+          continue;
 
-        if(rv != output_data.size())
-          throw fmt::exception("failed to write all data to file {} / {}",
-                               rv,
-                               output_data.size());
+        streams.push_back({job.input_data.data(),
+                           (u32)job.input_data.size(),
+                           job.output_data.data()});
       }
-    else if(output_type_ == "aifc")
+
+    if(streams.empty())
+      return;
+
+    // Longest first, dealt round robin, so every thread gets a
+    // similar mix of lengths to keep its lanes busy.
+    std::sort(streams.begin(),
+              streams.end(),
+              [](const adp4_stream_t &a_, const adp4_stream_t &b_)
+              {
+                return (a_.input_data_sample_count > b_.input_data_sample_count);
+              });
+
+    tasks = ((streams.size() + ADP4_LANES - 1) / ADP4_LANES);
+    tasks = std::max<u64>(1,std::min<u64>(tasks,threads_));
+    groups.resize(tasks);
+    for(u64 i = 0; i < streams.size(); i++)
+      groups[i % tasks].push_back(streams[i]);
+
+    if(tasks == 1)
+      return adp4_encode_streams(groups[0].data(),groups[0].size());
+
+    ThreadPool pool(tasks);
+
+    for(const auto &group : groups)
       {
-        u64 rv;
-        const int channels = 1;
-        const std::string format = "u8";
-        const std::string codec = "adpcm_ima_ws";
-
-        rv = ffmpeg::write(output_data.data(),
-                           output_data.size(),
-                           output_filepath,
-                           format,
-                           codec,
-                           channels,
-                           freq_);
-        if(rv != output_data.size())
-          throw fmt::exception("failed to write all data to file {} / {}",
-                               rv,
-                               output_data.size());
+        pool.enqueue([&group]()
+        {
+          adp4_encode_streams(group.data(),group.size());
+        });
       }
 
-    fmt::print(" - output file name: {}\n"
-               " - sample count: {}\n"
-               " - input data size: {}b\n"
-               " - output data size: {}b\n"
-               ,
-               output_filepath,
-               input_data.size(),
-               input_data.size() * 2,
-               output_data.size());
+    pool.wait();
   }
 }
 
 void
 SubCmd::to_adp4(const Opts::ToADP4 &opts_)
 {
-  if(opts_.output_type != "raw")
+  bool lanes;
+  bool grouped;
+  batch::Walk walk;
+  std::unique_ptr<cache::Store> cache;
+  std::unique_ptr<ffmpeg::GroupDecoder> group;
+  std::vector<std::filesystem::path> inputs;
+  std::vector<std::filesystem::path> filepaths;
+
+  batch::init_stdio(opts_.filepaths,opts_.output_file);
+
+  batch::OutputDirs dirpaths(opts_.filepaths,opts_.output_path);
+
+  walk    = {opts_.recursive,opts_.include,opts_.exclude};
+  // A group is decoded to one channel count so inputs keeping their
+  // own aren't grouped.
+  grouped = ((opts_.input_type == "auto") &&
+             (opts_.ffmpeg_group > 1) &&
+             (opts_.output_channels != 0));
+  lanes   = ((opts_.encoder == "default") &&
+             (opts_.output_channels == ADP4_MONO) &&
+             std::none_of(opts_.filepaths.begin(),
+                          opts_.filepaths.end(),
+                          file::is_stdio));
+
+  // Grouped decoding and lane batches need every file up front so
+  // they can't overlap with the walk.
+  inputs = opts_.filepaths;
+  if(grouped || lanes)
+    inputs = batch::expand(opts_.filepaths,walk,opts_.jobs);
+  lanes = (lanes && (inputs.size() > 1));
+
+  filepaths = inputs;
+  if(!opts_.cache_dir.empty())
     {
-      if(!ffmpeg::ffmpeg_available())
-        throw std::runtime_error("ffmpeg executable not found");
+      cache.reset(new cache::Store(opts_.cache_dir,
+                                   opts_.cache_size,
+                                   fmt::format("adp4;{};{};{};{};{};{};{};{};{};{}",
+                                               opts_.input_type,
+                                               opts_.input_channels,
+                                               opts_.input_freq,
+                                               opts_.resample_quality,
+                                               opts_.output_type,
+                                               opts_.encoder,
+                                               opts_.trellis_beam,
+                                               opts_.trellis_lookahead,
+                                               opts_.output_channels,
+                                               opts_.output_freq)));
+      if(grouped)
+        filepaths = cache->uncached(inputs,opts_.jobs);
     }
 
-  for(auto &filepath : opts_.filepaths)
-    {
-      fmt::print("{}:\n",filepath);
+  if(grouped)
+    group.reset(new ffmpeg::GroupDecoder(filepaths,
+                                         opts_.ffmpeg_group,
+                                         opts_.jobs,
+                                         opts_.output_channels,
+                                         opts_.output_freq));
+
+  auto make_output_filepath = [&](const std::filesystem::path &filepath_,
+                                  const int                    channels_)
+  {
+    return batch::output_filepath(filepath_,
+                                  opts_.output_file,
+                                  l::output_filepath(filepath_,
+                                                     dirpaths.dirpath(filepath_),
+                                                     channels_,
+                                                     opts_.output_freq,
+                                                     opts_.output_type));
+  };
+
+  // Pipes can't be hashed up front or copied out of the cache.
+  auto is_cacheable = [&](const std::filesystem::path &filepath_,
+                       const std::filesystem::path &output_filepath_)
+  {
+    return (cache &&
+            !file::is_stdio(filepath_) &&
+            !file::is_stdio(output_filepath_));
+  };
+
+  auto func = [&](const std::filesystem::path &filepath_,
+                  std::string                 &output_)
+  {
+    int channels;
+    bool cacheable;
+    std::filesystem::path output_filepath;
+
+    channels = l::output_channels(filepath_,
+                                  opts_.input_type,
+                                  opts_.output_channels,
+                                  opts_.input_channels);
+
+    output_filepath = make_output_filepath(filepath_,channels);
+    cacheable       = is_cacheable(filepath_,output_filepath);
+
+    if(cacheable && cache->fetch(filepath_,output_filepath))
+      {
+        fmt::format_to(std::back_inserter(output_),
+                       " - output file name: {}\n"
+                       " - cache: hit\n"
+                       ,
+                       output_filepath);
+        return;
+      }
+
+    l::to_adp4(filepath_,
+               output_filepath,
+               opts_.input_type,
+               opts_.output_type,
+               opts_.encoder,
+               channels,
+               opts_.output_freq,
+               opts_.trellis_beam,
+               opts_.trellis_lookahead,
+               opts_.threads,
+               opts_.input_channels,
+               opts_.input_freq,
+               pcm::resample_quality(opts_.resample_quality),
+               group.get(),
+               output_);
+
+    if(cacheable)
+      cache->insert(filepath_,output_filepath);
+  };
+
+  auto lane_batch = [&](const size_t begin_,
+                        const size_t end_)
+  {
+    std::vector<l::LaneJob> jobs(end_ - begin_);
+    std::vector<std::filesystem::path> labels(inputs.begin() + begin_,
+                                              inputs.begin() + end_);
 
+    auto decode = [&](l::LaneJob &job_)
+    {
       try
         {
-          l::to_adp4(filepath,
-                     opts_.input_type,
-                     opts_.output_type,
-                     opts_.encoder,
-                     opts_.output_freq);
+          job_.output_filepath = make_output_filepath(job_.filepath,ADP4_MONO);
+          job_.cacheable       = is_cacheable(job_.filepath,job_.output_filepath);
+          job_.cached          = (job_.cacheable &&
+                                  cache->fetch(job_.filepath,job_.output_filepath));
+          if(job_.cached)
+            return;
+
+          job_.input_data = l::load_file(opts_.input_type,
+                                         job_.filepath,
+                                         opts_.output_channels,
+                                         opts_.output_freq,
+                                         opts_.input_channels,
+                                         opts_.input_freq,
+                                         pcm::resample_quality(opts_.resample_quality),
+                                         group.get());
+          if(job_.input_data.empty())
+            throw fmt::exception("failed to load {}",job_.filepath);
+
+          // 4bits per sample, 2 samples per byte, padded to word / 4
+          // byte alignment for use with 3DO
+          job_.output_data.resize(((((job_.input_data.size() + 1) / 2) + 3) / 4) * 4);
         }
-      catch(const std::system_error &e_)
+      catch(...)
         {
-          fmt::print(" - ERROR - {} - {} ({})\n",filepath,e_.what(),e_.code().message());
+          job_.input_data.clear();
+          job_.error = std::current_exception();
         }
-      catch(const std::runtime_error &e_)
+    };
+
+    // Errors are held until the write pass so they're reported with
+    // their file.
+    auto write = [&](const size_t  i_,
+                     std::string  &output_)
+    {
+      l::LaneJob &job = jobs[i_];
+
+      if(job.error)
+        std::rethrow_exception(job.error);
+
+      if(job.cached)
         {
-          fmt::print(" - ERROR - {} - {}\n",filepath,e_.what());
+          fmt::format_to(std::back_inserter(output_),
+                         " - output file name: {}\n"
+                         " - cache: hit\n"
+                         ,
+                         job.output_filepath);
+          return;
         }
+
+      l::write_output(job.output_filepath,
+                      opts_.output_type,
+                      opts_.output_channels,
+                      opts_.output_freq,
+                      job.input_data.size(),
+                      job.output_data,
+                      output_);
+
+      if(job.cacheable)
+        cache->insert(job.filepath,job.output_filepath);
+    };
+
+    {
+      ThreadPool pool(std::min<size_t>(opts_.jobs,jobs.size()));
+
+      for(size_t i = 0; i < jobs.size(); i++)
+        {
+          jobs[i].filepath = labels[i];
+          pool.enqueue([&,i]()
+          {
+            decode(jobs[i]);
+          });
+        }
+
+      pool.wait();
+    }
+
+    l::encode_lanes(jobs,opts_.jobs);
+
+    batch::run_indexed(labels,opts_.jobs,write);
+  };
+
+  // Multiple mono inputs with the default encoder are encoded
+  // together, a stream per SIMD lane.
+  if(lanes)
+    {
+      for(size_t i = 0; i < inputs.size(); i += LANE_BATCH_SIZE)
+        lane_batch(i,std::min<size_t>(i + LANE_BATCH_SIZE,inputs.size()));
+    }
+  else
+    {
+      batch::run(inputs,walk,opts_.jobs,func);
     }
+
+  if(cache)
+    {
+      cache->trim();
+      fmt::print(batch::report_file(),"{}",cache->summary());
+    }
+}
+
+void
+SubCmd::to_adp4_file(const Opts::ToADP4          &opts_,
+                     const std::filesystem::path &filepath_,
+                     const std::filesystem::path &output_filepath_,
+                     std::string                 &output_)
+{
+  int channels;
+  std::filesystem::path output_filepath;
+
+  channels = l::output_channels(filepath_,
+                                opts_.input_type,
+                                opts_.output_channels,
+                                opts_.input_channels);
+
+  output_filepath = output_filepath_;
+  if(output_filepath.empty())
+    output_filepath = l::output_filepath(filepath_,
+                                         filepath_.parent_path(),
+                                         channels,
+                                         opts_.output_freq,
+                                         opts_.output_type);
+
+  l::to_adp4(filepath_,
+             output_filepath,
+             opts_.input_type,
+             opts_.output_type,
+             opts_.encoder,
+             channels,
+             opts_.output_freq,
+             opts_.trellis_beam,
+             opts_.trellis_lookahead,
+             opts_.threads,
+             opts_.input_channels,
+             opts_.input_freq,
+             pcm::resample_quality(opts_.resample_quality),
+             NULL,
+             output_);
 }
@@ -18,20 +18,33 @@
 
 #include "subcmd.hpp"
 
+#include "batch.hpp"
+
+#include "aiff.hpp"
+#include "cache.hpp"
+
 #include "options.hpp"
 
 #include "ffmpeg.hpp"
 #include "file.hpp"
+#include "pcm.hpp"
 #include "sdx2_encode.h"
+#include "sdx2_encode_mt.hpp"
 
 #include "fmt.hpp"
 
 #include "types_ints.h"
 
+#include <algorithm>
+#include <iterator>
+#include <memory>
 #include <vector>
 
 #include <cstdio>
 
+// Samples per block when streaming.
+#define STREAM_BLOCK_SIZE (1024 * 64)
+
 namespace l
 {
   static
@@ -39,45 +52,294 @@ namespace l
   load_file(const std::string           &input_type_,
             const std::filesystem::path &filepath_,
             const int                    channels_,
-            const int                    freq_)
+            const int                    freq_,
+            const int                    input_channels_,
+            const int                    input_freq_,
+            const u8                     quality_,
+            ffmpeg::GroupDecoder        *group_)
   {
+    auto load_raw = [&]()
+    {
+      return pcm::convert(file::load_s16(filepath_),
+                          input_channels_,
+                          input_freq_,
+                          channels_,
+                          freq_,
+                          quality_);
+    };
+
     if(input_type_ == "raw")
-      return file::load_s16(filepath_);
+      return load_raw();
 
     if(input_type_ == "auto")
       {
         std::vector<s16> buf;
 
-        buf = ffmpeg::to_s16le(filepath_,channels_,freq_);
+        if(group_ != NULL)
+          buf = group_->to_s16le(filepath_);
+        else
+          buf = ffmpeg::to_s16le(filepath_,channels_,freq_);
         if(!buf.empty())
           return buf;
 
-        return file::load_s16(filepath_);
+        return load_raw();
       }
 
     return {};
   }
 
+  /*
+    Encodes block by block straight from the decoder's pipe to the
+    output file so memory use doesn't depend on the input length.
+  */
+  static
+  void
+  to_sdx2_stream(const std::filesystem::path &filepath_,
+                 const std::filesystem::path &output_filepath_,
+                 const std::string           &input_type_,
+                 const int                    channels_,
+                 const int                    freq_,
+                 const int                    input_channels_,
+                 const int                    input_freq_,
+                 const u8                     quality_,
+                 std::string                 &output_)
+  {
+    u64 n;
+    u64 offset;
+    u64 padding;
+    u64 raw_offset;
+    bool decoding;
+    bool from_stdin;
+    bool flushed;
+    FILE *out_file;
+    const s16 *block;
+    file::View raw;
+    file::Reader raw_stdin;
+    pcm::Converter converter;
+    std::vector<s16> ibuf;
+    std::vector<s8>  obuf;
+    sdx2_encoder_t encoder;
+    ffmpeg::S16LEReader reader;
+
+    ibuf.resize(STREAM_BLOCK_SIZE);
+    obuf.resize(STREAM_BLOCK_SIZE);
+
+    // Raw input is encoded straight out of the mapped file unless it
+    // needs mixing or resampling first. stdin is read a block at a
+    // time.
+    raw_offset = 0;
+    flushed    = false;
+    auto read = [&]() -> u64
+    {
+      u64 count;
+
+      if(raw.empty() && !from_stdin)
+        {
+          block = ibuf.data();
+          return reader.read(ibuf.data(),ibuf.size());
+        }
+
+      while(true)
+        {
+          if(from_stdin)
+            {
+              count = (raw_stdin.read(ibuf.data(),ibuf.size() * sizeof(s16)) / sizeof(s16));
+              block = ibuf.data();
+            }
+          else
+            {
+              count = std::min<u64>(STREAM_BLOCK_SIZE,raw.size_as<s16>() - raw_offset);
+              block = &raw.data_as<s16>()[raw_offset];
+              raw_offset += count;
+            }
+
+          if(count == 0)
+            break;
+          if(!converter.active())
+            return count;
+
+          block = converter.feed(block,count,count);
+          if(count > 0)
+            return count;
+        }
+
+      if(!converter.active() || flushed)
+        return 0;
+
+      flushed = true;
+      block   = converter.flush(count);
+
+      return count;
+    };
+
+    n = 0;
+    from_stdin = false;
+    decoding   = ((input_type_ == "auto") && reader.open(filepath_,channels_,freq_));
+    if(decoding)
+      n = read();
+
+    // Once ffmpeg has consumed stdin there is nothing left to fall
+    // back to.
+    if((n == 0) && !(decoding && file::is_stdio(filepath_)))
+      {
+        reader.close();
+        decoding = false;
+        if(file::is_stdio(filepath_))
+          from_stdin = raw_stdin.open(filepath_);
+        else
+          raw.open(filepath_);
+        converter.init(input_channels_,input_freq_,channels_,freq_,quality_);
+        n = read();
+      }
+
+    if(n == 0)
+      throw fmt::exception("failed to load {}",filepath_);
+
+    out_file = file::open_output(output_filepath_);
+    if(out_file == NULL)
+      throw fmt::exception("failed to open output {}",output_filepath_);
+
+    sdx2_encoder_init(&encoder,channels_);
+
+    offset = 0;
+    while(n > 0)
+      {
+        u64 rv;
+
+        if(obuf.size() < n)
+          obuf.resize(n);
+
+        sdx2_encoder_feed(&encoder,
+                          block,
+                          n,
+                          obuf.data(),
+                          obuf.size());
+
+        rv = fwrite(obuf.data(),sizeof(s8),n,out_file);
+        if(rv != n)
+          break;
+
+        offset += n;
+        n = read();
+      }
+
+    // Pad to word / 4 byte alignment for use with 3DO
+    padding = (((offset + 3) / 4) * 4) - offset;
+    std::fill(obuf.begin(),obuf.end(),0);
+    fwrite(obuf.data(),sizeof(s8),padding,out_file);
+
+    file::close_output(out_file);
+
+    if(n != 0)
+      throw fmt::exception("failed to write all data to file {}",
+                           output_filepath_);
+
+    // ffmpeg dying part way through looks like the end of the input
+    // so only its exit status tells a truncated decode apart.
+    if(decoding && (reader.close() != 0))
+      throw fmt::exception("ffmpeg failed decoding {}",filepath_);
+
+    fmt::format_to(std::back_inserter(output_),
+                   " - output file name: {}\n"
+                   " - sample count: {}\n"
+                   " - input file size: {}b\n"
+                   " - output file size: {}b\n"
+                   ,
+                   output_filepath_,
+                   offset,
+                   offset * 2,
+                   offset + padding);
+  }
+
+  /*
+    Channels 0 keeps the input's channel count. auto input is probed
+    and input ffprobe can't read is taken as raw with input_channels_.
+    More than two channels are mixed down to stereo.
+  */
+  static
+  int
+  output_channels(const std::filesystem::path &filepath_,
+                  const std::string           &input_type_,
+                  const int                    channels_,
+                  const int                    input_channels_)
+  {
+    int channels;
+
+    if(channels_ != 0)
+      return channels_;
+
+    channels = -1;
+    if((input_type_ == "auto") && !file::is_stdio(filepath_))
+      channels = ffmpeg::channels(filepath_);
+    if(channels < 1)
+      channels = ((input_channels_ != 0) ? input_channels_ : 1);
+
+    return std::min(channels,2);
+  }
+
+  static
+  std::filesystem::path
+  output_filepath(const std::filesystem::path &filepath_,
+                  const std::filesystem::path &dirpath_,
+                  const int                    channels_,
+                  const int                    freq_,
+                  const std::string           &output_type_)
+  {
+    std::filesystem::path output_filepath;
+
+    output_filepath  = (dirpath_ / filepath_.filename());
+    output_filepath += fmt::format(".sdx2.{}ch.{}hz.{}",channels_,freq_,output_type_);
+
+    return output_filepath;
+  }
+
   static
   void
   to_sdx2(const std::filesystem::path &filepath_,
+          const std::filesystem::path &output_filepath_,
           const std::string           &input_type_,
           const std::string           &output_type_,
           const std::string           &encoder_,
           const int                    channels_,
-          const int                    freq_)
+          const int                    freq_,
+          const unsigned               threads_,
+          const int                    resync_max_error_,
+          const int                    input_channels_,
+          const int                    input_freq_,
+          const u8                     quality_,
+          ffmpeg::GroupDecoder        *group_,
+          std::string                 &output_)
   {
     std::vector<s16> input_data;
     std::vector<s8>  output_data;
-    std::filesystem::path output_filepath;
 
-    input_data = l::load_file(input_type_,filepath_,channels_,freq_);
+    // Splitting for threads and group decoding need the whole input
+    // up front.
+    if((output_type_ == "raw") &&
+       (encoder_ == "default") &&
+       (threads_ <= 1) &&
+       ((group_ == NULL) || file::is_stdio(filepath_)))
+      return l::to_sdx2_stream(filepath_,
+                               output_filepath_,
+                               input_type_,
+                               channels_,
+                               freq_,
+                               input_channels_,
+                               input_freq_,
+                               quality_,
+                               output_);
+
+    input_data = l::load_file(input_type_,
+                              filepath_,
+                              channels_,
+                              freq_,
+                              input_channels_,
+                              input_freq_,
+                              quality_,
+                              group_);
     if(input_data.empty())
       throw fmt::exception("failed to load {}",filepath_);
 
-    output_filepath = filepath_;
-    output_filepath += fmt::format(".sdx2.{}ch.{}hz.{}",channels_,freq_,output_type_);
-
     // 8bits per sample
     output_data.resize(input_data.size());
 
@@ -86,11 +348,13 @@ namespace l
 
     if(encoder_ == "default")
       {
-        sdx2_encode(input_data.data(),
-                  input_data.size(),
-                  channels_,
-                  output_data.data(),
-                  output_data.size());
+        sdx2_encode_mt(input_data.data(),
+                       input_data.size(),
+                       channels_,
+                       output_data.data(),
+                       output_data.size(),
+                       threads_,
+                       resync_max_error_);
       }
     else
       {
@@ -102,16 +366,16 @@ namespace l
         u64 rv;
         FILE *out_file;
 
-        out_file = fopen(output_filepath.string().c_str(),"wb");
+        out_file = file::open_output(output_filepath_);
         if(out_file == NULL)
-          throw fmt::exception("failed to open output {}",output_filepath);
+          throw fmt::exception("failed to open output {}",output_filepath_);
 
         rv = fwrite(output_data.data(),
                     sizeof(decltype(output_data)::value_type),
                     output_data.size(),
                     out_file);
 
-        fclose(out_file);
+        file::close_output(out_file);
 
         if(rv != output_data.size())
           throw fmt::exception("failed to write all data to file {} / {}",
@@ -121,63 +385,184 @@ namespace l
     else if(output_type_ == "aifc")
       {
         u64 rv;
-        const std::string format = "u8";
-        const std::string codec = "sdx2_dpcm";
-
-        rv = ffmpeg::write(output_data.data(),
-                           output_data.size(),
-                           output_filepath,
-                           format,
-                           codec,
-                           channels_,
-                           freq_);
+
+        rv = aiff::write_compressed(output_data.data(),
+                                    output_data.size(),
+                                    output_filepath_,
+                                    "SDX2",
+                                    channels_,
+                                    freq_,
+                                    input_data.size() / channels_);
         if(rv != output_data.size())
           throw fmt::exception("failed to write all data to file {} / {}",
                                rv,
                                output_data.size());
       }
 
-    fmt::print(" - output file name: {}\n"
-               " - sample count: {}\n"
-               " - input file size: {}b\n"
-               " - output file size: {}b\n"
-               ,
-               output_filepath,
-               input_data.size(),
-               input_data.size() * 2,
-               output_data.size());
+    fmt::format_to(std::back_inserter(output_),
+                   " - output file name: {}\n"
+                   " - sample count: {}\n"
+                   " - input file size: {}b\n"
+                   " - output file size: {}b\n"
+                   ,
+                   output_filepath_,
+                   input_data.size(),
+                   input_data.size() * 2,
+                   output_data.size());
   }
 }
 
 void
 SubCmd::to_sdx2(const Opts::ToSDX2 &opts_)
 {
-  if(opts_.output_type != "raw")
+  bool grouped;
+  batch::Walk walk;
+  std::unique_ptr<cache::Store> cache;
+  std::unique_ptr<ffmpeg::GroupDecoder> group;
+  std::vector<std::filesystem::path> inputs;
+  std::vector<std::filesystem::path> filepaths;
+
+  batch::init_stdio(opts_.filepaths,opts_.output_file);
+
+  batch::OutputDirs dirpaths(opts_.filepaths,opts_.output_path);
+
+  walk    = {opts_.recursive,opts_.include,opts_.exclude};
+  // A group is decoded to one channel count so inputs keeping their
+  // own aren't grouped.
+  grouped = ((opts_.input_type == "auto") &&
+             (opts_.ffmpeg_group > 1) &&
+             (opts_.output_channels != 0));
+
+  // Grouped decoding needs every file up front so it can't overlap
+  // with the walk.
+  inputs = opts_.filepaths;
+  if(grouped)
+    inputs = batch::expand(opts_.filepaths,walk,opts_.jobs);
+
+  filepaths = inputs;
+  if(!opts_.cache_dir.empty())
     {
-      if(!ffmpeg::ffmpeg_available())
-        throw std::runtime_error("ffmpeg executable not found");
+      cache.reset(new cache::Store(opts_.cache_dir,
+                                   opts_.cache_size,
+                                   fmt::format("sdx2;{};{};{};{};{};{};{};{};{};{}",
+                                               opts_.input_type,
+                                               opts_.input_channels,
+                                               opts_.input_freq,
+                                               opts_.resample_quality,
+                                               opts_.output_type,
+                                               opts_.encoder,
+                                               opts_.output_channels,
+                                               opts_.output_freq,
+                                               opts_.threads,
+                                               opts_.resync_max_error)));
+      if(grouped)
+        filepaths = cache->uncached(inputs,opts_.jobs);
     }
 
-  for(auto &filepath : opts_.filepaths)
-    {
-      fmt::print("{}:\n",filepath);
+  if(grouped)
+    group.reset(new ffmpeg::GroupDecoder(filepaths,
+                                         opts_.ffmpeg_group,
+                                         opts_.jobs,
+                                         opts_.output_channels,
+                                         opts_.output_freq));
 
-      try
-        {
-          l::to_sdx2(filepath,
-                     opts_.input_type,
-                     opts_.output_type,
-                     opts_.encoder,
-                     opts_.output_channels,
-                     opts_.output_freq);
-        }
-      catch(const std::system_error &e_)
-        {
-          fmt::print(" - ERROR - {} - {} ({})\n",filepath,e_.what(),e_.code().message());
-        }
-      catch(const std::runtime_error &e_)
-        {
-          fmt::print(" - ERROR - {} - {}\n",filepath,e_.what());
-        }
+  auto func = [&](const std::filesystem::path &filepath_,
+                  std::string                 &output_)
+  {
+    int channels;
+    bool cacheable;
+    std::filesystem::path output_filepath;
+
+    channels = l::output_channels(filepath_,
+                                  opts_.input_type,
+                                  opts_.output_channels,
+                                  opts_.input_channels);
+
+    output_filepath = batch::output_filepath(filepath_,
+                                             opts_.output_file,
+                                             l::output_filepath(filepath_,
+                                                                dirpaths.dirpath(filepath_),
+                                                                channels,
+                                                                opts_.output_freq,
+                                                                opts_.output_type));
+
+    // Pipes can't be hashed up front or copied out of the cache.
+    cacheable = (cache &&
+                 !file::is_stdio(filepath_) &&
+                 !file::is_stdio(output_filepath));
+
+    if(cacheable && cache->fetch(filepath_,output_filepath))
+      {
+        fmt::format_to(std::back_inserter(output_),
+                       " - output file name: {}\n"
+                       " - cache: hit\n"
+                       ,
+                       output_filepath);
+        return;
+      }
+
+    l::to_sdx2(filepath_,
+               output_filepath,
+               opts_.input_type,
+               opts_.output_type,
+               opts_.encoder,
+               channels,
+               opts_.output_freq,
+               opts_.threads,
+               opts_.resync_max_error,
+               opts_.input_channels,
+               opts_.input_freq,
+               pcm::resample_quality(opts_.resample_quality),
+               group.get(),
+               output_);
+
+    if(cacheable)
+      cache->insert(filepath_,output_filepath);
+  };
+
+  batch::run(inputs,walk,opts_.jobs,func);
+
+  if(cache)
+    {
+      cache->trim();
+      fmt::print(batch::report_file(),"{}",cache->summary());
     }
 }
+
+void
+SubCmd::to_sdx2_file(const Opts::ToSDX2          &opts_,
+                     const std::filesystem::path &filepath_,
+                     const std::filesystem::path &output_filepath_,
+                     std::string                 &output_)
+{
+  int channels;
+  std::filesystem::path output_filepath;
+
+  channels = l::output_channels(filepath_,
+                                opts_.input_type,
+                                opts_.output_channels,
+                                opts_.input_channels);
+
+  output_filepath = output_filepath_;
+  if(output_filepath.empty())
+    output_filepath = l::output_filepath(filepath_,
+                                         filepath_.parent_path(),
+                                         channels,
+                                         opts_.output_freq,
+                                         opts_.output_type);
+
+  l::to_sdx2(filepath_,
+             output_filepath,
+             opts_.input_type,
+             opts_.output_type,
+             opts_.encoder,
+             channels,
+             opts_.output_freq,
+             opts_.threads,
+             opts_.resync_max_error,
+             opts_.input_channels,
+             opts_.input_freq,
+             pcm::resample_quality(opts_.resample_quality),
+             NULL,
+             output_);
+}
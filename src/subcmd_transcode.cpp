@@ -0,0 +1,487 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "options.hpp"
+#include "subcmd.hpp"
+
+#include "batch.hpp"
+
+#include "aiff.hpp"
+#include "file.hpp"
+#include "pcm.hpp"
+#include "adp4_decode.h"
+#include "adp4_encode.h"
+#include "sdx2_decode.h"
+#include "sdx2_encode.h"
+
+#include "fmt.hpp"
+
+#include "types_ints.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+// Input bytes transcoded per block.
+#define STREAM_BLOCK_SIZE (1024 * 16)
+
+namespace l
+{
+  typedef std::function<u64(const u8*&)>          Source;
+  typedef std::function<void(const u8*,const u64)> Sink;
+
+  /*
+    Writes zeros after written_ bytes of output to reach word / 4
+    byte alignment for use with 3DO. Returns the padding written.
+  */
+  static
+  u64
+  pad(const u64   written_,
+      const Sink &write_)
+  {
+    u64 padding;
+    const u8 zeros[4] = {0,0,0,0};
+
+    padding = ((((written_ + 3) / 4) * 4) - written_);
+    if(padding > 0)
+      write_(zeros,padding);
+
+    return padding;
+  }
+
+  /*
+    SDX2 is decoded, mixed to the output channel count if it differs
+    and ADP4 encoded a block at a time so the intermediate PCM is
+    never larger than one block. Both codecs interleave stereo so
+    otherwise frames pass straight through. Blocks come from next_
+    which returns 0 at the end of the input and each encoded block
+    goes to write_ as it is produced. Returns the output sample count
+    and sets output_size_ to the bytes written.
+  */
+  static
+  u64
+  sdx2_to_adp4(const Source &next_,
+               const int     channels_,
+               const int     output_channels_,
+               const int     freq_,
+               const Sink   &write_,
+               u64          &output_size_)
+  {
+    u64 n;
+    u64 count;
+    u64 samples;
+    u64 written;
+    const u8 *input;
+    const s16 *block;
+    pcm::Converter converter;
+    sdx2_decoder_t decoder;
+    adp4_encoder_t encoder;
+    std::vector<s16> ibuf;
+    std::vector<u8>  obuf;
+
+    sdx2_decoder_init(&decoder,channels_);
+    adp4_encoder_init(&encoder,output_channels_);
+    converter.init(channels_,freq_,output_channels_,freq_,pcm::resample_quality("medium"));
+
+    ibuf.resize(STREAM_BLOCK_SIZE);
+
+    auto encode = [&](const s16 *block_,
+                      const u64  count_)
+    {
+      u64 rv;
+
+      // 4bits per sample, 2 samples per byte
+      if(obuf.size() < ((count_ + 1) / 2))
+        obuf.resize((count_ + 1) / 2);
+
+      rv = adp4_encoder_feed(&encoder,block_,count_,obuf.data());
+      write_(obuf.data(),rv);
+
+      written += rv;
+      samples += count_;
+    };
+
+    samples = 0;
+    written = 0;
+    while((n = next_(input)) > 0)
+      {
+        sdx2_decoder_feed(&decoder,
+                          input,
+                          n,
+                          ibuf.data(),
+                          ibuf.size());
+
+        block = ibuf.data();
+        count = n;
+        if(converter.active())
+          block = converter.feed(block,count,count);
+
+        encode(block,count);
+      }
+
+    if(converter.active())
+      {
+        block = converter.flush(count);
+        encode(block,count);
+      }
+
+    obuf.resize(std::max<size_t>(obuf.size(),1));
+    count = adp4_encoder_flush(&encoder,obuf.data());
+    write_(obuf.data(),count);
+    written += count;
+
+    output_size_ = (written + l::pad(written,write_));
+
+    return samples;
+  }
+
+  /*
+    Every ADP4 block decodes, is mixed to the output channel count if
+    it differs, and goes straight into the SDX2 encoder so the
+    intermediate PCM is never larger than one block. At most
+    sample_count_ input samples are decoded. Otherwise as
+    sdx2_to_adp4().
+  */
+  static
+  u64
+  adp4_to_sdx2(const Source &next_,
+               const u64     sample_count_,
+               const int     channels_,
+               const int     output_channels_,
+               const int     freq_,
+               const Sink   &write_,
+               u64          &output_size_)
+  {
+    u64 n;
+    u64 count;
+    u64 decoded;
+    u64 samples;
+    u32 pending;
+    const u8 *input;
+    const s16 *block;
+    pcm::Converter converter;
+    adp4_decoder_t decoder;
+    sdx2_encoder_t encoder;
+    std::vector<s16> ibuf;
+    std::vector<s8>  obuf;
+
+    adp4_decoder_init(&decoder,channels_);
+    sdx2_encoder_init(&encoder,output_channels_);
+    converter.init(channels_,freq_,output_channels_,freq_,pcm::resample_quality("medium"));
+
+    // ADP4 is 4bits per sample, 2 samples per byte
+    ibuf.resize(STREAM_BLOCK_SIZE * 2);
+    obuf.resize(STREAM_BLOCK_SIZE * 2);
+
+    auto encode = [&](const s16 *block_,
+                      const u64  count_)
+    {
+      if(obuf.size() < count_)
+        obuf.resize(count_);
+
+      sdx2_encoder_feed(&encoder,
+                        block_,
+                        count_,
+                        obuf.data(),
+                        obuf.size());
+      write_((const u8*)obuf.data(),count_);
+
+      samples += count_;
+    };
+
+    decoded = 0;
+    samples = 0;
+    while((decoded < sample_count_) && ((n = next_(input)) > 0))
+      {
+        adp4_decoder_feed(&decoder,
+                          input,
+                          n,
+                          ibuf.data());
+
+        count    = std::min<u64>(n * 2,sample_count_ - decoded);
+        decoded += count;
+
+        block = ibuf.data();
+        if(converter.active())
+          block = converter.feed(block,count,count);
+
+        encode(block,count);
+      }
+
+    if(converter.active())
+      {
+        block = converter.flush(count);
+        encode(block,count);
+      }
+
+    pending = 0;
+    sdx2_encoder_flush(&encoder,
+                       obuf.data(),
+                       obuf.size(),
+                       &pending);
+    write_((const u8*)obuf.data(),pending);
+
+    output_size_ = ((samples + pending) +
+                    l::pad(samples + pending,write_));
+
+    return samples;
+  }
+
+  static
+  void
+  transcode(const std::filesystem::path &filepath_,
+            const std::filesystem::path &output_file_,
+            const std::string           &to_,
+            const std::string           &output_type_,
+            int                          channels_,
+            int                          output_channels_,
+            int                          freq_,
+            std::string                 &output_)
+  {
+    u64 count;
+    u64 offset;
+    u64 input_size;
+    u64 output_size;
+    u64 sample_count;
+    bool pending;
+    bool streaming;
+    FILE *out_file;
+    aiff::Info info;
+    file::View input_file;
+    file::Reader input_stdin;
+    const u8 *input_data;
+    std::string from;
+    std::string compression;
+    std::vector<u8> buf;
+    std::vector<u8> output_data;
+    std::filesystem::path output_filepath;
+
+    from        = ((to_ == "adp4") ? "sdx2" : "adp4");
+    compression = ((to_ == "adp4") ? "ADP4" : "SDX2");
+
+    auto next_stdin = [&](const u8 *&block_) -> u64
+    {
+      if(!pending)
+        count = input_stdin.read(buf.data(),buf.size());
+      pending     = false;
+      block_      = buf.data();
+      input_size += count;
+
+      return count;
+    };
+
+    auto next_mapped = [&](const u8 *&block_) -> u64
+    {
+      u64 n;
+
+      n = std::min<u64>(STREAM_BLOCK_SIZE,input_size - offset);
+      block_  = &input_data[offset];
+      offset += n;
+
+      return n;
+    };
+
+    // Raw stdin is transcoded as it arrives. AIFF-C has to be parsed
+    // as a whole.
+    count        = 0;
+    pending      = false;
+    streaming    = false;
+    sample_count = ~(u64)0;
+    if(file::is_stdio(filepath_))
+      {
+        input_stdin.open(filepath_);
+        buf.resize(STREAM_BLOCK_SIZE);
+        count   = input_stdin.read(buf.data(),buf.size());
+        pending = true;
+        if(count == 0)
+          throw fmt::exception("failed to load {}",filepath_);
+
+        streaming = ((count < 4) || memcmp(buf.data(),"FORM",4));
+        if(!streaming)
+          {
+            std::vector<u8> rest;
+
+            rest = file::load_u8(filepath_);
+            buf.resize(count);
+            buf.insert(buf.end(),rest.begin(),rest.end());
+          }
+
+        input_data = buf.data();
+        input_size = buf.size();
+      }
+    else
+      {
+        input_file.open(filepath_);
+        if(input_file.empty())
+          throw fmt::exception("failed to load {}",filepath_);
+
+        input_data = input_file.data();
+        input_size = input_file.size();
+      }
+
+    // AIFF-C input carries its own layout, otherwise assume raw.
+    if(!streaming && aiff::parse(input_data,input_size,info))
+      {
+        if(info.compression == compression)
+          throw fmt::exception("input is already {}",compression);
+        if((info.compression != "SDX2") && (info.compression != "ADP4"))
+          throw fmt::exception("AIFF compression type '{}' is not SDX2 or ADP4",
+                               info.compression);
+        if((info.channels < 1) || (info.channels > 2))
+          throw fmt::exception("unsupported channel count {}",info.channels);
+
+        input_data   = info.sound_data;
+        input_size   = info.sound_data_size;
+        sample_count = ((u64)info.sample_frames * info.channels);
+        channels_    = info.channels;
+        freq_        = info.freq;
+      }
+
+    if(output_channels_ == 0)
+      output_channels_ = channels_;
+
+    output_filepath  = filepath_;
+    output_filepath += fmt::format(".{}.{}ch.{}hz.{}",to_,output_channels_,freq_,output_type_);
+    output_filepath  = batch::output_filepath(filepath_,
+                                              output_file_,
+                                              output_filepath);
+
+    // Raw output is written a block at a time, AIFF-C needs the sizes
+    // up front.
+    out_file = NULL;
+    if(output_type_ == "raw")
+      {
+        out_file = file::open_output(output_filepath);
+        if(out_file == NULL)
+          throw fmt::exception("failed to open output {}",output_filepath);
+      }
+
+    auto write = [&](const u8  *data_,
+                     const u64  size_)
+    {
+      if(out_file == NULL)
+        {
+          output_data.insert(output_data.end(),data_,data_ + size_);
+          return;
+        }
+
+      if(fwrite(data_,sizeof(u8),size_,out_file) != size_)
+        throw fmt::exception("failed to write all data to file {}",
+                             output_filepath);
+    };
+
+    offset = 0;
+    if(streaming)
+      input_size = 0;
+
+    try
+      {
+        if(to_ == "adp4")
+          {
+            // SDX2 is a byte per sample
+            if(!streaming)
+              input_size = std::min(input_size,sample_count);
+            sample_count = l::sdx2_to_adp4((streaming ? l::Source(next_stdin) : l::Source(next_mapped)),
+                                           channels_,
+                                           output_channels_,
+                                           freq_,
+                                           write,
+                                           output_size);
+          }
+        else
+          {
+            sample_count = l::adp4_to_sdx2((streaming ? l::Source(next_stdin) : l::Source(next_mapped)),
+                                           sample_count,
+                                           channels_,
+                                           output_channels_,
+                                           freq_,
+                                           write,
+                                           output_size);
+          }
+      }
+    catch(...)
+      {
+        if(out_file != NULL)
+          file::close_output(out_file);
+        throw;
+      }
+
+    if(out_file != NULL)
+      {
+        file::close_output(out_file);
+      }
+    else
+      {
+        u64 rv;
+
+        rv = aiff::write_compressed(output_data.data(),
+                                    output_data.size(),
+                                    output_filepath,
+                                    compression,
+                                    output_channels_,
+                                    freq_,
+                                    sample_count / output_channels_);
+        if(rv != output_data.size())
+          throw fmt::exception("failed to write all data to file {} / {}",
+                               rv,
+                               output_data.size());
+      }
+
+    fmt::format_to(std::back_inserter(output_),
+                   " - output file name: {}\n"
+                   " - input codec: {} {}ch {}hz\n"
+                   " - sample count: {}\n"
+                   " - input data size: {}b\n"
+                   " - output data size: {}b\n"
+                   ,
+                   output_filepath,
+                   from,
+                   channels_,
+                   freq_,
+                   sample_count,
+                   input_size,
+                   output_size);
+  }
+}
+
+void
+SubCmd::transcode(const Opts::Transcode &opts_)
+{
+  batch::init_stdio(opts_.filepaths,opts_.output_file);
+
+  auto func = [&](const std::filesystem::path &filepath_,
+                  std::string                 &output_)
+  {
+    l::transcode(filepath_,
+                 opts_.output_file,
+                 opts_.to,
+                 opts_.output_type,
+                 opts_.channels,
+                 opts_.output_channels,
+                 opts_.freq,
+                 output_);
+  };
+
+  batch::run(opts_.filepaths,
+             {opts_.recursive,opts_.include,opts_.exclude},
+             opts_.jobs,
+             func);
+}
@@ -0,0 +1,125 @@
+/*
+  ISC License
+
+  Copyright (c) 2024, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class ThreadPool
+{
+public:
+  typedef std::function<void(void)> Func;
+
+public:
+  ThreadPool(const unsigned thread_count_)
+  {
+    unsigned count;
+
+    count = ((thread_count_ > 0) ? thread_count_ : 1);
+    for(unsigned i = 0; i < count; i++)
+      _threads.emplace_back(&ThreadPool::_worker,this);
+  }
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _done = true;
+    }
+
+    _cv_queue.notify_all();
+    for(auto &thread : _threads)
+      thread.join();
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+public:
+  void
+  enqueue(Func func_)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _queue.emplace_back(std::move(func_));
+      _pending++;
+    }
+
+    _cv_queue.notify_one();
+  }
+
+  // Blocks until every queued job has finished.
+  void
+  wait(void)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _cv_idle.wait(lock,[this]{ return (_pending == 0); });
+  }
+
+  unsigned
+  size(void) const
+  {
+    return _threads.size();
+  }
+
+private:
+  void
+  _worker(void)
+  {
+    Func func;
+
+    while(true)
+      {
+        {
+          std::unique_lock<std::mutex> lock(_mutex);
+
+          _cv_queue.wait(lock,[this]{ return (_done || !_queue.empty()); });
+          if(_queue.empty())
+            return;
+
+          func = std::move(_queue.front());
+          _queue.pop_front();
+        }
+
+        func();
+
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _pending--;
+          if(_pending == 0)
+            _cv_idle.notify_all();
+        }
+      }
+  }
+
+private:
+  bool                     _done = false;
+  unsigned                 _pending = 0;
+  std::mutex               _mutex;
+  std::condition_variable  _cv_queue;
+  std::condition_variable  _cv_idle;
+  std::deque<Func>         _queue;
+  std::vector<std::thread> _threads;
+};